@@ -347,6 +347,9 @@ int main(int argc, char **argv)
 
     if(!hw_items && is_short) hw_item[hw_items++] = 2000;	/* all */
 
+    /* nobody is going to read the log */
+    if(!*log_file && !(showconfig && hd_data->debug == -1)) hd_data->log_level = log_none;
+
     if(hw_items >= 0 || showconfig || saveconfig) {
       if(*log_file) {
         if(!strcmp(log_file, "-")) {
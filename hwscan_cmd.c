@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "hwscan_cmd.h"
+
+int verbose = 0;
+hwscan_opt_t opt;
+
+#ifndef LIBHD_TINY
+
+static hd_t *read_config(hd_data_t *hd_data, char *id);
+
+int do_scan(hd_data_t *hd_data, hd_hw_item_t *items)
+{
+  int run_config = 0;
+  hd_status_t status = { };
+  hd_data_t *hd_data_tmp = NULL;
+  hd_t *hd, *hd1;
+  str_list_t *sl;
+  int err = 0, found_items = 0;
+  char *s;
+  FILE *f;
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  if(opt.fast) opt.fast = fast_ok(hd_data, items);
+
+  if(opt.boot && scan_disabled(hd_data)) {
+    if(hd_data_tmp) {
+      hd_free_hd_data(hd_data_tmp);
+      free(hd_data_tmp);
+    }
+    opt.paths = free_str_list(opt.paths);
+    return 0;
+  }
+
+  free_str_list(hd_data->only);
+  hd_data->only = opt.only;
+  opt.only = NULL;
+
+  hd_data->flags.list_all = 1;
+  hd_data->flags.fast = opt.fast;
+
+  /* rescanning parts needs the entries of a previous scan */
+  if(opt.paths && hd_data->hd) {
+    for(sl = opt.paths; sl; sl = sl->next) {
+      hd_free_hd_list(hd_rescan_sysfs_path(hd_data, sl->str));
+    }
+    hd = hd_list2(hd_data, items, 0);
+  }
+  else {
+    hd = hd_list2(hd_data, items, 1);
+  }
+  opt.paths = free_str_list(opt.paths);
+
+  if(hd) found_items = 1;
+
+  /* written in one go, if config.db is used */
+  hd_begin_config(hd_data);
+
+  for(hd1 = hd; hd1; hd1 = hd1->next) {
+    err = hd_write_config(hd_data, hd1);
+    if(verbose >= 2) {
+      printf(
+        "write=%d %s: (cfg=%s, avail=%s, need=%s, active=%s",
+        err,
+        hd1->unique_id,
+        hd_status_value_name(hd1->status.configured),
+        hd_status_value_name(hd1->status.available),
+        hd_status_value_name(hd1->status.needed),
+        hd_status_value_name(hd1->status.active)
+      );
+      if(hd1->unix_dev_name) {
+        printf(", dev=%s", hd1->unix_dev_name);
+      }
+      printf(
+        ") %s\n",
+        hd1->model
+      );
+
+    }
+    if(err) break;
+  }
+
+  if(err) {
+    fprintf(stderr,
+      "Error writing configuration for %s (%s)\n",
+      hd1->unique_id,
+      hd1->model
+    );
+    run_config = -1;
+  }
+
+  if(hd_commit_config(hd_data) && !err) {
+    fprintf(stderr, "Error writing configuration\n");
+    err = 1;
+    run_config = -1;
+  }
+
+  hd = hd_free_hd_list(hd);
+
+  if(!err) {
+    if(opt.new) {
+      status.configured = status_new;
+    }
+    else {
+      status.reconfig = status_yes;
+    }
+
+    hd = hd_list_with_status2(hd_data, items, status);
+    if(hd) run_config = 1;
+
+    if(verbose) {
+      for(hd1 = hd; hd1; hd1 = hd1->next) {
+        printf(
+          "%s: (cfg=%s, avail=%s, need=%s, active=%s",
+          hd1->unique_id,
+          hd_status_value_name(hd1->status.configured),
+          hd_status_value_name(hd1->status.available),
+          hd_status_value_name(hd1->status.needed),
+          hd_status_value_name(hd1->status.active)
+        );
+        if(hd1->unix_dev_name) {
+          printf(", dev=%s", hd1->unix_dev_name);
+        }
+        printf(
+          ") %s\n",
+          hd1->model
+        );
+      }
+    }
+    else if(!opt.silent) {
+      for(hd1 = hd; hd1; hd1 = hd1->next) printf("%s\n", hd1->unique_id);
+    }
+
+    hd = hd_free_hd_list(hd);
+
+    if(found_items) {
+      unlink(HARDWARE_DIR "/.update");		/* the old file */
+      s = hd_get_hddb_path("unique-keys/.update");
+      unlink(s);				/* so we trigger a rescan */
+      if((f = fopen(s, "a"))) fclose(f);
+    }
+  }
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+  else {
+    hd_data->only = free_str_list(hd_data->only);
+  }
+
+  return run_config < 0 ? -1 : run_config ^ 1;
+}
+
+
+int do_show(hd_data_t *hd_data, char *id)
+{
+  hd_data_t *hd_data_tmp = NULL;
+  hd_t *hd;
+  unsigned debug;
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  hd = read_config(hd_data, id);
+
+  if(hd) {
+    debug = hd_data->debug;
+    hd_data->debug = -1;
+    hd_dump_entry(hd_data, hd, stdout);
+    hd_data->debug = debug;
+    hd = hd_free_hd_list(hd);
+  }
+  else {
+    printf("no such hardware item: %s\n", id);
+  }
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+
+  return 0;
+}
+
+
+int do_list(hd_data_t *hd_data, hd_hw_item_t *items)
+{
+  hd_data_t *hd_data_tmp = NULL;
+  hd_t *hd, *hd_manual;
+  char *s;
+  char status[64];
+  int i;
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  hd_manual = hd_list(hd_data, hw_manual, 1, NULL);
+
+  for(hd = hd_manual; hd; hd = hd->next) {
+    if(opt.scan && ! has_hw_class(hd, items)) continue;
+
+    strcpy(status, "(");
+
+    i = 0;
+    if(hd->status.configured && (s = hd_status_value_name(hd->status.configured))) {
+      sprintf(status + strlen(status), "%scfg=%s", i ? ", " : "", s);
+      i++;
+    }
+
+    if(hd->status.available && (s = hd_status_value_name(hd->status.available))) {
+      sprintf(status + strlen(status), "%savail=%s", i ? ", " : "", s);
+      i++;
+    }
+
+    if(hd->status.needed && (s = hd_status_value_name(hd->status.needed))) {
+      sprintf(status + strlen(status), "%sneed=%s", i ? ", " : "", s);
+      i++;
+    }
+
+    if(hd->status.active && (s = hd_status_value_name(hd->status.active))) {
+      sprintf(status + strlen(status), "%sactive=%s", i ? ", " : "", s);
+      i++;
+    }
+
+    strcat(status, ")");
+
+    s = hd_hw_item_name(hd->hw_class);
+    if(!s) s = "???";
+
+    printf("%s: %-32s %-16s %s\n", hd->unique_id, status, s, hd->model);
+    if(hd->config_string) {
+      printf("   configured as: \"%s\"\n", hd->config_string);
+    }
+  }
+
+  hd_free_hd_list(hd_manual);
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+
+  return 0;
+}
+
+
+int do_config(hd_data_t *hd_data, int type, char *val, char *id)
+{
+  hd_data_t *hd_data_tmp = NULL;
+  hd_t *hd;
+  hd_status_value_t status = 0;
+  int i;
+  char *s;
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  hd = read_config(hd_data, id);
+
+  if(hd) {
+    for(i = 1; i < 8; i++) {
+      s = hd_status_value_name(i);
+      if(s && !strcmp(val, s)) {
+        status = i;
+        break;
+      }
+    }
+    if(!status) {
+      printf("invalid status: %s\n", val);
+    }
+    else {
+      switch(type) {
+        case 1:
+          hd->status.configured = status;
+          break;
+
+        case 2:
+          hd->status.available = status;
+          break;
+
+        case 3:
+          hd->status.needed = status;
+          break;
+
+        case 4:
+          hd->status.active = status;
+          break;
+      }
+      hd_write_config(hd_data, hd);
+    }
+    hd = hd_free_hd_list(hd);
+  }
+  else {
+    printf("no such hardware item: %s\n", id);
+  }
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+
+  return 0;
+}
+
+
+int do_save_config(hd_data_t *hd_data)
+{
+  hd_data_t *hd_data_tmp = NULL;
+  int err;
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  err = hd_save_config(hd_data);
+
+  if(err) fprintf(stderr, "Error writing %s\n", hd_get_hddb_path("config.db"));
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+
+  return err;
+}
+
+
+/*
+ * Read config entry; id is either a unique id or a device name.
+ */
+hd_t *read_config(hd_data_t *hd_data, char *id)
+{
+  int nr = 0;
+  char *_id = NULL;
+  hd_t *hd, *hd_manual;
+
+  if(id[0] != '/') return hd_read_config(hd_data, id);
+
+  hd_manual = hd_list(hd_data, hw_manual, 1, NULL);
+  for(hd = hd_manual; hd; hd = hd->next) {
+    if(hd->status.available != status_yes) continue;
+    if(!search_str_list(hd->unix_dev_names, id)) continue;
+    _id = hd->unique_id;
+    nr++;
+  }
+
+  /* > 1 means our database is not okay */
+  hd = nr == 1 ? hd_read_config(hd_data, _id) : NULL;
+
+  hd_free_hd_list(hd_manual);
+
+  return hd;
+}
+
+
+/*
+ * Check whether we have been disabled via 'hwprobe=-scan'.
+ */
+int scan_disabled(hd_data_t *hd_data)
+{
+  unsigned char probe_save[sizeof hd_data->probe];
+  int disabled;
+
+  memcpy(probe_save, hd_data->probe, sizeof probe_save);
+
+  hd_clear_probe_feature(hd_data, pr_all);
+  hd_scan(hd_data);
+  hd_set_probe_feature(hd_data, pr_scan);
+  disabled = hd_probe_feature(hd_data, pr_scan) ? 0 : 1;
+
+  memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
+
+  return disabled;
+}
+
+
+/*
+ * Check whether a 'fast' scan would suffice to re-check the presence
+ * of all known hardware.
+ */
+int fast_ok(hd_data_t *hd_data, hd_hw_item_t *items)
+{
+  hd_data_t *hd_data_tmp = NULL;
+  hd_t *hd, *hd1;
+  int ok = 1;
+
+  if(!has_item(items, hw_mouse) && !has_item(items, hw_storage_ctrl)) {
+    return 1;
+  }
+
+  if(!hd_data) hd_data = hd_data_tmp = calloc(1, sizeof *hd_data);
+
+  hd_data->flags.list_all = 1;
+
+  hd = hd_list(hd_data, hw_manual, 1, NULL);
+
+  for(hd1 = hd; hd1; hd1 = hd1->next) {
+    /* serial mice */
+    if(hd1->hw_class == hw_mouse && hd1->bus.id == bus_serial) {
+      ok = 0;
+      break;
+    }
+    /* parallel zip */
+    if(hd1->hw_class == hw_storage_ctrl && hd1->bus.id == bus_parallel) {
+      ok = 0;
+      break;
+    }
+  }
+
+  hd_free_hd_list(hd);
+
+  if(hd_data_tmp) {
+    hd_free_hd_data(hd_data_tmp);
+    free(hd_data_tmp);
+  }
+
+  return ok;
+}
+
+
+/* check if item is in items */
+int has_item(hd_hw_item_t *items, hd_hw_item_t item)
+{
+  while(*items) if(*items++ == item) return 1;
+
+  return 0;
+}
+
+
+/* check if one of items is in hw_class */
+int has_hw_class(hd_t *hd, hd_hw_item_t *items)
+{
+  while(*items) if(hd_is_hw_class(hd, *items++)) return 1;
+
+  return 0;
+}
+
+
+#endif		/* !defined(LIBHD_TINY) */
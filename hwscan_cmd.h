@@ -0,0 +1,36 @@
+/*
+ * hwscan commands, shared by hwscan and hwscand.
+ *
+ * All functions take the hd_data_t to work with; pass NULL to have them
+ * use a temporary one.
+ */
+
+typedef struct {
+  unsigned show:1;
+  unsigned scan:1;
+  unsigned list:1;
+  unsigned config_cfg:1;
+  unsigned config_avail:1;
+  unsigned config_need:1;
+  unsigned config_active:1;
+  unsigned new:1;
+  unsigned fast:1;
+  unsigned silent:1;
+  unsigned boot:1;
+  unsigned save_config:1;
+  str_list_t *only;
+  str_list_t *paths;	/* do_scan(): just rescan these sysfs paths, cf. hd_rescan_sysfs_path() */
+} hwscan_opt_t;
+
+extern int verbose;
+extern hwscan_opt_t opt;
+
+int do_scan(hd_data_t *hd_data, hd_hw_item_t *items);
+int do_show(hd_data_t *hd_data, char *id);
+int do_list(hd_data_t *hd_data, hd_hw_item_t *items);
+int do_config(hd_data_t *hd_data, int type, char *val, char *id);
+int do_save_config(hd_data_t *hd_data);
+int scan_disabled(hd_data_t *hd_data);
+int fast_ok(hd_data_t *hd_data, hd_hw_item_t *items);
+int has_item(hd_hw_item_t *items, hd_hw_item_t item);
+int has_hw_class(hd_t *hd, hd_hw_item_t *items);
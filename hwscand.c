@@ -1,4 +1,3 @@
-
 /* hwscan front end
    Copyright 2004 by SUSE (<adrian@suse.de>) */
 
@@ -7,38 +6,131 @@
 #include <sys/msg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/utsname.h>
+#include <linux/netlink.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
 
+#include "hd.h"
+#include "hd_int.h"
+#include "hwscan_cmd.h"
 #include "init_message.h"
 
-#define TIMEOUT 2
-#define LONG_TIMEOUT 0
+#define DEBOUNCE 200		// default debounce window (ms)
+#define POLL_INTERVAL 5000	// media check interval for devices without kernel events (ms)
 #define BUFFERS 1024
+#define UEVENT_BUFFER (16 * 1024)
+#define ARENA_MAX (32 << 20)	// start over with a full scan if the scan arena gets larger
+
+// pseudo command: run config command
+#define COMMAND_CONFIG NR_COMMANDS
+
+// hardware items to scan for, cf. command_args
+static hd_hw_item_t command_item[NR_COMMANDS] = {
+	hw_block, hw_partition, hw_usb, hw_ieee1394, hw_pci, hw_pcmcia, hw_bluetooth
+};
+
+// kernel subsystems, cf. command_args
+static const char *command_subsystem[NR_COMMANDS] = {
+	"block", "block", "usb", "firewire", "pci", "pcmcia", "bluetooth"
+};
+
+// classes hd_rescan_sysfs_path() can handle, cf. command_args
+static const int command_rescan[NR_COMMANDS] = {
+	1, 1, 1, 0, 1, 0, 0
+};
+
+// pending request; requests for the same path are coalesced
+typedef struct event_s {
+	struct event_s *next;
+	int cmd;		// index into command_args or COMMAND_CONFIG
+	char *path;		// sysfs path, device name or config command
+	char *dev;		// device name, if command_with_device
+	long long due;		// handle after this time (ms)
+} event_t;
+
+// removable media device, registered via 'hwscanqueue --scan=dev'
+typedef struct {
+	char *dev;
+	int state;		// media present
+	int kernel_events;	// kernel reports media changes via uevent
+	long long next_check;	// (ms), if !kernel_events
+} media_t;
+
+static struct option options[] = {
+	{ "debounce", 1, NULL, 'd' },
+	{ }
+};
+
+// kept across all scans: hardware db, module aliases & device list are read
+// only once (and again when they change, cf. check_db())
+static hd_data_t *hd_data;
+// hd_data holds a full scan of this class: further events need only a rescan
+static int scanned[NR_COMMANDS];
+// db_stamp() of the files hd_data was set up with
+static unsigned long long db_last;
+static int scan_off;
+static int debounce = DEBOUNCE;
+static event_t *events;
+static media_t media[BUFFERS];
+static int media_nr;
+static int msgid;
+
+static long long msecs(void);
+static void add_event(int cmd, char *path, char *dev);
+static void run_events(long long now);
+static void scan_items(hd_hw_item_t *items, int silent, str_list_t *paths);
+static void scan_done(void);
+static int check_db(void);
+static unsigned long long db_stamp(void);
+static unsigned long long file_stamp(unsigned long long stamp, char *name);
+static void run_command(char *cmd);
+static int uevent_open(void);
+static void uevent_read(int fd);
+static void rescan_all(void);
+static void dev_name(char *dev, size_t size, char *name);
+static int ignore_block_dev(char *dev);
+static void add_media(char *dev);
+static void remove_media(char *dev);
+static void check_media(long long now);
+static void handle_message(char *p);
+static int msg_start(int epfd, int *msg_fd, pthread_t *tid);
+static void *msg_thread(void *arg);
+
 
 int main( int argc, char **argv )
 {
-        int ret, i;
-	key_t key = KEY;
-	int msgid;
-	int mode = 0;
-	int dev_nr = 0;
-	int lines = 0;
-	int block, usb, firewire, pci;
-	int dev_last_state[BUFFERS];
-	int dev_counter[BUFFERS];
-	char * command_device[NR_COMMANDS][BUFFERS];
-	time_t command_device_last[NR_COMMANDS][BUFFERS];
-	time_t last;
-	char **commands;
-	char **devices;
+        int ret, i, n, timeout;
+	int epfd, nl_fd, msg_fd[2];
 	char buffer[32];
+	long long now, next;
+	struct epoll_event ev, evs[8];
+	pthread_t msg_tid;
+	event_t *e;
 	message m;
 
+	while ( (i = getopt_long(argc, argv, "d:", options, NULL)) != -1 ){
+		switch ( i ){
+			case 'd':
+				debounce = atoi(optarg);
+				if ( debounce < 0 ) debounce = 0;
+				break;
+
+			default:
+				fprintf( stderr, "usage: hwscand [--debounce msecs]\n" );
+				exit(1);
+		}
+	}
+
 	// are we running already, maybe ?
 	{
 		do {
@@ -71,187 +163,675 @@ int main( int argc, char **argv )
 		close(ret);
 	}
 
-	// initialize ...
-	for ( i=0; i<NR_COMMANDS; i++ ){
-		command_device[i][0] = 0;
-		command_device_last[i][0] = 1;
+	hd_data = calloc(1, sizeof *hd_data);
+	hd_data->log_level = log_none;
+	db_last = db_stamp();
+	// same as 'hwscan --boot'
+	scan_off = scan_disabled(hd_data);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if ( epfd < 0 ){
+		perror("epoll_create1");
+		exit(1);
 	}
 
-	last=block=usb=firewire=pci=0;
-	commands = (char**) malloc( BUFFERS * sizeof(char*) );
-	devices  = (char**) malloc( BUFFERS * sizeof(char*) );
+	// kernel uevents
+	nl_fd = uevent_open();
+	if ( nl_fd >= 0 ){
+		memset(&ev, 0, sizeof ev);
+		ev.events = EPOLLIN;
+		ev.data.fd = nl_fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, nl_fd, &ev);
+	}else
+		perror("hwscand: no uevents");
 
-	msgid = msgget(key, IPC_CREAT | 0600);
-        if (msgid < 0) {
-		perror("msgget");
-		exit(1);
-        }
+	// message queue (hwscanqueue)
+	if ( msg_start(epfd, msg_fd, &msg_tid) ) exit(1);
 
 	while (1) {
-		if ( last || dev_nr )
-			mode = IPC_NOWAIT;
-		else
-			mode = 0;
-
-		if( msgrcv(msgid, &m, MESSAGE_BUFFER, 1, mode) >= 0 ){
-			char *p = m.mtext;
-
-			if ( p == 0 ){
-				fprintf( stderr, "hwscand: error, zero sized message\n" );
-			}else{
-				if ( p[0] == 'S' && strlen(p) > 1 ){
-					// scan calls
-					char z[2];
-					int c;
-					z[0] = *(p+1);
-					z[1] = '\0';
-					c = atoi(z);
-					if ( c < NR_COMMANDS ){
-						if ( ! command_with_device[c] ){
-							last = time(0L);
-							if ( LONG_TIMEOUT+command_device_last[c][0] < time(0L) )
-								command_device_last[c][0] = 0;
-						}else
-						for ( i=0; i<BUFFERS; i++ ){
-							if ( !command_device[c][i] ){
-								last = time(0L);
-								command_device[c][i] = strdup(p+2);
-								command_device[c][i+1] = 0;
-								command_device_last[c][i] = 0;
-								break;
-							}else if ( !strcmp(command_device[c][i], p+2) ){
-								last = time(0L);
-								if ( LONG_TIMEOUT+command_device_last[c][i] < time(0L) )
-									command_device_last[c][i] = 0;
-								break;
-							}
-						}
-					}
-				}
-				if ( p[0] == 'C' && lines < BUFFERS ){
-					last = time(0L);
-					// config calls
-					commands[lines] = strdup(p+1);
-					lines++;	
-				}
-				if ( p[0] == 'A' && dev_nr < BUFFERS ){	
-					// add scan devices
-					devices[dev_nr]        = strdup(p+1);
-					dev_last_state[dev_nr] = 0;
-					dev_counter[dev_nr]    = 0;
-					dev_nr++;
-				}
-				if ( p[0] == 'R' && dev_nr < BUFFERS ){	
-					for ( i=0; i<dev_nr; i++ ){
-						if ( !strcmp(p+1, devices[i]) ){
-							int j;
-							free(devices[i]);
-							for ( j=i; j+1<dev_nr; j++ ){
-								devices[j]        = devices[j+1];
-								dev_last_state[j] = dev_last_state[j+1];
-								dev_counter[j]    = dev_counter[j+1];
-							}
-							dev_nr--;
-						}
-					}
+		// sleep until the next request is due
+		now = msecs();
+		next = -1;
+		for ( e=events; e; e=e->next )
+			if ( next < 0 || e->due < next ) next = e->due;
+		for ( i=0; i<media_nr; i++ )
+			if ( !media[i].kernel_events && (next < 0 || media[i].next_check < next) ) next = media[i].next_check;
+		timeout = next < 0 ? -1 : next <= now ? 0 : next - now;
+
+		n = epoll_wait(epfd, evs, sizeof evs / sizeof *evs, timeout);
+		if ( n < 0 && errno != EINTR ){
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		for ( i=0; i<n; i++ ){
+			if ( evs[i].data.fd == nl_fd ){
+				uevent_read(nl_fd);
+			}else if ( evs[i].data.fd == msg_fd[0] ){
+				ret = read(msg_fd[0], &m, sizeof m);
+				if ( ret == sizeof m ){
+					handle_message(m.mtext);
+				}else if ( ret == 0 ){
+					// the queue is gone (msg_thread() quit), create a new one
+					epoll_ctl(epfd, EPOLL_CTL_DEL, msg_fd[0], NULL);
+					close(msg_fd[0]);
+					pthread_join(msg_tid, NULL);
+					if ( msg_start(epfd, msg_fd, &msg_tid) ) exit(1);
 				}
 			}
+		}
+
+		now = msecs();
+		check_media(now);
+		run_events(now);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Monotonic time in ms.
+ */
+long long msecs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * Queue request; a pending request for the same path is postponed.
+ */
+void add_event(int cmd, char *path, char *dev)
+{
+	event_t *e, **next;
+
 #if DEBUG
-				printf("CALL RECEIVED %s\n", p);
+	printf("EVENT %d %s %s\n", cmd, path, dev ?: "");
 #endif
+
+	for ( next=&events; (e=*next); next=&e->next ){
+		if ( e->cmd == cmd && !strcmp(e->path, path) ){
+			e->due = msecs() + debounce;
+			return;
+		}
+	}
+
+	e = calloc(1, sizeof *e);
+	e->cmd = cmd;
+	e->path = strdup(path);
+	if ( dev ) e->dev = strdup(dev);
+	e->due = msecs() + debounce;
+	*next = e;
+}
+
+
+/*
+ * Handle all due requests.
+ *
+ * Scans for whole classes and for single devices run separately, as the
+ * device list would restrict the reported devices of all classes.
+ *
+ * Events for a device of an already scanned class only rescan the device's
+ * sysfs subtree; anything else means a full scan of the classes.
+ */
+void run_events(long long now)
+{
+	hd_hw_item_t items[NR_COMMANDS + 1], dev_items[NR_COMMANDS + 1];
+	int item_cnt = 0, dev_item_cnt = 0, full = 0, dev_full = 0;
+	event_t *e, **next, *config = NULL, **config_next = &config;
+	str_list_t *only = NULL, *paths = NULL, *dev_paths = NULL;
+	char *s = NULL;
+	int i;
+
+	for ( next=&events; (e=*next); ){
+		if ( e->due > now ){
+			next = &e->next;
+			continue;
+		}
+		*next = e->next;
+		e->next = NULL;
+
+		if ( e->cmd == COMMAND_CONFIG ){
+			*config_next = e;
+			config_next = &e->next;
+			continue;
+		}
+
+		if ( e->dev ){
+			for ( i=0; i<dev_item_cnt && dev_items[i] != command_item[e->cmd]; i++ );
+			if ( i == dev_item_cnt ) dev_items[dev_item_cnt++] = command_item[e->cmd];
+			if ( !search_str_list(only, e->dev) ) add_str_list(&only, e->dev);
+			// a symlink name (e.g. /dev/cdrom) has no sysfs entry
+			str_printf(&s, 0, "/sys/class/block/%s", strrchr(e->dev, '/') ? strrchr(e->dev, '/') + 1 : e->dev);
+			if ( command_rescan[e->cmd] && scanned[e->cmd] && !access(s, F_OK) )
+				add_str_list(&dev_paths, s);
+			else
+				dev_full = 1;
 		}else{
-			// we do this only in scanning mode ...
+			for ( i=0; i<item_cnt && items[i] != command_item[e->cmd]; i++ );
+			if ( i == item_cnt ) items[item_cnt++] = command_item[e->cmd];
+			// uevents come with a sysfs path, class scan requests don't
+			if ( command_rescan[e->cmd] && scanned[e->cmd] && !strncmp(e->path, "/devices/", 9) )
+				add_str_list(&paths, e->path);
+			else
+				full = 1;
+		}
 
-			sleep(1);
-			for ( i=0; i<dev_nr; i++ ){
-				if (dev_counter[i]<0) continue;
-				dev_counter[i]++;
-				if ( dev_counter[i] > 5 ){
-					int fd;
-					char buf[MESSAGE_BUFFER];
-					dev_counter[i] = 0;
-					fd = open( devices[i], O_RDONLY );
-					strcpy( buf, "/sbin/hwscan --fast --partition --only=");
-					strcat( buf, devices[i] );
-					if ( fd < 0 ){
-						if ( dev_last_state[i] )
-							system(buf);
-						dev_last_state[i] = 0;
-					}else{
-						if ( dev_last_state[i] == 0)
-							system(buf);
-						dev_last_state[i] = 1;
-						close(fd);
-					}
-				}
-			}
+		free(e->path);
+		free(e->dev);
+		free(e);
+	}
+	items[item_cnt] = 0;
+	dev_items[dev_item_cnt] = 0;
+	free_mem(s);
+
+	if ( full ) paths = free_str_list(paths);
+	if ( dev_full ) dev_paths = free_str_list(dev_paths);
+
+	// same as 'hwscan --fast --boot --silent'
+	if ( !scan_off ){
+		if ( item_cnt ){
+			scan_items(items, 1, paths);
+			paths = NULL;
 		}
-		
-		if ( last && (last+TIMEOUT <= time(0L)) ){
-			char buf[MESSAGE_BUFFER * NR_COMMANDS];
-			int run_really = 0;
-
-			last=0;
-			strcpy( buf, "/sbin/hwscan --fast --boot --silent" );
-			for ( i=0; i<NR_COMMANDS; i++ ){
-				if ( command_with_device[i] == 0 &&
-				     command_device_last[i][0] == 0 ){
-					command_device_last[i][0] = time(0L);
-					strcat( buf, " --");
-					strcat( buf, command_args[i] );
-				 	run_really = 1;
-				} else {
-					int j;
-					int commappended = 0;
-
-					for ( j=0; j<BUFFERS; j++ ){
-						if ( !command_device[i][j] )
-							break;
-						if ( command_device_last[i][j] == 0 ){
-							if (!commappended) {
-								strcat( buf, " --");
-								strcat( buf, command_args[i] );
-								commappended = 1;
-						        }
-							strcat( buf, " --only=" );
-							strcat( buf, command_device[i][j] );
-							command_device_last[i][j] = time(0L);
-							run_really = 1;
-							if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER)
-								break;
-						}
-					}
-				}
-				if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER) {
-					last = time(0L);	/* call me again */
-					break;
-				}
-			}
+		if ( dev_item_cnt ){
+			opt.only = only;
+			only = NULL;
+			scan_items(dev_items, 1, dev_paths);
+			dev_paths = NULL;
+		}
+	}
+	free_str_list(only);
+	free_str_list(paths);
+	free_str_list(dev_paths);
 
-			if ( run_really ){
+	for ( ; (e=config); ){
 #if DEBUG
-				printf("RUN %s\n", buf);
-#endif
-				system(buf);
-#if DEBUG				
-				printf("RUN quit %s\n", buf);
+		printf("CALL DIRECT %s\n", e->path);
 #endif
-			}
-			if ( lines ){
-				for (i=0; i<lines; i++){
+		run_command(e->path);
+		config = e->next;
+		free(e->path);
+		free(e);
+	}
+}
+
+
+/*
+ * Scan for items, restricted to devices in opt.only (if any).
+ *
+ * If 'paths' is set, only rescan these sysfs paths (and take over the list).
+ */
+void scan_items(hd_hw_item_t *items, int silent, str_list_t *paths)
+{
+	int i, j;
+
 #if DEBUG
-				printf("CALL DIRECT %s\n", commands[i]);
+	for ( i=0; items[i]; i++ )
+		printf("RUN --%s\n", hd_hw_item_name(items[i]));
 #endif
-					system(commands[i]);
+
+	if ( check_db() ) paths = free_str_list(paths);
+
+	opt.fast = 1;
+	opt.silent = silent;
+	opt.paths = paths;
+	do_scan(hd_data, items);
+	fflush(stdout);
+
+	if ( !paths ){
+		for ( i=0; items[i]; i++ )
+			for ( j=0; j<NR_COMMANDS; j++ )
+				if ( command_item[j] == items[i] ) scanned[j] = 1;
+	}
+
+	scan_done();
+}
+
+
+/*
+ * Free what the last scan left over.
+ *
+ * The device list is kept for rescans. Arena memory is given back only by
+ * hd_reset_scan(); do that once the arena has grown too large. The next
+ * scan is then a full one again.
+ */
+void scan_done()
+{
+	int i;
+
+	hd_free_old_entries(hd_data);
+
+	if ( hd_data->flags.arena && hd_arena_size(hd_data) > ARENA_MAX ){
+		hd_reset_scan(hd_data);
+		for ( i=0; i<NR_COMMANDS; i++ ) scanned[i] = 0;
+	}
+}
+
+
+/*
+ * Start over if the hardware db or the module aliases have changed.
+ *
+ * Return 1 if hd_data was reset.
+ */
+int check_db()
+{
+	unsigned long long stamp;
+	int i;
+
+	stamp = db_stamp();
+	if ( stamp == db_last ) return 0;
+	db_last = stamp;
+
+	hd_free_hd_data(hd_data);
+	hd_data->log_level = log_none;
+	for ( i=0; i<NR_COMMANDS; i++ ) scanned[i] = 0;
+
+	return 1;
+}
+
+
+/*
+ * Fingerprint of the files hddb_init() reads.
+ */
+unsigned long long db_stamp()
+{
+	unsigned long long stamp = 1;
+	struct utsname ubuf;
+	str_list_t *sl, *ids;
+	char *s = NULL, *r;
+
+	stamp = file_stamp(stamp, hd_get_hddb_path("hd.ids"));
+	stamp = file_stamp(stamp, hd_get_hddb_path("hd.ids.bin"));
+	stamp = file_stamp(stamp, hd_get_hddb_path("ids"));
+
+	ids = read_dir(hd_get_hddb_path("ids"), 0);
+	for ( sl=ids; sl; sl=sl->next ){
+		str_printf(&s, 0, "ids/%s", sl->str);
+		stamp = file_stamp(stamp, hd_get_hddb_path(s));
+	}
+	free_str_list(ids);
+
+	if ( !uname(&ubuf) ){
+		r = getenv("LIBHD_KERNELVERSION");
+		if ( !r || !*r ) r = ubuf.release;
+		str_printf(&s, 0, "/lib/modules/%s/modules.alias", r);
+		stamp = file_stamp(stamp, s);
+	}
+
+	free_mem(s);
+
+	return stamp;
+}
+
+
+unsigned long long file_stamp(unsigned long long stamp, char *name)
+{
+	struct stat sbuf;
+
+	stamp *= 1000003;
+	if ( stat(name, &sbuf) ) return stamp;
+
+	stamp ^= sbuf.st_ino;
+	stamp = stamp * 1000003 ^ sbuf.st_size;
+	stamp = stamp * 1000003 ^ (sbuf.st_mtim.tv_sec * 1000000000ULL + sbuf.st_mtim.tv_nsec);
+
+	return stamp;
+}
+
+
+/*
+ * Run config command; hwscan calls are handled directly.
+ */
+void run_command(char *cmd)
+{
+	char name[16], val[64], id[MESSAGE_BUFFER];
+	int type = 0;
+
+	if ( sscanf(cmd, "/sbin/hwscan --%15[a-z]=%63s %1023s", name, val, id) == 3 ){
+		if ( !strcmp(name, "cfg") ) type = 1;
+		else if ( !strcmp(name, "avail") ) type = 2;
+		else if ( !strcmp(name, "need") ) type = 3;
+		else if ( !strcmp(name, "active") ) type = 4;
+	}
+
+	if ( type )
+		do_config(hd_data, type, val, id);
+	else
+		system(cmd);
+}
+
+
+/*
+ * Open netlink socket for kernel uevents.
+ */
+int uevent_open()
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+	int fd, size = 4 * 1024 * 1024;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if ( fd < 0 ) return -1;
+
+	// don't lose events in hotplug storms
+	if ( setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size) )
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+
+	if ( bind(fd, (struct sockaddr *) &addr, sizeof addr) ){
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * Read all pending uevents and queue scan requests for them.
+ *
+ * A uevent is "ACTION@DEVPATH" followed by "KEY=value" strings.
+ *
+ * Block device requests are keyed by device name, like those from the
+ * message queue, so both kinds are coalesced.
+ */
+void uevent_read(int fd)
+{
+	char buf[UEVENT_BUFFER + 1], dev[MESSAGE_BUFFER];
+	char *s, *action, *devpath, *subsystem, *devtype, *devname;
+	struct sockaddr_nl addr;
+	struct iovec iov = { .iov_base = buf, .iov_len = UEVENT_BUFFER };
+	struct msghdr msg = { .msg_name = &addr, .msg_namelen = sizeof addr, .msg_iov = &iov, .msg_iovlen = 1 };
+	int i, media_change;
+	ssize_t len;
+
+	while ( (len = recvmsg(fd, &msg, 0)) >= 0 || errno == EINTR || errno == ENOBUFS ){
+		// receive buffer overflowed: events are lost, we don't know which
+		if ( len < 0 && errno == ENOBUFS ) rescan_all();
+		if ( len <= 0 ) continue;
+
+		// only from kernel
+		if ( addr.nl_pid ) continue;
+
+		buf[len] = 0;
+		if ( !(devpath = strchr(buf, '@')) ) continue;
+		action = buf;
+		*devpath++ = 0;
+		subsystem = devtype = devname = NULL;
+		media_change = 0;
+
+		for ( s = devpath + strlen(devpath) + 1; s < buf + len; s += strlen(s) + 1 ){
+			if ( !strncmp(s, "SUBSYSTEM=", 10) ) subsystem = s + 10;
+			else if ( !strncmp(s, "DEVTYPE=", 8) ) devtype = s + 8;
+			else if ( !strncmp(s, "DEVNAME=", 8) ) devname = s + 8;
+			else if ( !strcmp(s, "DISK_MEDIA_CHANGE=1") || !strcmp(s, "DISK_EJECT_REQUEST=1") ) media_change = 1;
+		}
+
+		if ( !subsystem ) continue;
+
+		if ( !strcmp(subsystem, "block") ){
+			if ( !devname ) continue;
+			dev_name(dev, sizeof dev, devname);
+			if ( media_change ){
+				for ( i=0; i<media_nr && strcmp(media[i].dev, dev); i++ );
+				if ( i < media_nr ) add_event(1, dev, dev);
+				continue;
+			}
+			// nothing to configure there
+			if ( ignore_block_dev(dev) ) continue;
+			// a scan wouldn't find it anyway
+			if ( !strcmp(action, "remove") ) continue;
+			add_event(devtype && !strcmp(devtype, "partition") ? 1 : 0, dev, dev);
+			continue;
+		}
+
+		for ( i=0; i<NR_COMMANDS; i++ ){
+			if ( !command_with_device[i] && !strcmp(subsystem, command_subsystem[i]) ){
+				add_event(i, devpath, NULL);
+				break;
+			}
+		}
+	}
+}
+
+
+/*
+ * Queue scans of all classes (uevents were lost).
+ */
+void rescan_all()
+{
+	int i;
+
+	for ( i=0; i<NR_COMMANDS; i++ )
+		add_event(i, (char *) command_args[i], NULL);
+}
+
+
+/*
+ * Device file name for 'name' ("sdb" or "/dev/sdb").
+ */
+void dev_name(char *dev, size_t size, char *name)
+{
+	*dev = 0;
+	if ( *name != '/' ) strcat(dev, "/dev/");
+	strncat(dev, name, size - strlen(dev) - 1);
+}
+
+
+/*
+ * Block devices not worth a scan: loop, ram & device mapper devices come
+ * and go all the time.
+ */
+int ignore_block_dev(char *dev)
+{
+	if ( !strncmp(dev, "/dev/", 5) ) dev += 5;
+
+	return
+		!strncmp(dev, "loop", 4) ||
+		!strncmp(dev, "ram", 3) ||
+		!strncmp(dev, "dm-", 3);
+}
+
+
+/*
+ * Register media device.
+ *
+ * If the kernel polls the device, media changes come in as uevents;
+ * else we have to check it ourselves.
+ *
+ * The kernel polls only if the device supports media change events and
+ * the poll interval is > 0 (events_poll_msecs; -1: use the block module's
+ * events_dfl_poll_msecs).
+ */
+void add_media(char *dev)
+{
+	media_t *m;
+	char *s = NULL, *name;
+	str_list_t *sl;
+	long poll_msecs = 0;
+
+	if ( media_nr >= BUFFERS ) return;
+
+	m = media + media_nr++;
+	memset(m, 0, sizeof *m);
+	m->dev = strdup(dev);
+
+	name = strrchr(dev, '/');
+	name = name ? name + 1 : dev;
+
+	str_printf(&s, 0, "/sys/class/block/%s/events", name);
+	sl = read_file(s, 0, 1);
+	m->kernel_events = sl && strstr(sl->str, "media_change") ? 1 : 0;
+	free_str_list(sl);
+
+	if ( m->kernel_events ){
+		str_printf(&s, 0, "/sys/class/block/%s/events_poll_msecs", name);
+		sl = read_file(s, 0, 1);
+		if ( sl ) poll_msecs = strtol(sl->str, NULL, 10);
+		free_str_list(sl);
+
+		if ( poll_msecs < 0 ){
+			sl = read_file("/sys/module/block/parameters/events_dfl_poll_msecs", 0, 1);
+			poll_msecs = sl ? strtol(sl->str, NULL, 10) : 0;
+			free_str_list(sl);
+		}
+
+		if ( poll_msecs <= 0 ) m->kernel_events = 0;
+	}
+
+	free_mem(s);
+
+	m->next_check = msecs() + POLL_INTERVAL;
+}
+
+
+void remove_media(char *dev)
+{
+	int i;
+
+	for ( i=0; i<media_nr; i++ ){
+		if ( !strcmp(dev, media[i].dev) ){
+			free(media[i].dev);
+			memmove(media + i, media + i + 1, (media_nr - i - 1) * sizeof *media);
+			media_nr--;
+			i--;
+		}
+	}
+}
+
+
+/*
+ * Check devices without kernel events for media changes.
+ */
+void check_media(long long now)
+{
+	int i, fd;
+
+	for ( i=0; i<media_nr; i++ ){
+		if ( media[i].kernel_events || media[i].next_check > now ) continue;
+		media[i].next_check = now + POLL_INTERVAL;
+		fd = open( media[i].dev, O_RDONLY );
+		if ( (fd >= 0) != media[i].state ){
+			media[i].state = fd >= 0;
+			add_event(1, media[i].dev, media[i].dev);
+		}
+		if ( fd >= 0 ) close(fd);
+	}
+}
+
+
+/*
+ * Handle message from hwscanqueue.
+ */
+void handle_message(char *p)
+{
+	char z[2], dev[MESSAGE_BUFFER];
+	int c;
+
 #if DEBUG
-				printf("CALL quit %s\n", commands[i]);
+	printf("CALL RECEIVED %s\n", p);
 #endif
-					free(commands[i]);
-				}
-				lines=0;
-			}
+
+	if ( p[0] == 'S' && strlen(p) > 1 ){
+		// scan calls
+		z[0] = *(p+1);
+		z[1] = '\0';
+		c = atoi(z);
+		if ( c < NR_COMMANDS ){
+			if ( command_with_device[c] ){
+				dev_name(dev, sizeof dev, p+2);
+				add_event(c, dev, dev);
+			}else
+				add_event(c, (char *) command_args[c], NULL);
 		}
 	}
+	if ( p[0] == 'C' ){
+		// config calls
+		add_event(COMMAND_CONFIG, p+1, NULL);
+	}
+	if ( p[0] == 'A' ){
+		// add scan devices
+		dev_name(dev, sizeof dev, p+1);
+		add_media(dev);
+	}
+	if ( p[0] == 'R' ){
+		dev_name(dev, sizeof dev, p+1);
+		remove_media(dev);
+	}
+}
+
+
+/*
+ * Open the message queue and start msg_thread(); its messages arrive on
+ * msg_fd[0], which is added to epfd.
+ *
+ * msgrcv() can't be polled, so a thread feeds a pipe.
+ */
+int msg_start(int epfd, int *msg_fd, pthread_t *tid)
+{
+	key_t key = KEY;
+	struct epoll_event ev;
+
+	msgid = msgget(key, IPC_CREAT | 0600);
+	if ( msgid < 0 ){
+		perror("msgget");
+		return 1;
+	}
+
+	if ( pipe(msg_fd) ){
+		perror("hwscand: message queue");
+		return 1;
+	}
+	if ( pthread_create(tid, NULL, msg_thread, msg_fd + 1) ){
+		perror("hwscand: message queue");
+		close(msg_fd[0]);
+		close(msg_fd[1]);
+		return 1;
+	}
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.fd = msg_fd[0];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, msg_fd[0], &ev);
 
 	return 0;
 }
+
+
+/*
+ * Pass messages from the message queue to the main loop.
+ *
+ * If the queue has been removed, close the pipe; the main loop sees EOF
+ * and creates a new queue.
+ */
+void *msg_thread(void *arg)
+{
+	int fd = *(int *) arg;
+	message m;
+
+	while ( 1 ){
+		memset(&m, 0, sizeof m);
+		// MSG_NOERROR: truncate overlong messages instead of failing
+		if ( msgrcv(msgid, &m, MESSAGE_BUFFER, 1, MSG_NOERROR) < 0 ){
+			if ( errno == EINTR ) continue;
+			if ( errno == EIDRM || errno == EINVAL ) break;
+			perror("msgrcv");
+			sleep(1);
+			continue;
+		}
+		m.mtext[MESSAGE_BUFFER] = 0;
+		if ( !*m.mtext ){
+			fprintf( stderr, "hwscand: error, zero sized message\n" );
+			continue;
+		}
+		if ( write(fd, &m, sizeof m) != sizeof m ) break;
+	}
+
+	close(fd);
+
+	return NULL;
+}
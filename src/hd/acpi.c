@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "acpi.h"
+
+/**
+ * @defgroup ACPIint ACPI tables
+ * @ingroup libhdInternals
+ * @brief Binary ACPI tables (/sys/firmware/acpi/tables)
+ *
+ * @{
+ */
+
+#define ACPI_TABLE_DIR		"/sys/firmware/acpi/tables"
+#define ACPI_HEADER_SIZE	36
+
+static void read_acpi_dir(hd_data_t *hd_data, char *dir, unsigned *size);
+static void dump_acpi_table(hd_data_t *hd_data, hd_acpi_table_t *at);
+static int cmp_acpi_table(const void *p0, const void *p1);
+
+
+/*
+ * Read all ACPI tables (usually needs root).
+ *
+ * The tables are kept in hd_data->acpi, sorted by name; use hd_acpi_table()
+ * to look them up. Table contents are logged only with HD_DEB_BIOS.
+ */
+void hd_read_acpi_tables(hd_data_t *hd_data)
+{
+  unsigned u, size = 0;
+
+  hd_free_acpi_tables(hd_data);
+
+  read_acpi_dir(hd_data, ACPI_TABLE_DIR, &size);
+  read_acpi_dir(hd_data, ACPI_TABLE_DIR "/dynamic", &size);
+
+  if(!hd_data->acpi.len) {
+    ADD2LOG("acpi: no tables\n");
+
+    return;
+  }
+
+  qsort(hd_data->acpi.list, hd_data->acpi.len, sizeof *hd_data->acpi.list, cmp_acpi_table);
+
+  ADD2LOG("----- %s -----\n", "ACPI tables");
+  for(u = 0; u < hd_data->acpi.len; u++) {
+    dump_acpi_table(hd_data, hd_data->acpi.list + u);
+  }
+  ADD2LOG("----- %s end -----\n", "ACPI tables");
+}
+
+
+/*
+ * Look up ACPI table by name (e.g. "DSDT", "SSDT2").
+ */
+hd_acpi_table_t *hd_acpi_table(hd_data_t *hd_data, char *name)
+{
+  hd_acpi_table_t key = { };
+
+  if(!hd_data->acpi.len || !name || strlen(name) >= sizeof key.name) return NULL;
+
+  strcpy(key.name, name);
+
+  return bsearch(&key, hd_data->acpi.list, hd_data->acpi.len, sizeof key, cmp_acpi_table);
+}
+
+
+void hd_free_acpi_tables(hd_data_t *hd_data)
+{
+  unsigned u;
+
+  for(u = 0; u < hd_data->acpi.len; u++) {
+    free_mem(hd_data->acpi.list[u].data);
+  }
+
+  hd_data->acpi.list = free_mem(hd_data->acpi.list);
+  hd_data->acpi.len = 0;
+}
+
+
+void read_acpi_dir(hd_data_t *hd_data, char *dir, unsigned *size)
+{
+  str_list_t *sl, *sl0;
+  hd_acpi_table_t *at;
+  struct stat sbuf;
+  char *path = NULL;
+  unsigned len;
+  int fd, i;
+
+  for(sl = sl0 = read_dir(dir, 'r'); sl; sl = sl->next) {
+    if(strlen(sl->str) >= sizeof at->name) continue;
+
+    str_printf(&path, 0, "%s/%s", dir, sl->str);
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) continue;
+
+    if(!fstat(fd, &sbuf) && sbuf.st_size >= ACPI_HEADER_SIZE) {
+      if(hd_data->acpi.len == *size) {
+        *size += 0x10;
+        hd_data->acpi.list = resize_mem(hd_data->acpi.list, *size * sizeof *at);
+      }
+
+      at = hd_data->acpi.list + hd_data->acpi.len;
+      memset(at, 0, sizeof *at);
+      strcpy(at->name, sl->str);
+      at->data = new_mem(sbuf.st_size);
+
+      for(len = 0; len < sbuf.st_size; len += i) {
+        if((i = read(fd, at->data + len, sbuf.st_size - len)) <= 0) break;
+      }
+
+      if(len == sbuf.st_size) {
+        at->len = len;
+        hd_data->acpi.len++;
+      }
+      else {
+        at->data = free_mem(at->data);
+      }
+    }
+
+    close(fd);
+  }
+
+  free_mem(path);
+  free_str_list(sl0);
+}
+
+
+/*
+ * Log table header & (with HD_DEB_BIOS) contents.
+ */
+void dump_acpi_table(hd_data_t *hd_data, hd_acpi_table_t *at)
+{
+  unsigned char *d = at->data;
+  unsigned u;
+
+  ADD2LOG(
+    "  %s: sig %.4s, len %u, rev %u, oem \"%.6s\" \"%.8s\" 0x%x\n",
+    at->name, d, at->len, d[8], d + 10, d + 16,
+    d[24] + (d[25] << 8) + (d[26] << 16) + ((unsigned) d[27] << 24)
+  );
+
+  if(!(hd_data->debug & HD_DEB_BIOS)) return;
+
+  for(u = 0; u < at->len; u += 0x10) {
+    ADD2LOG_DATA("    ");
+    hd_log_hex(hd_data, 1, at->len - u >= 0x10 ? 0x10 : at->len - u, at->data + u);
+    ADD2LOG_DATA("\n");
+  }
+}
+
+
+int cmp_acpi_table(const void *p0, const void *p1)
+{
+  return strcmp(((const hd_acpi_table_t *) p0)->name, ((const hd_acpi_table_t *) p1)->name);
+}
+
+/** @} */
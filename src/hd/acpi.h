@@ -0,0 +1,3 @@
+void hd_read_acpi_tables(hd_data_t *hd_data);
+hd_acpi_table_t *hd_acpi_table(hd_data_t *hd_data, char *name);
+void hd_free_acpi_tables(hd_data_t *hd_data);
@@ -27,6 +27,7 @@
 #include "bios.h"
 #include "smbios.h"
 #include "klog.h"
+#include "acpi.h"
 
 /**
  * @defgroup BIOSint BIOS information
@@ -180,7 +181,7 @@ void hd_scan_bios(hd_data_t *hd_data)
   vbe_info_t *vbe;
   vbe_mode_info_t *mi;
   hd_res_t *res;
-  str_list_t *sl, *sl0;
+  str_list_t *sl;
 
   if(!hd_probe_feature(hd_data, pr_bios)) return;
 
@@ -536,14 +537,7 @@ void hd_scan_bios(hd_data_t *hd_data)
   if(hd_probe_feature(hd_data, pr_bios_acpi)) {
     PROGRESS(6, 0, "acpi");
 
-    if((sl0 = read_file("|/usr/sbin/acpidump 2>/dev/null", 0, 0))) {
-      ADD2LOG("----- %s -----\n", "ACPI dump");
-      for(sl = sl0; sl; sl = sl->next) {
-        ADD2LOG("%s", sl->str);
-      }
-      ADD2LOG("----- %s end -----\n", "ACPI dump");
-      free_str_list(sl0);
-    }
+    hd_read_acpi_tables(hd_data);
   }
 }
 
@@ -576,13 +570,13 @@ void dump_memory(hd_data_t *hd_data, memory_range_t *mem, int sparse, char *labe
   step = 0x10;
 #endif
 
-  ADD2LOG("----- %s 0x%05x - 0x%05x -----\n", label, mem->start, mem->start + mem->size - 1);
+  ADD2LOG_DATA("----- %s 0x%05x - 0x%05x -----\n", label, mem->start, mem->start + mem->size - 1);
   for(u = 0; u < mem->size; u += step) {
-    ADD2LOG("  %03x  ", u + mem->start);
+    ADD2LOG_DATA("  %03x  ", u + mem->start);
     hd_log_hex(hd_data, 1, mem->size - u > 0x10 ? 0x10 : mem->size - u, mem->data + u);
-    ADD2LOG("\n");
+    ADD2LOG_DATA("\n");
   }
-  ADD2LOG("----- %s end -----\n", label);
+  ADD2LOG_DATA("----- %s end -----\n", label);
 }
 
 
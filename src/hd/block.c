@@ -14,6 +14,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "sysfs.h"
 #include "hddb.h"
 #include "block.h"
 #include "dvd.h"
@@ -38,6 +39,9 @@ static cdrom_info_t *new_cdrom_entry(cdrom_info_t **ci);
 static cdrom_info_t *get_cdrom_entry(cdrom_info_t *ci, int n);
 static void get_scsi_tape(hd_data_t *hd_data);
 static void get_generic_scsi_devs(hd_data_t *hd_data);
+static void read_scsi_transport(hd_data_t *hd_data);
+static hd_scsi_transport_t *get_scsi_transport(hd_data_t *hd_data, char *hctl);
+static int cmp_scsi_transport(const void *p0, const void *p1);
 static void add_disk_size(hd_data_t *hd_data, hd_t *hd);
 
 
@@ -102,20 +106,13 @@ void get_block_devs(hd_data_t *hd_data)
   str_list_t *sf_bus, *sf_bus_e;
   char *sf_block_dir;
 
-  hd_data->lsscsi = free_str_list(hd_data->lsscsi);
-  hd_data->lsscsi = read_file("|/usr/bin/lsscsi -t 2>/dev/null", 0, 0);
-
-  ADD2LOG("-----  lsscsi -----\n");
-  for(sl = hd_data->lsscsi; sl; sl = sl->next) {
-    ADD2LOG("  %s", sl->str);
-  }
-  ADD2LOG("-----  lsscsi end -----\n");
+  read_scsi_transport(hd_data);
 
   sf_bus = read_dir("/sys/bus/ide/devices", 'l');
 
   if(sf_bus) {
     for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-      sf_dev = new_str(hd_read_sysfs_link("/sys/bus/ide/devices", sf_bus_e->str));
+      sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/ide/devices", sf_bus_e->str));
       ADD2LOG(
         "  ide: bus_id = %s path = %s\n",
         sf_bus_e->str,
@@ -145,6 +142,13 @@ void get_block_devs(hd_data_t *hd_data)
 
   for(sf_class_e = sf_class; sf_class_e; sf_class_e = sf_class_e->next) {
     str_printf(&sf_cdev, 0, "%s/%s", sf_block_dir, sf_class_e->str);
+
+    /* cf. hd_rescan_sysfs_path() */
+    if(
+      !hd_sysfs_in_scope(hd_data, sf_cdev) &&
+      !hd_sysfs_in_scope(hd_data, hd_sysfs_link(hd_data, sf_cdev, "device"))
+    ) continue;
+
     ADD2LOG(
       "  block: name = %s, path = %s\n",
       sf_class_e->str,
@@ -168,12 +172,12 @@ void get_block_devs(hd_data_t *hd_data)
       ADD2LOG("    range = %u\n", dev_num.range);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
     sf_drv_name = NULL;
-    sf_drv = hd_read_sysfs_link(sf_dev, "driver");
+    sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver");
     if(!sf_drv) {
       /* maybe older kernel */
-      sf_drv = hd_read_sysfs_link(sf_cdev, "driver");
+      sf_drv = hd_sysfs_link(hd_data, sf_cdev, "driver");
     }
     if(sf_drv) {
       sf_drv_name = strrchr(sf_drv, '/');
@@ -187,8 +191,8 @@ void get_block_devs(hd_data_t *hd_data)
 
     bus_name = NULL;
     if(
-      (s = hd_read_sysfs_link(sf_dev, "subsystem")) ||
-      (s = hd_read_sysfs_link(sf_dev, "bus"))
+      (s = hd_sysfs_link(hd_data, sf_dev, "subsystem")) ||
+      (s = hd_sysfs_link(hd_data, sf_dev, "bus"))
     ) {
       bus_name = strrchr(s, '/');
       if(bus_name) bus_name++;
@@ -263,6 +267,7 @@ void get_block_devs(hd_data_t *hd_data)
       hd->base_class.id = bc_storage_device;
 
       hd->sysfs_id = new_str(hd_sysfs_id(sf_cdev));
+      hd->sysfs_path = hd_sysfs_real_id(sf_cdev);
 
       hd->sysfs_device_link = new_str(hd_sysfs_id(sf_dev));
 
@@ -305,7 +310,7 @@ void get_block_devs(hd_data_t *hd_data)
         /* look for ide-scsi handled devices */
         if(hd->bus.id == bus_scsi) {
           for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-            sf_dev_ide = new_str(hd_read_sysfs_link("/sys/bus/ide/devices", sf_bus_e->str));
+            sf_dev_ide = new_str(hd_sysfs_link(hd_data, "/sys/bus/ide/devices", sf_bus_e->str));
             ide_bus_id = sf_dev_ide ? strrchr(sf_dev_ide, '/') : NULL;
             if(ide_bus_id) ide_bus_id++;
 
@@ -730,9 +735,8 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
   scsi_t *scsi;
   hd_res_t *geo, *size;
   uint64_t ul0;
-  str_list_t *sl;
-  char buf[16];
   hd_res_t *res;
+  hd_scsi_transport_t *st;
 
   if(!hd_report_this(hd_data, hd)) return;
 
@@ -868,20 +872,13 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
   res = new_mem(sizeof *res);
   res->any.type = res_fc;
 
-  if(hd->sysfs_bus_id) {
-    for(sl = hd_data->lsscsi; sl; sl = sl->next) {
-      if(
-        sscanf(sl->str, "[%15[^]]] %*s fc:%"SCNx64" , %x ", buf, &ul0, &u0) == 3 &&
-        !strcmp(hd->sysfs_bus_id, buf)
-      ) {
-        ADD2LOG("    lsscsi: wwpn = 0x%"PRIx64", port_id = 0x%x\n", ul0, u0);
-        res->fc.wwpn = ul0;
-        res->fc.wwpn_ok = 1;
-        res->fc.port_id = u0;
-        res->fc.port_id_ok = 1;
-        if(hd->sysfs_device_link && strstr(hd->sysfs_device_link, "/net/")) hd->is.fcoe = 1;
-      }
-    }
+  if((st = get_scsi_transport(hd_data, hd->sysfs_bus_id)) && !strcmp(st->type, "fc")) {
+    ADD2LOG("    fc: wwpn = 0x%"PRIx64", port_id = 0x%x\n", st->wwpn, st->port_id);
+    res->fc.wwpn = st->wwpn;
+    res->fc.wwpn_ok = 1;
+    res->fc.port_id = st->port_id;
+    res->fc.port_id_ok = 1;
+    if(hd->sysfs_device_link && strstr(hd->sysfs_device_link, "/net/")) hd->is.fcoe = 1;
   }
 
   /* s390: wwpn & fcp lun */
@@ -1061,9 +1058,9 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
         ADD2LOG("  serial id len: %u\n", serial_buf[3]);
 
         for(u = 0; u < serial_buf_len; u += 0x10) {
-          ADD2LOG("    ");
+          ADD2LOG_DATA("    ");
           hd_log_hex(hd_data, 1, serial_buf_len - u >= 0x10 ? 0x10 : serial_buf_len - u, serial_buf + u);
-          ADD2LOG("\n");
+          ADD2LOG_DATA("\n");
         }
 
         if((hd->serial = canon_str(serial_buf + 4, serial_buf[3]))) {
@@ -1107,9 +1104,9 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
         ADD2LOG("  inq resp len: %u\n", len);
 
         for(u = 0; u < len; u += 0x10) {
-          ADD2LOG("    ");
+          ADD2LOG_DATA("    ");
           hd_log_hex(hd_data, 1, len - u >= 0x10 ? 0x10 : len - u, ptr + u);
-          ADD2LOG("\n");
+          ADD2LOG_DATA("\n");
         }
 
         if(len >= 36) {
@@ -1592,12 +1589,12 @@ void get_scsi_tape(hd_data_t *hd_data)
       ADD2LOG("    range = %u\n", dev_num.range);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
     sf_drv_name = NULL;
-    sf_drv = hd_read_sysfs_link(sf_dev, "driver");
+    sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver");
     if(!sf_drv) {
       /* maybe older kernel */
-      sf_drv = hd_read_sysfs_link(sf_cdev, "driver");
+      sf_drv = hd_sysfs_link(hd_data, sf_cdev, "driver");
     }
     if(sf_drv) {
       sf_drv_name = strrchr(sf_drv, '/');
@@ -1675,6 +1672,8 @@ void get_scsi_tape(hd_data_t *hd_data)
         hd->unix_dev_num = dev_num;
         free_mem(hd->sysfs_id);
         hd->sysfs_id = new_str(hd_sysfs_id(sf_cdev));
+        free_mem(hd->sysfs_path);
+        hd->sysfs_path = hd_sysfs_real_id(sf_cdev);
       }
     }
   }
@@ -1728,12 +1727,12 @@ void get_generic_scsi_devs(hd_data_t *hd_data)
       ADD2LOG("    range = %u\n", dev_num.range);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
     sf_drv_name = NULL;
-    sf_drv = hd_read_sysfs_link(sf_dev, "driver");
+    sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver");
     if(!sf_drv) {
       /* maybe older kernel */
-      sf_drv = hd_read_sysfs_link(sf_cdev, "driver");
+      sf_drv = hd_sysfs_link(hd_data, sf_cdev, "driver");
     }
     if(sf_drv) {
       sf_drv_name = strrchr(sf_drv, '/');
@@ -1784,6 +1783,7 @@ void get_generic_scsi_devs(hd_data_t *hd_data)
       hd->bus.id = bus_scsi;
 
       hd->sysfs_id = new_str(hd_sysfs_id(sf_cdev));
+      hd->sysfs_path = hd_sysfs_real_id(sf_cdev);
 
       hd->unix_dev_num = dev_num;
 
@@ -1860,5 +1860,144 @@ void add_disk_size(hd_data_t *hd_data, hd_t *hd)
   pr_str = free_mem(pr_str);
 }
 
+
+/*
+ * Read SCSI transport info (fc, sas, iscsi) for all SCSI devices.
+ *
+ * This is what 'lsscsi -t' reports. The result is sorted by H:C:T:L, cf.
+ * get_scsi_transport().
+ */
+void read_scsi_transport(hd_data_t *hd_data)
+{
+  str_list_t *sf_bus, *sf_bus_e;
+  hd_scsi_transport_t *st;
+  char *sf_dev, *s, *path = NULL;
+  unsigned u, u0, u1, u2, u3, size = 0;
+  uint64_t ul0, ul1;
+
+  hd_free_scsi_transport(hd_data);
+
+  sf_bus = read_dir("/sys/bus/scsi/devices", 'l');
+
+  for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
+    if(sscanf(sf_bus_e->str, "%u:%u:%u:%u", &u0, &u1, &u2, &u3) != 4) continue;
+
+    if(hd_data->scsi_transport.len == size) {
+      size += 0x40;
+      hd_data->scsi_transport.list = resize_mem(hd_data->scsi_transport.list, size * sizeof *st);
+    }
+
+    st = hd_data->scsi_transport.list + hd_data->scsi_transport.len;
+    memset(st, 0, sizeof *st);
+
+    st->host = u0;
+    st->channel = u1;
+    st->id = u2;
+    st->lun = u3;
+
+    /* fc: per target */
+    str_printf(&path, 0, "/sys/class/fc_transport/target%u:%u:%u", u0, u1, u2);
+    if(
+      hd_attr_uint(get_sysfs_attr_by_path(path, "port_name"), &ul0, 0) &&
+      hd_attr_uint(get_sysfs_attr_by_path(path, "port_id"), &ul1, 0)
+    ) {
+      strcpy(st->type, "fc");
+      st->wwpn = ul0;
+      st->port_id = ul1;
+    }
+    else if((sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/scsi/devices", sf_bus_e->str)))) {
+      /* sas: .../end_device-X:Y/target.../H:C:T:L */
+      if((s = strstr(sf_dev, "/end_device-"))) {
+        if((s = strchr(s + 1, '/'))) *s = 0;
+        str_printf(&path, 0, "/sys/class/sas_device/%s", strrchr(sf_dev, '/') + 1);
+        if((s = get_sysfs_attr_by_path(path, "sas_address"))) {
+          strcpy(st->type, "sas");
+          st->address = canon_str(s, strlen(s));
+        }
+      }
+      /* iscsi: .../sessionN/target.../H:C:T:L */
+      else if((s = strstr(sf_dev, "/session"))) {
+        if((s = strchr(s + 1, '/'))) *s = 0;
+        str_printf(&path, 0, "/sys/class/iscsi_session/%s", strrchr(sf_dev, '/') + 1);
+        if((s = get_sysfs_attr_by_path(path, "targetname"))) {
+          strcpy(st->type, "iscsi");
+          st->address = canon_str(s, strlen(s));
+          if((s = get_sysfs_attr_by_path(path, "tpgt"))) {
+            s = canon_str(s, strlen(s));
+            str_printf(&st->address, -1, ",t,0x%s", s);
+            free_mem(s);
+          }
+        }
+      }
+      free_mem(sf_dev);
+    }
+
+    if(*st->type) hd_data->scsi_transport.len++;
+  }
+
+  free_mem(path);
+  free_str_list(sf_bus);
+
+  if(!hd_data->scsi_transport.len) return;
+
+  qsort(hd_data->scsi_transport.list, hd_data->scsi_transport.len, sizeof *st, cmp_scsi_transport);
+
+  ADD2LOG("-----  scsi transport -----\n");
+  for(u = 0; u < hd_data->scsi_transport.len; u++) {
+    st = hd_data->scsi_transport.list + u;
+    ADD2LOG("  [%u:%u:%u:%u] %s:", st->host, st->channel, st->id, st->lun, st->type);
+    if(st->address) {
+      ADD2LOG("%s\n", st->address);
+    }
+    else {
+      ADD2LOG("0x%"PRIx64",0x%06x\n", st->wwpn, st->port_id);
+    }
+  }
+  ADD2LOG("-----  scsi transport end -----\n");
+}
+
+
+/*
+ * Get SCSI transport info for 'hctl' (H:C:T:L).
+ */
+hd_scsi_transport_t *get_scsi_transport(hd_data_t *hd_data, char *hctl)
+{
+  hd_scsi_transport_t key = { };
+
+  if(
+    !hd_data->scsi_transport.len ||
+    !hctl ||
+    sscanf(hctl, "%u:%u:%u:%u", &key.host, &key.channel, &key.id, &key.lun) != 4
+  ) return NULL;
+
+  return bsearch(&key, hd_data->scsi_transport.list, hd_data->scsi_transport.len, sizeof key, cmp_scsi_transport);
+}
+
+
+int cmp_scsi_transport(const void *p0, const void *p1)
+{
+  const hd_scsi_transport_t *st0 = p0, *st1 = p1;
+
+  if(st0->host != st1->host) return st0->host < st1->host ? -1 : 1;
+  if(st0->channel != st1->channel) return st0->channel < st1->channel ? -1 : 1;
+  if(st0->id != st1->id) return st0->id < st1->id ? -1 : 1;
+  if(st0->lun != st1->lun) return st0->lun < st1->lun ? -1 : 1;
+
+  return 0;
+}
+
+
+void hd_free_scsi_transport(hd_data_t *hd_data)
+{
+  unsigned u;
+
+  for(u = 0; u < hd_data->scsi_transport.len; u++) {
+    free_mem(hd_data->scsi_transport.list[u].address);
+  }
+
+  hd_data->scsi_transport.list = free_mem(hd_data->scsi_transport.list);
+  hd_data->scsi_transport.len = 0;
+}
+
 /** @} */
 
@@ -1,9 +1,12 @@
+#define _GNU_SOURCE		/* pthread_timedjoin_np() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <termios.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 
 #include "hd.h"
@@ -20,6 +23,32 @@
 
 #if !defined(LIBHD_TINY) && !defined(__sparc__)
 
+/* max. time for a single port; each timed out port adds its cancel wait */
+#define BRAILLE_TIMEOUT		8
+
+typedef struct {
+  char *dev_name;
+  int cnt;
+  unsigned *dev, *vend;
+} braille_probe_t;
+
+/* open port, restored by braille_port_reset() */
+typedef struct {
+  int fd;
+  struct termios *tio;		/* original settings */
+} braille_port_t;
+
+typedef struct {
+  braille_probe_t bp;
+  hd_data_t *hd_data;		/* private copy */
+  pthread_t thread;
+  int started;
+} braille_thread_t;
+
+static void probe_braille_ports(hd_data_t *hd_data, void *arg);
+static void *probe_braille_thread(void *arg);
+static void probe_braille(hd_data_t *hd_data, braille_probe_t *bp);
+static void braille_port_reset(void *arg);
 static unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt);
 static unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt);
 static unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt);
@@ -28,9 +57,10 @@ static unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt);
 
 void hd_scan_braille(hd_data_t *hd_data)
 {
-  hd_t *hd, *hd_tmp;
-  int cnt = 0;
-  unsigned *dev, *vend;
+  hd_t *hd, *hd_tmp, **port = NULL;
+  unsigned u, len = 0, *dev, *vend;
+  braille_probe_t *bp;
+  int timeout;
 
   if(!hd_probe_feature(hd_data, pr_braille)) return;
 
@@ -39,11 +69,6 @@ void hd_scan_braille(hd_data_t *hd_data)
   /* some clean-up */
   remove_hd_entries(hd_data);
 
-  dev = hd_shm_add(hd_data, NULL, sizeof *dev);
-  vend = hd_shm_add(hd_data, NULL, sizeof *vend);
-
-  if(!dev || !vend) return;
-
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(
       hd->base_class.id == bc_comm &&
@@ -52,67 +77,180 @@ void hd_scan_braille(hd_data_t *hd_data)
       !hd->tag.skip_braille &&
       !has_something_attached(hd_data, hd)
     ) {
-      cnt++;
-      *dev = *vend = 0;
-
-      hd_fork(hd_data, 10, 10);
-
-      if(hd_data->flags.forked) {
-
-        if(hd_probe_feature(hd_data, pr_braille_alva)) {
-          PROGRESS(1, cnt, "alva");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5001);
-          *dev = do_alva(hd_data, hd->unix_dev_name, cnt);
-        }
-
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
-          PROGRESS(1, cnt, "fhp_old");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
-          *dev = do_fhp(hd_data, hd->unix_dev_name, B19200, cnt);
-          if(!*dev) {
-            PROGRESS(1, cnt, "fhp_el");
-            *dev = do_fhp(hd_data, hd->unix_dev_name, B38400, cnt);
-          }
-        }
-
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_ht)) {
-          PROGRESS(1, cnt, "ht");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5003);
-          *dev = do_ht(hd_data, hd->unix_dev_name, cnt);
-        }
-
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_baum)) {
-          PROGRESS(1, cnt, "baum");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5004);
-          *dev = do_baum(hd_data, hd->unix_dev_name, cnt);
-        }
-
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
-          PROGRESS(1, cnt, "fhp new");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
-          *dev = do_fhp_new(hd_data, hd->unix_dev_name, cnt);
-        }
+      port = add_mem(port, sizeof *port, len);
+      port[len++] = hd;
+    }
+  }
 
-      }
+  if(!len) return;
 
-      hd_fork_done(hd_data);
+  dev = hd_shm_add(hd_data, NULL, len * sizeof *dev);
+  vend = hd_shm_add(hd_data, NULL, len * sizeof *vend);
 
-      if(*dev && *vend) {
-        hd_tmp = add_hd_entry(hd_data, __LINE__, 0);
-        hd_tmp->base_class.id = bc_braille;
-        hd_tmp->bus.id = bus_serial;
-        hd_tmp->unix_dev_name = new_str(hd->unix_dev_name);
-        hd_tmp->attached_to = hd->idx;
-        hd_tmp->vendor.id = *vend;
-        hd_tmp->device.id = *dev;
-      }
+  if(!dev || !vend) {
+    free_mem(port);
+    return;
+  }
+
+  /* probe all ports at once; list ends with dev_name == NULL */
+  bp = new_mem((len + 1) * sizeof *bp);
+  for(u = 0; u < len; u++) {
+    bp[u].dev_name = port[u]->unix_dev_name;
+    bp[u].cnt = u + 1;
+    bp[u].dev = dev + u;
+    bp[u].vend = vend + u;
+  }
+
+  /* ports run in parallel, cf. probe_braille_ports() */
+  timeout = BRAILLE_TIMEOUT + len + 2;
+  hd_isolate(hd_data, timeout, timeout, probe_braille_ports, bp);
+
+  for(u = 0; u < len; u++) {
+    hd = port[u];
+    if(dev[u] && vend[u]) {
+      hd_tmp = add_hd_entry(hd_data, __LINE__, 0);
+      hd_tmp->base_class.id = bc_braille;
+      hd_tmp->bus.id = bus_serial;
+      hd_tmp->unix_dev_name = new_str(hd->unix_dev_name);
+      hd_tmp->attached_to = hd->idx;
+      hd_tmp->vendor.id = vend[u];
+      hd_tmp->device.id = dev[u];
     }
   }
 
+  free_mem(port);
+  free_mem(bp);
+
   hd_shm_clean(hd_data);
 }
 
 
+/*
+ * Probe ports in parallel, one thread per port.
+ *
+ * Each thread works on a private copy of hd_data; the logs are added in port
+ * order. Threads that don't finish within BRAILLE_TIMEOUT seconds are
+ * cancelled and waited for, as their copies still point into hd_data.
+ *
+ * Runs in a subprocess or, with flags.threads, in a thread, cf. hd_isolate().
+ */
+void probe_braille_ports(hd_data_t *hd_data, void *arg)
+{
+  braille_probe_t *bp = arg;
+  braille_thread_t **bt;
+  struct timespec ts;
+  unsigned u, len;
+
+  for(len = 0; bp[len].dev_name; len++);
+
+  bt = new_mem(len * sizeof *bt);
+
+  for(u = 0; u < len; u++) {
+    bt[u] = new_mem(sizeof **bt);
+    bt[u]->bp = bp[u];
+    bt[u]->bp.dev_name = new_str(bp[u].dev_name);
+    bt[u]->hd_data = new_mem(sizeof *bt[u]->hd_data);
+    *bt[u]->hd_data = *hd_data;
+    bt[u]->hd_data->log = NULL;
+    bt[u]->hd_data->log_size = bt[u]->hd_data->log_max = 0;
+    bt[u]->hd_data->progress = NULL;
+
+    bt[u]->started = !pthread_create(&bt[u]->thread, NULL, probe_braille_thread, bt[u]);
+    if(!bt[u]->started) probe_braille(bt[u]->hd_data, &bt[u]->bp);
+  }
+
+  PROGRESS(1, len, "probing");
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += BRAILLE_TIMEOUT;
+
+  for(u = 0; u < len; u++) {
+    if(bt[u]->started && pthread_timedjoin_np(bt[u]->thread, NULL, &ts)) {
+      ADD2LOG("braille: %s: probe timed out\n", bp[u].dev_name);
+      pthread_cancel(bt[u]->thread);
+      pthread_join(bt[u]->thread, NULL);
+    }
+
+    hd_log(hd_data, bt[u]->hd_data->log, bt[u]->hd_data->log_size);
+    free_mem(bt[u]->hd_data->log);
+    free_mem(bt[u]->hd_data);
+    free_mem(bt[u]->bp.dev_name);
+    free_mem(bt[u]);
+  }
+
+  free_mem(bt);
+}
+
+
+void *probe_braille_thread(void *arg)
+{
+  braille_thread_t *bt = arg;
+
+  probe_braille(bt->hd_data, &bt->bp);
+
+  return NULL;
+}
+
+
+/*
+ * Probe a single port.
+ */
+void probe_braille(hd_data_t *hd_data, braille_probe_t *bp)
+{
+  unsigned *dev = bp->dev, *vend = bp->vend;
+  int cnt = bp->cnt;
+
+  if(hd_probe_feature(hd_data, pr_braille_alva)) {
+    PROGRESS(1, cnt, "alva");
+    *vend = MAKE_ID(TAG_SPECIAL, 0x5001);
+    *dev = do_alva(hd_data, bp->dev_name, cnt);
+  }
+
+  if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
+    PROGRESS(1, cnt, "fhp_old");
+    *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
+    *dev = do_fhp(hd_data, bp->dev_name, B19200, cnt);
+    if(!*dev) {
+      PROGRESS(1, cnt, "fhp_el");
+      *dev = do_fhp(hd_data, bp->dev_name, B38400, cnt);
+    }
+  }
+
+  if(!*dev && hd_probe_feature(hd_data, pr_braille_ht)) {
+    PROGRESS(1, cnt, "ht");
+    *vend = MAKE_ID(TAG_SPECIAL, 0x5003);
+    *dev = do_ht(hd_data, bp->dev_name, cnt);
+  }
+
+  if(!*dev && hd_probe_feature(hd_data, pr_braille_baum)) {
+    PROGRESS(1, cnt, "baum");
+    *vend = MAKE_ID(TAG_SPECIAL, 0x5004);
+    *dev = do_baum(hd_data, bp->dev_name, cnt);
+  }
+
+  if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
+    PROGRESS(1, cnt, "fhp new");
+    *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
+    *dev = do_fhp_new(hd_data, bp->dev_name, cnt);
+  }
+}
+
+
+/*
+ * Reset serial line and close port.
+ *
+ * Also a cleanup handler: probe threads may be cancelled.
+ */
+void braille_port_reset(void *arg)
+{
+  braille_port_t *port = arg;
+
+  tcflush(port->fd, TCIOFLUSH);
+  tcsetattr(port->fd, TCSAFLUSH, port->tio);
+  close(port->fd);
+}
+
+
 /*
  * autodetect for Alva Braille-displays
  * Author: marco Skambraks <marco@suse.de>
@@ -134,6 +272,7 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
 {
   int fd, i, timeout = 100;
   struct termios oldtio, newtio;		/* old & new terminal settings */
+  braille_port_t port;
   int model = -1;
   unsigned char buffer[sizeof BRL_ID];
   unsigned dev = 0;
@@ -145,6 +284,9 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);	/* save current settings */
+  port.fd = fd;
+  port.tio = &oldtio;
+  pthread_cleanup_push(braille_port_reset, &port);
 
   /* Set flow control and 8n1, enable reading */
   memset(&newtio, 0, sizeof newtio);
@@ -200,9 +342,7 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
   PROGRESS(5, cnt, "alva read done");
 
   /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+  pthread_cleanup_pop(1);
 
   return dev;
 }
@@ -224,6 +364,7 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
   char crash[] = { 2, 'S', 0, 0, 0, 0 };
   unsigned char buf[10];
   struct termios oldtio, newtio;	/* old & new terminal settings */
+  braille_port_t port;
   unsigned dev;
 
   PROGRESS(2, cnt, "fhp open");
@@ -233,6 +374,9 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);	/* save current settings */
+  port.fd = fd;
+  port.tio = &oldtio;
+  pthread_cleanup_push(braille_port_reset, &port);
 
   /* Set bps, flow control and 8n1, enable reading */
   memset(&newtio, 0, sizeof newtio);
@@ -296,9 +440,7 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
   if(!dev) ADD2LOG("no fhp display: 0x%02x\n", i >= 2 ? buf[2] : 0);
 
   /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+  pthread_cleanup_pop(1);
 
   return dev;
 }
@@ -319,6 +461,7 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
   int fd, i;
   unsigned char code = 0xff, buf[2] = { 0, 0 };
   struct termios oldtio, newtio;
+  braille_port_t port;
   unsigned dev = 0;
 
   PROGRESS(2, cnt, "ht open");
@@ -327,6 +470,9 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);
+  port.fd = fd;
+  port.tio = &oldtio;
+  pthread_cleanup_push(braille_port_reset, &port);
 
   newtio = oldtio;
   newtio.c_cflag = CLOCAL | PARODD | PARENB | CREAD | CS8;
@@ -401,9 +547,7 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
   if(!dev) ADD2LOG("no ht display: 0x%02x\n", buf[1]);
 
   /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+  pthread_cleanup_pop(1);
 
   return dev;
 }
@@ -427,6 +571,7 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
   static char device_id[] = { 0x1b, 0x84 };
   int fd;
   struct termios oldtio, curtio;
+  braille_port_t port;
   unsigned char buf[MAXREAD + 1];
   int i;
 
@@ -438,6 +583,10 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
   tcgetattr(fd, &curtio);
 
   oldtio = curtio;
+  port.fd = fd;
+  port.tio = &oldtio;
+  pthread_cleanup_push(braille_port_reset, &port);
+
   cfmakeraw(&curtio);
 
   /* no SIGTTOU to backgrounded processes */
@@ -469,9 +618,7 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
   ADD2LOG("\n");
 
   /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+  pthread_cleanup_pop(1);
 
   if(!strcmp(buf + 2, "Baum Vario40")) return MAKE_ID(TAG_SPECIAL, 1);
   if(!strcmp(buf + 2, "Baum Vario80")) return MAKE_ID(TAG_SPECIAL, 2);
@@ -487,6 +634,7 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
   unsigned char retstr[50] = "";
   unsigned char brlauto[] = { 2, 0x42, 0x50, 0x50, 3 };
   struct termios oldtio, tiodata = { };
+  braille_port_t port;
 
   PROGRESS(2, cnt, "fhp2 open");
 
@@ -522,6 +670,10 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
     return 0;
   }
 
+  port.fd = fd;
+  port.tio = &oldtio;
+  pthread_cleanup_push(braille_port_reset, &port);
+
   tcflush(fd, TCIOFLUSH);
   usleep(100 * 1000);
 
@@ -570,9 +722,7 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
   }
 
   /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+  pthread_cleanup_pop(1);
 
   return id;
 }
@@ -0,0 +1,979 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "cache.h"
+#include "version.h"
+
+/**
+ * @defgroup CACHEint Scan result cache
+ * @ingroup libhdInternals
+ * @brief Persistent scan results (/var/lib/hardware/scan/)
+ *
+ * With probe feature 'scan.cache', the result of hd_scan() on an empty
+ * hd_data (hd_data->hd and the log) is stored. The next scan with the same
+ * probe setup uses it instead of probing, as long as the system state
+ * (kernel, boot id, uevent sequence number, loaded modules, hardware db)
+ * hasn't changed.
+ *
+ * Entries are stored as raw structs, each followed by the data its pointers
+ * refer to (in the order free_hd_entry() & co. use).
+ *
+ * @{
+ */
+
+#define SCAN_CACHE_DIR		"scan"
+#define SCAN_CACHE_MAGIC	0x63736468	/* "hdsc" */
+#define SCAN_CACHE_VERSION	3
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t hd_size;		/* sizeof (hd_t), to catch ABI changes */
+  uint32_t entries;
+  uint32_t last_idx;
+  uint32_t reserved;
+  uint64_t key;
+  uint64_t state;
+  uint64_t crc;			/* data following the header */
+} scan_cache_header_t;
+
+/*
+ * Serialization buffer; the cache_*() functions below either write
+ * (cb->write = 1) or read the same data.
+ */
+typedef struct {
+  unsigned char *data;
+  size_t size;			/* write: buffer size; read: data size */
+  size_t pos;
+  unsigned write:1;
+  unsigned err:1;		/* write: data not cacheable; read: data corrupt */
+} cache_buf_t;
+
+static uint64_t scan_cache_key(hd_data_t *hd_data);
+static uint64_t scan_cache_state(hd_data_t *hd_data);
+static char *scan_cache_name(scan_cache_id_t *id);
+
+static void put_data(cache_buf_t *cb, const void *p, size_t len);
+static void put_mem(cache_buf_t *cb, const void *p, unsigned len);
+static int get_data(cache_buf_t *cb, void *p, size_t len);
+static void *get_mem(cache_buf_t *cb, unsigned *len);
+
+static unsigned cache_cnt(cache_buf_t *cb, unsigned cnt);
+static void cache_mem(cache_buf_t *cb, void *p, unsigned len);
+static void cache_str(cache_buf_t *cb, char **str);
+static void cache_str_list(cache_buf_t *cb, str_list_t **sl);
+static void cache_hd(cache_buf_t *cb, hd_t **hd_p);
+static void cache_res(cache_buf_t *cb, hd_res_t **res_p);
+static void cache_detail(cache_buf_t *cb, hd_detail_t **d_p);
+static void cache_driver_info(cache_buf_t *cb, driver_info_t **di_p);
+static void cache_prop(cache_buf_t *cb, hal_prop_t **prop_p);
+
+
+/*
+ * Check if we may use the cache and get the cache id.
+ *
+ * Only a scan starting with an empty hd_data can be replaced by cached data.
+ *
+ * return:
+ *   0/1: no cache/cache
+ */
+int hd_scan_cache_init(hd_data_t *hd_data, scan_cache_id_t *id)
+{
+  memset(id, 0, sizeof *id);
+
+  if(
+    !hd_probe_feature(hd_data, pr_scan_cache) ||
+    hd_data->hd ||
+    hd_data->last_idx
+  ) return 0;
+
+  if(!(id->state = scan_cache_state(hd_data))) return 0;
+
+  id->key = scan_cache_key(hd_data);
+  id->log_start = hd_data->log_dropped + hd_data->log_size;
+
+  return 1;
+}
+
+
+/*
+ * Read cached scan results.
+ *
+ * Returns the list of entries (with their original idx values) and appends
+ * the cached log. 'last_idx' is set to the value hd_data->last_idx had.
+ * Our own log messages are not part of the scan log (cf. id->log_start).
+ */
+hd_t *hd_scan_cache_read(hd_data_t *hd_data, scan_cache_id_t *id, unsigned *last_idx)
+{
+  cache_buf_t cb = { };
+  scan_cache_header_t header;
+  struct stat sbuf;
+  hd_t *hd, *hd_list = NULL, **hd_p, *next;
+  unsigned char *log;
+  unsigned u, log_len;
+  uint64_t crc = 0;
+  char *name;
+  int fd, i;
+
+  *last_idx = 0;
+
+  name = scan_cache_name(id);
+
+  if((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) {
+    ADD2LOG("scan cache: %s not found\n", name);
+    id->log_start = hd_data->log_dropped + hd_data->log_size;
+    free_mem(name);
+
+    return NULL;
+  }
+
+  if(!fstat(fd, &sbuf) && sbuf.st_size >= (off_t) sizeof header) {
+    cb.data = new_mem(sbuf.st_size);
+    for(cb.size = 0; cb.size < (size_t) sbuf.st_size; cb.size += i) {
+      if((i = read(fd, cb.data + cb.size, sbuf.st_size - cb.size)) <= 0) break;
+    }
+  }
+
+  close(fd);
+
+  get_data(&cb, &header, sizeof header);
+  if(!cb.err) crc64(&crc, cb.data + cb.pos, cb.size - cb.pos);
+
+  if(
+    cb.err ||
+    header.magic != SCAN_CACHE_MAGIC ||
+    header.version != SCAN_CACHE_VERSION ||
+    header.hd_size != sizeof *hd ||
+    header.key != id->key ||
+    header.state != id->state ||
+    header.crc != crc
+  ) {
+    ADD2LOG("scan cache: %s outdated\n", name);
+    id->log_start = hd_data->log_dropped + hd_data->log_size;
+    free_mem(cb.data);
+    free_mem(name);
+
+    return NULL;
+  }
+
+  log = get_mem(&cb, &log_len);
+
+  for(u = 0, hd_p = &hd_list; u < header.entries && !cb.err; u++) {
+    cache_hd(&cb, hd_p);
+    if(!(hd = *hd_p)) break;
+    hd_p = &hd->next;
+    if(
+      hd->idx <= *last_idx ||
+      hd->idx > header.last_idx ||
+      hd->attached_to > header.last_idx
+    ) cb.err = 1;
+    *last_idx = hd->idx;
+  }
+
+  if(cb.pos != cb.size || u != header.entries) cb.err = 1;
+
+  if(cb.err) {
+    ADD2LOG("scan cache: %s corrupt\n", name);
+    id->log_start = hd_data->log_dropped + hd_data->log_size;
+    for(hd = hd_list; hd; hd = next) {
+      next = hd->next;
+      hd->next = NULL;
+      hd->tag.freeit = 1;
+      hd_free_hd_list(hd);
+    }
+    hd_list = NULL;
+    *last_idx = 0;
+  }
+  else {
+    ADD2LOG("scan cache: using %s\n", name);
+    hd_log(hd_data, (char *) log, log_len);
+    *last_idx = header.last_idx;
+  }
+
+  free_mem(log);
+  free_mem(cb.data);
+  free_mem(name);
+
+  return hd_list;
+}
+
+
+/*
+ * Store scan results.
+ */
+void hd_scan_cache_write(hd_data_t *hd_data, scan_cache_id_t *id)
+{
+  cache_buf_t cb = { write: 1 };
+  scan_cache_header_t header = { };
+  hd_t *hd;
+  char *name, *tmp = NULL;
+  size_t len;
+  int fd, i, ok = 0;
+
+  header.magic = SCAN_CACHE_MAGIC;
+  header.version = SCAN_CACHE_VERSION;
+  header.hd_size = sizeof *hd;
+  header.last_idx = hd_data->last_idx;
+  header.key = id->key;
+  header.state = id->state;
+  for(hd = hd_data->hd; hd; hd = hd->next) header.entries++;
+
+  put_data(&cb, &header, sizeof header);
+
+  /* id->log_start counts dropped log bytes, too (ring buffer mode) */
+  if(hd_data->log_dropped > id->log_start) {
+    /* log incomplete */
+    cb.err = 1;
+  }
+  else if(hd_data->log && hd_data->log_dropped + hd_data->log_size >= id->log_start) {
+    len = id->log_start - hd_data->log_dropped;
+    put_mem(&cb, hd_data->log + len, hd_data->log_size - len);
+  }
+  else {
+    put_mem(&cb, NULL, 0);
+  }
+
+  for(hd = hd_data->hd; hd && !cb.err; hd = hd->next) {
+    cache_hd(&cb, &hd);
+  }
+
+  if(cb.err) {
+    ADD2LOG("scan cache: results not cacheable\n");
+    free_mem(cb.data);
+
+    return;
+  }
+
+  crc64(&header.crc, cb.data + sizeof header, cb.pos - sizeof header);
+  memcpy(cb.data, &header, sizeof header);
+
+  mkdir(hd_get_hddb_path(SCAN_CACHE_DIR), 0755);
+
+  name = scan_cache_name(id);
+  str_printf(&tmp, 0, "%s.XXXXXX", name);
+
+  /* the log may contain serial numbers & such */
+  if((fd = mkstemp(tmp)) != -1) {
+    for(len = 0; len < cb.pos; len += i) {
+      if((i = write(fd, cb.data + len, cb.pos - len)) <= 0) break;
+    }
+    ok = len == cb.pos;
+    if(close(fd)) ok = 0;
+    if(ok && rename(tmp, name)) ok = 0;
+    if(!ok) unlink(tmp);
+  }
+
+  ADD2LOG("scan cache: %s %s\n", name, ok ? "written" : "not written");
+
+  free_mem(tmp);
+  free_mem(name);
+  free_mem(cb.data);
+}
+
+
+/*
+ * Everything that influences what hd_scan() does.
+ */
+uint64_t scan_cache_key(hd_data_t *hd_data)
+{
+  uint64_t id = 0;
+  hal_prop_t *prop;
+  str_list_t *sl;
+  unsigned u;
+  char *s;
+
+  crc64(&id, hd_data->probe, sizeof hd_data->probe);
+
+  for(prop = hd_data->probe_val; prop; prop = prop->next) {
+    s = hd_hal_print_prop(prop);
+    crc64(&id, s, strlen(s) + 1);
+  }
+
+  for(sl = hd_data->only; sl; sl = sl->next) {
+    crc64(&id, sl->str, strlen(sl->str) + 1);
+  }
+
+  crc64(&id, &hd_data->debug, sizeof hd_data->debug);
+  crc64(&id, &hd_data->log_level, sizeof hd_data->log_level);
+
+  u = hd_data->flags.fast;
+  crc64(&id, &u, sizeof u);
+
+  /* root sees more */
+  u = getuid();
+  crc64(&id, &u, sizeof u);
+
+  return id;
+}
+
+
+/*
+ * System state fingerprint.
+ *
+ * Every device change (including driver binding and module loading) bumps
+ * the uevent sequence number; it starts over after reboot.
+ *
+ * return:
+ *   0: no fingerprint available
+ */
+uint64_t scan_cache_state(hd_data_t *hd_data)
+{
+  uint64_t id = 0;
+  struct utsname ubuf;
+  struct stat sbuf;
+  str_list_t *sl, *sl0;
+  char *s;
+
+  crc64(&id, (char *) HD_VERSION_STRING, sizeof HD_VERSION_STRING);
+
+  if(uname(&ubuf)) return 0;
+
+  crc64(&id, ubuf.release, strlen(ubuf.release) + 1);
+  crc64(&id, ubuf.version, strlen(ubuf.version) + 1);
+
+  if(!(sl0 = read_file("/proc/sys/kernel/random/boot_id", 0, 1))) return 0;
+  crc64(&id, sl0->str, strlen(sl0->str) + 1);
+  free_str_list(sl0);
+
+  if(!(sl0 = read_file("/sys/kernel/uevent_seqnum", 0, 1))) return 0;
+  crc64(&id, sl0->str, strlen(sl0->str) + 1);
+  free_str_list(sl0);
+
+  /* module names only; use counts change all the time */
+  for(sl = sl0 = read_file(PROC_MODULES, 0, 0); sl; sl = sl->next) {
+    if((s = strchr(sl->str, ' '))) *s = 0;
+    crc64(&id, sl->str, strlen(sl->str) + 1);
+  }
+  free_str_list(sl0);
+
+  if(!stat(hd_get_hddb_path("hd.ids"), &sbuf)) {
+    crc64(&id, &sbuf.st_mtime, sizeof sbuf.st_mtime);
+  }
+
+  if(!stat(hd_get_hddb_path("ids"), &sbuf)) {
+    crc64(&id, &sbuf.st_mtime, sizeof sbuf.st_mtime);
+  }
+
+  return id ?: 1;
+}
+
+
+char *scan_cache_name(scan_cache_id_t *id)
+{
+  char *name = NULL;
+
+  str_printf(&name, 0, "%s/%016"PRIx64, hd_get_hddb_path(SCAN_CACHE_DIR), id->key);
+
+  return name;
+}
+
+
+void put_data(cache_buf_t *cb, const void *p, size_t len)
+{
+  if(cb->pos + len > cb->size) {
+    cb->size = cb->pos + len + (cb->size >> 1) + 0x1000;
+    cb->data = resize_mem(cb->data, cb->size);
+  }
+
+  memcpy(cb->data + cb->pos, p, len);
+  cb->pos += len;
+}
+
+
+/*
+ * Length-prefixed data block; NULL is stored as length -1.
+ */
+void put_mem(cache_buf_t *cb, const void *p, unsigned len)
+{
+  uint32_t u = p ? len : (uint32_t) -1;
+
+  put_data(cb, &u, sizeof u);
+  if(p) put_data(cb, p, len);
+}
+
+
+int get_data(cache_buf_t *cb, void *p, size_t len)
+{
+  if(cb->err || len > cb->size - cb->pos) {
+    cb->err = 1;
+    memset(p, 0, len);
+
+    return 0;
+  }
+
+  memcpy(p, cb->data + cb->pos, len);
+  cb->pos += len;
+
+  return 1;
+}
+
+
+/*
+ * Counterpart to put_mem(). The returned buffer is 0-terminated.
+ */
+void *get_mem(cache_buf_t *cb, unsigned *len)
+{
+  uint32_t u;
+  void *p;
+
+  *len = 0;
+
+  if(!get_data(cb, &u, sizeof u) || u == (uint32_t) -1) return NULL;
+
+  if(u > cb->size - cb->pos) {
+    cb->err = 1;
+
+    return NULL;
+  }
+
+  p = new_mem(u + 1);
+  get_data(cb, p, u);
+  *len = u;
+
+  return p;
+}
+
+
+/*
+ * List length.
+ */
+unsigned cache_cnt(cache_buf_t *cb, unsigned cnt)
+{
+  uint32_t u = cnt;
+
+  if(cb->write) {
+    put_data(cb, &u, sizeof u);
+  }
+  else {
+    get_data(cb, &u, sizeof u);
+  }
+
+  return u;
+}
+
+
+/*
+ * Data block of known size; '*p' points to the block. NULL is allowed.
+ */
+void cache_mem(cache_buf_t *cb, void *p, unsigned len)
+{
+  void **mem = p;
+  unsigned u;
+
+  if(cb->write) {
+    put_mem(cb, *mem, len);
+
+    return;
+  }
+
+  *mem = get_mem(cb, &u);
+
+  if(*mem && u != len) {
+    *mem = free_mem(*mem);
+    cb->err = 1;
+  }
+}
+
+
+void cache_str(cache_buf_t *cb, char **str)
+{
+  unsigned u;
+
+  if(cb->write) {
+    put_mem(cb, *str, *str ? strlen(*str) + 1 : 0);
+
+    return;
+  }
+
+  *str = get_mem(cb, &u);
+
+  if(*str && (!u || (*str)[u - 1])) {
+    *str = free_mem(*str);
+    cb->err = 1;
+  }
+}
+
+
+void cache_str_list(cache_buf_t *cb, str_list_t **sl)
+{
+  str_list_t *sl0;
+  unsigned u, cnt;
+  char *s;
+
+  for(cnt = 0, sl0 = *sl; cb->write && sl0; sl0 = sl0->next) cnt++;
+
+  cnt = cache_cnt(cb, cnt);
+
+  if(cb->write) {
+    for(sl0 = *sl; sl0; sl0 = sl0->next) cache_str(cb, &sl0->str);
+
+    return;
+  }
+
+  for(*sl = NULL, u = 0; u < cnt && !cb->err; u++) {
+    /* NULL entries are allowed (cf. module args) */
+    cache_str(cb, &s);
+    add_str_list(sl, s);
+    free_mem(s);
+  }
+}
+
+
+/*
+ * Note: struct members are only reset when reading.
+ */
+void cache_hd(cache_buf_t *cb, hd_t **hd_p)
+{
+  hd_t *hd;
+
+  cache_mem(cb, hd_p, sizeof **hd_p);
+
+  if(!(hd = *hd_p)) {
+    if(!cb->write) cb->err = 1;
+
+    return;
+  }
+
+  if(!cb->write) {
+    hd->next = NULL;
+    hd->ref = NULL;
+    hd->ref_cnt = 0;
+  }
+
+  cache_str(cb, &hd->bus.name);
+  cache_str(cb, &hd->base_class.name);
+  cache_str(cb, &hd->sub_class.name);
+  cache_str(cb, &hd->prog_if.name);
+  cache_str(cb, &hd->vendor.name);
+  cache_str(cb, &hd->device.name);
+  cache_str(cb, &hd->sub_vendor.name);
+  cache_str(cb, &hd->sub_device.name);
+  cache_str(cb, &hd->revision.name);
+  cache_str(cb, &hd->serial);
+  cache_str(cb, &hd->compat_vendor.name);
+  cache_str(cb, &hd->compat_device.name);
+  cache_str(cb, &hd->model);
+  cache_str(cb, &hd->sysfs_id);
+  cache_str(cb, &hd->sysfs_path);
+  cache_str(cb, &hd->sysfs_bus_id);
+  cache_str(cb, &hd->sysfs_device_link);
+  cache_str_list(cb, &hd->unix_dev_names);
+  cache_str(cb, &hd->unix_dev_name);
+  cache_str(cb, &hd->unix_dev_name2);
+  cache_str(cb, &hd->rom_id);
+  cache_str(cb, &hd->udi);
+  cache_str(cb, &hd->parent_udi);
+  cache_str(cb, &hd->unique_id);
+  cache_str_list(cb, &hd->unique_ids);
+  cache_mem(cb, &hd->block0, 512);
+  cache_str(cb, &hd->driver);
+  cache_str(cb, &hd->driver_module);
+  cache_str_list(cb, &hd->drivers);
+  cache_str_list(cb, &hd->driver_modules);
+  cache_str(cb, &hd->old_unique_id);
+  cache_str(cb, &hd->unique_id1);
+  cache_str(cb, &hd->usb_guid);
+  cache_str(cb, &hd->parent_id);
+  cache_str_list(cb, &hd->child_ids);
+  cache_str(cb, &hd->config_string);
+  cache_str_list(cb, &hd->extra_info);
+  cache_str_list(cb, &hd->requires);
+  cache_str(cb, &hd->modalias);
+  cache_str(cb, &hd->label);
+
+  cache_res(cb, &hd->res);
+  cache_detail(cb, &hd->detail);
+  cache_driver_info(cb, &hd->driver_info);
+  cache_prop(cb, &hd->hal_prop);
+  cache_prop(cb, &hd->persistent_prop);
+}
+
+
+void cache_res(cache_buf_t *cb, hd_res_t **res_p)
+{
+  hd_res_t *res;
+  unsigned u, cnt;
+
+  for(cnt = 0, res = *res_p; cb->write && res; res = res->next) cnt++;
+
+  cnt = cache_cnt(cb, cnt);
+
+  if(!cb->write) *res_p = NULL;
+
+  for(u = 0; u < cnt && !cb->err; u++, res_p = &res->next) {
+    cache_mem(cb, res_p, sizeof **res_p);
+    if(!(res = *res_p)) {
+      cb->err = 1;
+      break;
+    }
+    if(!cb->write) res->next = NULL;
+
+    switch(res->any.type) {
+      case res_init_strings:
+        cache_str(cb, &res->init_strings.init1);
+        cache_str(cb, &res->init_strings.init2);
+        break;
+
+      case res_pppd_option:
+        cache_str(cb, &res->pppd_option.option);
+        break;
+
+      case res_hwaddr:
+      case res_phwaddr:
+        cache_str(cb, &res->hwaddr.addr);
+        break;
+
+      case res_wlan:
+        cache_str_list(cb, &res->wlan.channels);
+        cache_str_list(cb, &res->wlan.frequencies);
+        cache_str_list(cb, &res->wlan.bitrates);
+        cache_str_list(cb, &res->wlan.auth_modes);
+        cache_str_list(cb, &res->wlan.enc_modes);
+        break;
+
+      case res_fc:
+        cache_str(cb, &res->fc.controller_id);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+
+/*
+ * Cf. free_hd_detail().
+ */
+void cache_detail(cache_buf_t *cb, hd_detail_t **d_p)
+{
+  hd_detail_t *d;
+  hd_detail_monitor_t *mdetail, **mdetail_p;
+  scsi_t *scsi, **scsi_p;
+  unsigned u, cnt;
+
+  cache_mem(cb, d_p, sizeof **d_p);
+
+  if(!(d = *d_p)) return;
+
+  switch(d->type) {
+    case hd_detail_pci:
+      cache_mem(cb, &d->pci.data, sizeof *d->pci.data);
+      if(d->pci.data) {
+        pci_t *p = d->pci.data;
+
+        if(!cb->write) p->next = NULL;
+        cache_str(cb, &p->log);
+        cache_str(cb, &p->sysfs_id);
+        cache_str(cb, &p->sysfs_bus_id);
+        cache_str(cb, &p->modalias);
+        cache_str(cb, &p->label);
+      }
+      break;
+
+    case hd_detail_usb:
+      cache_mem(cb, &d->usb.data, sizeof *d->usb.data);
+      if(d->usb.data) {
+        usb_t *u = d->usb.data;
+
+        if(!cb->write) {
+          u->next = NULL;
+          u->cloned = NULL;
+        }
+        cache_str_list(cb, &u->c);
+        cache_str_list(cb, &u->d);
+        cache_str_list(cb, &u->e);
+        cache_str_list(cb, &u->i);
+        cache_str_list(cb, &u->p);
+        cache_str_list(cb, &u->s);
+        cache_str_list(cb, &u->t);
+        cache_str(cb, &u->manufact);
+        cache_str(cb, &u->product);
+        cache_str(cb, &u->serial);
+        cache_str(cb, &u->driver);
+        cache_mem(cb, &u->raw_descr.data, u->raw_descr.size);
+      }
+      break;
+
+    case hd_detail_cdrom:
+      cache_mem(cb, &d->cdrom.data, sizeof *d->cdrom.data);
+      if(d->cdrom.data) {
+        cdrom_info_t *c = d->cdrom.data;
+
+        if(!cb->write) c->next = NULL;
+        cache_str(cb, &c->name);
+        cache_str(cb, &c->iso9660.volume);
+        cache_str(cb, &c->iso9660.publisher);
+        cache_str(cb, &c->iso9660.preparer);
+        cache_str(cb, &c->iso9660.application);
+        cache_str(cb, &c->iso9660.creation_date);
+        cache_str(cb, &c->el_torito.id_string);
+        cache_str(cb, &c->el_torito.label);
+      }
+      break;
+
+    case hd_detail_floppy:
+      cache_mem(cb, &d->floppy.data, sizeof *d->floppy.data);
+      break;
+
+    case hd_detail_bios:
+      cache_mem(cb, &d->bios.data, sizeof *d->bios.data);
+      if(d->bios.data) {
+        bios_info_t *b = d->bios.data;
+
+        cache_str(cb, &b->vbe.oem_name);
+        cache_str(cb, &b->vbe.vendor_name);
+        cache_str(cb, &b->vbe.product_name);
+        cache_str(cb, &b->vbe.product_revision);
+        cache_mem(cb, &b->vbe.mode, b->vbe.modes * sizeof *b->vbe.mode);
+        cache_str(cb, &b->lcd.vendor);
+        cache_str(cb, &b->lcd.name);
+        cache_str(cb, &b->mouse.vendor);
+        cache_str(cb, &b->mouse.type);
+      }
+      break;
+
+    case hd_detail_cpu:
+      cache_mem(cb, &d->cpu.data, sizeof *d->cpu.data);
+      if(d->cpu.data) {
+        cpu_info_t *c = d->cpu.data;
+
+        cache_str(cb, &c->vend_name);
+        cache_str(cb, &c->model_name);
+        cache_str(cb, &c->platform);
+        cache_str_list(cb, &c->features);
+        /* it's a copy now */
+        if(!cb->write) c->features_shared = 0;
+      }
+      break;
+
+    case hd_detail_prom:
+      cache_mem(cb, &d->prom.data, sizeof *d->prom.data);
+      break;
+
+    case hd_detail_monitor:
+      for(cnt = 0, mdetail = d->monitor.next; cb->write && mdetail; mdetail = mdetail->next) cnt++;
+      cnt = cache_cnt(cb, cnt);
+
+      for(mdetail = &d->monitor, mdetail_p = NULL, u = 0; mdetail; u++) {
+        cache_mem(cb, &mdetail->data, sizeof *mdetail->data);
+        if(mdetail->data) {
+          monitor_info_t *m = mdetail->data;
+
+          cache_str(cb, &m->vendor);
+          cache_str(cb, &m->name);
+          cache_str(cb, &m->serial);
+        }
+
+        mdetail_p = &mdetail->next;
+        if(u == cnt || cb->err) {
+          if(!cb->write) *mdetail_p = NULL;
+          break;
+        }
+        cache_mem(cb, mdetail_p, sizeof **mdetail_p);
+        mdetail = *mdetail_p;
+      }
+      break;
+
+    case hd_detail_sys:
+      cache_mem(cb, &d->sys.data, sizeof *d->sys.data);
+      if(d->sys.data) {
+        sys_info_t *s = d->sys.data;
+
+        cache_str(cb, &s->system_type);
+        cache_str(cb, &s->generation);
+        cache_str(cb, &s->vendor);
+        cache_str(cb, &s->model);
+        cache_str(cb, &s->serial);
+        cache_str(cb, &s->lang);
+        cache_str(cb, &s->formfactor);
+      }
+      break;
+
+    case hd_detail_scsi:
+      for(cnt = 0, scsi = d->scsi.data; cb->write && scsi; scsi = scsi->next) cnt++;
+      cnt = cache_cnt(cb, cnt);
+
+      if(!cb->write) d->scsi.data = NULL;
+
+      for(u = 0, scsi_p = &d->scsi.data; u < cnt && !cb->err; u++, scsi_p = &scsi->next) {
+        cache_mem(cb, scsi_p, sizeof **scsi_p);
+        if(!(scsi = *scsi_p)) {
+          cb->err = 1;
+          break;
+        }
+        if(!cb->write) scsi->next = NULL;
+        cache_str(cb, &scsi->dev_name);
+        cache_str(cb, &scsi->guessed_dev_name);
+        cache_str(cb, &scsi->vendor);
+        cache_str(cb, &scsi->model);
+        cache_str(cb, &scsi->rev);
+        cache_str(cb, &scsi->type_str);
+        cache_str(cb, &scsi->serial);
+        cache_str(cb, &scsi->proc_dir);
+        cache_str(cb, &scsi->driver);
+        cache_str(cb, &scsi->info);
+        cache_str(cb, &scsi->usb_guid);
+        cache_str_list(cb, &scsi->host_info);
+        cache_str(cb, &scsi->controller_id);
+      }
+      break;
+
+    case hd_detail_ccw:
+      cache_mem(cb, &d->ccw.data, sizeof *d->ccw.data);
+      break;
+
+    case hd_detail_joystick:
+      cache_mem(cb, &d->joystick.data, sizeof *d->joystick.data);
+      break;
+
+    default:
+      /* isapnp: shared card data; devtree: belongs to hd_data->devtree */
+      cb->err = 1;
+      if(!cb->write) *d_p = free_mem(d);
+      return;
+  }
+
+  /* free_hd_detail() relies on it */
+  if(!cb->write && !d->pci.data && d->type != hd_detail_cdrom) {
+    cb->err = 1;
+    *d_p = free_mem(d);
+  }
+}
+
+
+/*
+ * Cf. free_driver_info().
+ */
+void cache_driver_info(cache_buf_t *cb, driver_info_t **di_p)
+{
+  driver_info_t *di;
+  isdn_parm_t *ip, **ip_p;
+  unsigned u, v, cnt, cnt2;
+
+  for(cnt = 0, di = *di_p; cb->write && di; di = di->next) cnt++;
+
+  cnt = cache_cnt(cb, cnt);
+
+  if(!cb->write) *di_p = NULL;
+
+  for(u = 0; u < cnt && !cb->err; u++, di_p = &di->next) {
+    cache_mem(cb, di_p, sizeof **di_p);
+    if(!(di = *di_p)) {
+      cb->err = 1;
+      break;
+    }
+    if(!cb->write) di->next = NULL;
+
+    cache_str_list(cb, &di->any.hddb0);
+    cache_str_list(cb, &di->any.hddb1);
+
+    switch(di->any.type) {
+      case di_any:
+      case di_display:
+        break;
+
+      case di_module:
+        cache_str_list(cb, &di->module.names);
+        cache_str_list(cb, &di->module.mod_args);
+        cache_str(cb, &di->module.conf);
+        break;
+
+      case di_mouse:
+        cache_str(cb, &di->mouse.xf86);
+        cache_str(cb, &di->mouse.gpm);
+        break;
+
+      case di_x11:
+        cache_str(cb, &di->x11.server);
+        cache_str(cb, &di->x11.xf86_ver);
+        cache_str_list(cb, &di->x11.extensions);
+        cache_str_list(cb, &di->x11.options);
+        cache_str_list(cb, &di->x11.raw);
+        cache_str(cb, &di->x11.script);
+        break;
+
+      case di_isdn:
+        cache_str(cb, &di->isdn.i4l_name);
+
+        for(cnt2 = 0, ip = di->isdn.params; cb->write && ip; ip = ip->next) cnt2++;
+        cnt2 = cache_cnt(cb, cnt2);
+
+        if(!cb->write) di->isdn.params = NULL;
+
+        for(v = 0, ip_p = &di->isdn.params; v < cnt2 && !cb->err; v++, ip_p = &ip->next) {
+          cache_mem(cb, ip_p, sizeof **ip_p);
+          if(!(ip = *ip_p)) {
+            cb->err = 1;
+            break;
+          }
+          if(!cb->write) ip->next = NULL;
+          cache_str(cb, &ip->name);
+          cache_mem(cb, &ip->alt_value, ip->alt_values * sizeof *ip->alt_value);
+        }
+        break;
+
+      case di_dsl:
+        cache_str(cb, &di->dsl.name);
+        cache_str(cb, &di->dsl.mode);
+        break;
+
+      case di_kbd:
+        cache_str(cb, &di->kbd.XkbRules);
+        cache_str(cb, &di->kbd.XkbModel);
+        cache_str(cb, &di->kbd.XkbLayout);
+        cache_str(cb, &di->kbd.keymap);
+        break;
+
+      default:
+        cb->err = 1;
+        if(!cb->write) *di_p = free_mem(di);
+        return;
+    }
+  }
+}
+
+
+/*
+ * Cf. hd_free_hal_properties().
+ */
+void cache_prop(cache_buf_t *cb, hal_prop_t **prop_p)
+{
+  hal_prop_t *prop;
+  unsigned u, cnt;
+
+  for(cnt = 0, prop = *prop_p; cb->write && prop; prop = prop->next) cnt++;
+
+  cnt = cache_cnt(cb, cnt);
+
+  if(!cb->write) *prop_p = NULL;
+
+  for(u = 0; u < cnt && !cb->err; u++, prop_p = &prop->next) {
+    cache_mem(cb, prop_p, sizeof **prop_p);
+    if(!(prop = *prop_p)) {
+      cb->err = 1;
+      break;
+    }
+    if(!cb->write) prop->next = NULL;
+
+    cache_str(cb, &prop->key);
+
+    if(prop->type == p_string) {
+      cache_str(cb, &prop->val.str);
+    }
+    else if(prop->type == p_list) {
+      cache_str_list(cb, &prop->val.list);
+    }
+  }
+}
+
+/** @} */
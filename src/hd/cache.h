@@ -0,0 +1,12 @@
+/*
+ * scan result cache id, cf. hd_scan_cache_init()
+ */
+typedef struct {
+  uint64_t key;		/* probe setup: selects the cache file */
+  uint64_t state;	/* system state: validates the cache file */
+  size_t log_start;	/* log part belonging to the scan */
+} scan_cache_id_t;
+
+int hd_scan_cache_init(hd_data_t *hd_data, scan_cache_id_t *id);
+hd_t *hd_scan_cache_read(hd_data_t *hd_data, scan_cache_id_t *id, unsigned *last_idx);
+void hd_scan_cache_write(hd_data_t *hd_data, scan_cache_id_t *id);
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "cfgdb.h"
+
+/**
+ * @defgroup CFGDBint Config store
+ * @ingroup libhdInternals
+ * @brief Device configs in a single file (/var/lib/hardware/config.db)
+ *
+ * If config.db exists, hd_write_config() & co. store the device configs
+ * there instead of in one file per device below udi/ ('hwscan
+ * --save-config' moves existing files into it).
+ *
+ * It is a table sorted by key (udi or unique id, no leading '/') that is
+ * searched in place. Every update writes a new file and renames it over
+ * the old one, so readers always see a consistent state. Several updates
+ * can be collected and written at once, cf. hd_begin_config().
+ *
+ * @{
+ */
+
+#define CFGDB_NAME	"config.db"
+#define CFGDB_MAGIC	0x62646663	/* "cfdb", little endian */
+#define CFGDB_VERSION	1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;		/* file size */
+  uint32_t entries;		/* index entries following the header */
+  uint32_t strings_ofs;
+  uint32_t strings_len;
+} cfgdb_header_t;
+
+typedef struct {
+  uint32_t key;			/* offset into strings */
+  uint32_t data;		/* offset into strings; one property per line */
+} cfgdb_entry_t;
+
+typedef struct {
+  char *key;
+  char *data;
+  unsigned seq;			/* later changes win */
+} cfgdb_change_t;
+
+/* changes not yet written, cf. hd_begin_config() */
+struct hd_cfgdb_batch_s {
+  unsigned len, max;
+  unsigned create:1;		/* write config.db even if there are no changes */
+  cfgdb_change_t *entry;
+};
+
+/* the mapped config.db */
+static struct {
+  unsigned char *data;
+  size_t size;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  cfgdb_header_t *h;
+  cfgdb_entry_t *entry;
+  char *strings;
+} cfgdb;
+
+static int cfgdb_map(void);
+static void cfgdb_unmap(void);
+static int cfgdb_find(const char *key);
+static int cfgdb_cmp(const void *p0, const void *p1);
+static unsigned cfgdb_add_str(char **buf, unsigned *len, unsigned *max, const char *str);
+static int cfgdb_commit(hd_data_t *hd_data, struct hd_cfgdb_batch_s *batch);
+
+
+/*
+ * Check whether config.db is in use.
+ */
+int hd_cfgdb_active()
+{
+  return cfgdb_map() > 0;
+}
+
+
+/*
+ * Properties stored for key (one per line); NULL if there's no entry.
+ */
+char *hd_cfgdb_get(const char *key)
+{
+  int i;
+
+  if(!key || cfgdb_map() <= 0) return NULL;
+
+  while(*key == '/') key++;
+
+  i = cfgdb_find(key);
+
+  return i >= 0 ? new_str(cfgdb.strings + cfgdb.entry[i].data) : NULL;
+}
+
+
+/*
+ * All keys, in sorted order.
+ */
+str_list_t *hd_cfgdb_keys()
+{
+  str_list_t *sl = NULL, **next = &sl;
+  unsigned u;
+
+  if(cfgdb_map() <= 0) return NULL;
+
+  for(u = 0; u < cfgdb.h->entries; u++) {
+    *next = new_mem(sizeof **next);
+    (*next)->str = new_str(cfgdb.strings + cfgdb.entry[u].key);
+    next = &(*next)->next;
+  }
+
+  return sl;
+}
+
+
+/*
+ * Store properties for key.
+ *
+ * Within hd_begin_config() / hd_commit_config() the change is only
+ * recorded; else it's written immediately.
+ *
+ * return 0 if ok
+ */
+int hd_cfgdb_put(hd_data_t *hd_data, const char *key, const char *data)
+{
+  struct hd_cfgdb_batch_s *batch, tmp = { };
+  int err = 0;
+
+  if(!key) return 1;
+
+  while(*key == '/') key++;
+
+  if(!*key) return 1;
+
+  batch = hd_data && hd_data->cfgdb_batch ? hd_data->cfgdb_batch : &tmp;
+
+  if(batch->len == batch->max) {
+    batch->max += 64;
+    batch->entry = resize_mem(batch->entry, batch->max * sizeof *batch->entry);
+  }
+  batch->entry[batch->len].key = new_str(key);
+  batch->entry[batch->len].data = new_str(data ?: "");
+  batch->entry[batch->len].seq = batch->len;
+  batch->len++;
+
+  if(batch == &tmp) {
+    err = cfgdb_commit(hd_data, &tmp);
+    hd_cfgdb_free_batch(&tmp);
+  }
+
+  return err;
+}
+
+
+/*
+ * Make hd_commit_config() create config.db if it doesn't exist.
+ */
+void hd_cfgdb_create(hd_data_t *hd_data)
+{
+  hd_begin_config(hd_data);
+
+  hd_data->cfgdb_batch->create = 1;
+}
+
+
+/*
+ * Free recorded changes.
+ */
+void hd_cfgdb_free_batch(struct hd_cfgdb_batch_s *batch)
+{
+  unsigned u;
+
+  if(!batch) return;
+
+  for(u = 0; u < batch->len; u++) {
+    free_mem(batch->entry[u].key);
+    free_mem(batch->entry[u].data);
+  }
+  batch->entry = free_mem(batch->entry);
+  batch->len = batch->max = 0;
+  batch->create = 0;
+}
+
+
+/*
+ * Collect hd_write_config() calls until hd_commit_config().
+ */
+void hd_begin_config(hd_data_t *hd_data)
+{
+  if(!hd_data->cfgdb_batch) hd_data->cfgdb_batch = new_mem(sizeof *hd_data->cfgdb_batch);
+}
+
+
+/*
+ * Write all config changes since hd_begin_config() at once.
+ *
+ * Only has an effect if config.db is used.
+ *
+ * return 0 if ok
+ */
+int hd_commit_config(hd_data_t *hd_data)
+{
+  int err = 0;
+
+  if(!hd_data->cfgdb_batch) return 0;
+
+  if(hd_data->cfgdb_batch->len || hd_data->cfgdb_batch->create) err = cfgdb_commit(hd_data, hd_data->cfgdb_batch);
+
+  hd_cfgdb_free_batch(hd_data->cfgdb_batch);
+  hd_data->cfgdb_batch = free_mem(hd_data->cfgdb_batch);
+
+  return err;
+}
+
+
+/*
+ * Map config.db (again, if it has been replaced).
+ *
+ * return 1 if ok, 0 if there's no (readable) config.db, -1 if it is broken
+ */
+int cfgdb_map()
+{
+  int fd;
+  struct stat sbuf;
+  unsigned char *data;
+  cfgdb_header_t *h;
+  cfgdb_entry_t *entry;
+  uint64_t size;
+  unsigned u;
+
+  if(stat(hd_get_hddb_path(CFGDB_NAME), &sbuf)) {
+    cfgdb_unmap();
+    return 0;
+  }
+
+  if(
+    cfgdb.data &&
+    sbuf.st_dev == cfgdb.dev &&
+    sbuf.st_ino == cfgdb.ino &&
+    (uint64_t) sbuf.st_size == cfgdb.size &&
+    sbuf.st_mtim.tv_sec == cfgdb.mtime.tv_sec &&
+    sbuf.st_mtim.tv_nsec == cfgdb.mtime.tv_nsec
+  ) return 1;
+
+  cfgdb_unmap();
+
+  if((fd = open(hd_get_hddb_path(CFGDB_NAME), O_RDONLY)) == -1) return 0;
+
+  if(
+    fstat(fd, &sbuf) ||
+    !S_ISREG(sbuf.st_mode) ||
+    sbuf.st_size < (off_t) sizeof *h ||
+    sbuf.st_size > 0x7fffffff
+  ) {
+    close(fd);
+    return S_ISREG(sbuf.st_mode) ? -1 : 0;
+  }
+
+  size = sbuf.st_size;
+  data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(data == MAP_FAILED) return 0;
+
+  h = (cfgdb_header_t *) data;
+  entry = (cfgdb_entry_t *) (h + 1);
+
+  if(
+    h->magic != CFGDB_MAGIC ||
+    h->version != CFGDB_VERSION ||
+    h->size != size ||
+    sizeof *h + (uint64_t) h->entries * sizeof *entry > h->strings_ofs ||
+    h->strings_ofs + (uint64_t) h->strings_len > size ||
+    !h->strings_len ||
+    data[h->strings_ofs + h->strings_len - 1]
+  ) {
+    munmap(data, size);
+    return -1;
+  }
+
+  for(u = 0; u < h->entries; u++) {
+    if(entry[u].key >= h->strings_len || entry[u].data >= h->strings_len) {
+      munmap(data, size);
+      return -1;
+    }
+  }
+
+  cfgdb.data = data;
+  cfgdb.size = size;
+  cfgdb.dev = sbuf.st_dev;
+  cfgdb.ino = sbuf.st_ino;
+  cfgdb.mtime = sbuf.st_mtim;
+  cfgdb.h = h;
+  cfgdb.entry = entry;
+  cfgdb.strings = (char *) data + h->strings_ofs;
+
+  return 1;
+}
+
+
+void cfgdb_unmap()
+{
+  if(cfgdb.data) munmap(cfgdb.data, cfgdb.size);
+
+  memset(&cfgdb, 0, sizeof cfgdb);
+}
+
+
+/*
+ * Binary search for key; returns entry index or -1.
+ */
+int cfgdb_find(const char *key)
+{
+  int l = 0, r = cfgdb.h->entries - 1, m, i;
+
+  while(l <= r) {
+    m = (l + r) / 2;
+    i = strcmp(key, cfgdb.strings + cfgdb.entry[m].key);
+    if(!i) return m;
+    if(i < 0) {
+      r = m - 1;
+    }
+    else {
+      l = m + 1;
+    }
+  }
+
+  return -1;
+}
+
+
+int cfgdb_cmp(const void *p0, const void *p1)
+{
+  const cfgdb_change_t *e0 = p0, *e1 = p1;
+  int i;
+
+  i = strcmp(e0->key, e1->key);
+
+  return i ?: (int) e0->seq - (int) e1->seq;
+}
+
+
+unsigned cfgdb_add_str(char **buf, unsigned *len, unsigned *max, const char *str)
+{
+  unsigned ofs = *len, l = strlen(str) + 1;
+
+  if(*len + l > *max) {
+    *max = *len + l + 0x10000;
+    *buf = resize_mem(*buf, *max);
+  }
+  memcpy(*buf + ofs, str, l);
+  *len += l;
+
+  return ofs;
+}
+
+
+/*
+ * Write a new config.db: the current one with the changes applied.
+ *
+ * Writers are serialized via config.db.lock. A config.db that is broken
+ * is not overwritten but moved to config.db.bad.
+ *
+ * return 0 if ok
+ */
+int cfgdb_commit(hd_data_t *hd_data, struct hd_cfgdb_batch_s *batch)
+{
+  cfgdb_header_t h = { };
+  cfgdb_entry_t *entry;
+  char *strings = NULL, *tmp = NULL, *key0, *key1;
+  unsigned u0, u1, len0, strings_max = 0;
+  int fd, lock_fd, i, ok = 0;
+
+  qsort(batch->entry, batch->len, sizeof *batch->entry, cfgdb_cmp);
+
+  /* drop all but the last change per key */
+  for(u0 = u1 = 0; u1 < batch->len; u1++) {
+    if(u1 + 1 < batch->len && !strcmp(batch->entry[u1].key, batch->entry[u1 + 1].key)) {
+      free_mem(batch->entry[u1].key);
+      free_mem(batch->entry[u1].data);
+      continue;
+    }
+    batch->entry[u0++] = batch->entry[u1];
+  }
+  batch->len = u0;
+
+  lock_fd = open(hd_get_hddb_path(CFGDB_NAME ".lock"), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(lock_fd == -1 || flock(lock_fd, LOCK_EX)) {
+    if(lock_fd != -1) close(lock_fd);
+    return 1;
+  }
+
+  if((i = cfgdb_map()) < 0) {
+    /* hd_get_hddb_path() returns a static buffer */
+    str_printf(&tmp, 0, "%s.bad", hd_get_hddb_path(CFGDB_NAME));
+    if(rename(hd_get_hddb_path(CFGDB_NAME), tmp)) {
+      if(hd_data) ADD2LOG("config.db: broken, not written\n");
+      close(lock_fd);
+      free_mem(tmp);
+      return 1;
+    }
+    if(hd_data) ADD2LOG("config.db: broken, moved to config.db.bad\n");
+  }
+
+  len0 = i > 0 ? cfgdb.h->entries : 0;
+
+  entry = new_mem((len0 + batch->len) * sizeof *entry);
+
+  /* merge both sorted lists */
+  for(u0 = u1 = 0; u0 < len0 || u1 < batch->len; h.entries++) {
+    key0 = u0 < len0 ? cfgdb.strings + cfgdb.entry[u0].key : NULL;
+    key1 = u1 < batch->len ? batch->entry[u1].key : NULL;
+    i = !key0 ? 1 : !key1 ? -1 : strcmp(key0, key1);
+    if(i < 0) {
+      entry[h.entries].key = cfgdb_add_str(&strings, &h.strings_len, &strings_max, key0);
+      entry[h.entries].data = cfgdb_add_str(&strings, &h.strings_len, &strings_max, cfgdb.strings + cfgdb.entry[u0].data);
+      u0++;
+    }
+    else {
+      entry[h.entries].key = cfgdb_add_str(&strings, &h.strings_len, &strings_max, key1);
+      entry[h.entries].data = cfgdb_add_str(&strings, &h.strings_len, &strings_max, batch->entry[u1].data);
+      u1++;
+      if(!i) u0++;
+    }
+  }
+
+  if(!strings) cfgdb_add_str(&strings, &h.strings_len, &strings_max, "");
+
+  h.magic = CFGDB_MAGIC;
+  h.version = CFGDB_VERSION;
+  h.strings_ofs = sizeof h + h.entries * sizeof *entry;
+  h.size = h.strings_ofs + h.strings_len;
+
+  /* write to temporary file & rename, there might be concurrent readers */
+  str_printf(&tmp, 0, "%s.XXXXXX", hd_get_hddb_path(CFGDB_NAME));
+
+  if((fd = mkstemp(tmp)) != -1) {
+    ok =
+      fchmod(fd, 0644) == 0 &&
+      write(fd, &h, sizeof h) == sizeof h &&
+      write(fd, entry, h.entries * sizeof *entry) == (ssize_t) (h.entries * sizeof *entry) &&
+      write(fd, strings, h.strings_len) == (ssize_t) h.strings_len &&
+      fsync(fd) == 0;
+    if(close(fd)) ok = 0;
+    if(ok && !rename(tmp, hd_get_hddb_path(CFGDB_NAME))) {
+      if(hd_data) ADD2LOG("config.db: %u entries, %u changed\n", h.entries, batch->len);
+    }
+    else {
+      ok = 0;
+      unlink(tmp);
+    }
+  }
+
+  close(lock_fd);
+
+  free_mem(tmp);
+  free_mem(strings);
+  free_mem(entry);
+
+  return ok ? 0 : 1;
+}
+
+/** @} */
+
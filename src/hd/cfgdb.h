@@ -0,0 +1,6 @@
+int hd_cfgdb_active(void);
+char *hd_cfgdb_get(const char *key);
+str_list_t *hd_cfgdb_keys(void);
+int hd_cfgdb_put(hd_data_t *hd_data, const char *key, const char *data);
+void hd_cfgdb_create(hd_data_t *hd_data);
+void hd_cfgdb_free_batch(struct hd_cfgdb_batch_s *batch);
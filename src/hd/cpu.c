@@ -34,6 +34,30 @@ static void dump_cpu_data(hd_data_t *hd_data);
 
 #if defined(__i386__) || defined(__x86_64__)
 static inline unsigned units_per_cpu();
+static int cpuinfo_key(char *key);
+static hd_cpu_flags_t *cpu_flags(hd_data_t *hd_data, char *str);
+
+/* /proc/cpuinfo lines we look at */
+enum cpuinfo_key {
+  ci_none, ci_processor, ci_model_name, ci_vendor_id, ci_flags, ci_bogomips,
+  ci_mhz, ci_cache, ci_family, ci_model, ci_stepping
+};
+
+static struct {
+  char *name;
+  enum cpuinfo_key key;
+} cpuinfo_keys[] = {
+  { "processor",  ci_processor  },
+  { "vendor_id",  ci_vendor_id  },
+  { "cpu family", ci_family     },
+  { "model",      ci_model      },
+  { "model name", ci_model_name },
+  { "stepping",   ci_stepping   },
+  { "cpu MHz",    ci_mhz        },
+  { "cache size", ci_cache      },
+  { "flags",      ci_flags      },
+  { "bogomips",   ci_bogomips   }
+};
 #endif
 #ifdef __ia64__
 static int ia64DetectSMP(hd_data_t *hd_data);
@@ -86,13 +110,16 @@ void read_cpuinfo(hd_data_t *hd_data)
   hd_t *hd;
   unsigned cpus = 0;
   cpu_info_t *ct;
+#if !defined(__i386__) && !defined (__x86_64__)
   str_list_t *sl;
+#endif
 
 #if defined(__i386__) || defined (__x86_64__)
-  char model_id[80], vendor_id[80], features[0x400];
-  unsigned mhz, cache, family, model, stepping;
+  hd_file_t *file;
+  hd_cpu_flags_t *flags;
+  char *model_id, *vendor_id, *key, *val, *s;
+  unsigned mhz, cache, family, model, stepping, u;
   double bogo;
-  char *t0, *t;
 #endif
 
 #ifdef __ia64__
@@ -149,7 +176,14 @@ void read_cpuinfo(hd_data_t *hd_data)
   double bogo;
 #endif
 
+#if defined(__i386__) || defined (__x86_64__)
+  /* parsed in place, see below */
+  file = hd_read_file(PROC_CPUINFO, 0);
+  hd_data->cpu = hd_file_str_list(file, 0, 0);
+  if(!hd_data->cpu) file = hd_free_file(file);
+#else
   hd_data->cpu = read_file(PROC_CPUINFO, 0, 0);
+#endif
   if((hd_data->debug & HD_DEB_CPU)) dump_cpu_data(hd_data);
   if(!hd_data->cpu) return;
 
@@ -390,24 +424,71 @@ void read_cpuinfo(hd_data_t *hd_data)
 
 
 #if defined(__i386__) || defined (__x86_64__)
-  *model_id = *vendor_id = *features = 0;
+  model_id = vendor_id = NULL;
+  flags = NULL;
   mhz = cache = family = model = stepping = 0;
   bogo = 0;
 
-  for(sl = hd_data->cpu; sl; sl = sl->next) {
-    if(sscanf(sl->str, "model name : %79[^\n]", model_id) == 1);
-    if(sscanf(sl->str, "vendor_id : %79[^\n]", vendor_id) == 1);
-    if(sscanf(sl->str, "flags : %1023[^\n]", features) == 1);
-    if(sscanf(sl->str, "bogomips : %lg", &bogo) == 1);
-    if(sscanf(sl->str, "cpu MHz : %u", &mhz) == 1);
-    if(sscanf(sl->str, "cache size : %u KB", &cache) == 1);
+  /*
+   * Look at each line once: split it into key and value and only parse
+   * the value if we need it. Strings point into file->data.
+   */
+  for(u = 0; u < file->len; u++) {
+    key = file->data + file->line[u].ofs;
+    if(key[file->line[u].len - 1] == '\n') key[file->line[u].len - 1] = 0;
+
+    val = NULL;
+    if((s = strchr(key, ':'))) {
+      val = s + 1;
+      while(s > key && (s[-1] == ' ' || s[-1] == '\t')) s--;
+      *s = 0;
+      while(*val == ' ' || *val == '\t') val++;
+      if(!*val) val = NULL;
+    }
 
-    if(sscanf(sl->str, "cpu family : %u", &family) == 1);
-    if(sscanf(sl->str, "model : %u", &model) == 1);
-    if(sscanf(sl->str, "stepping : %u", &stepping) == 1);
+    switch(val ? cpuinfo_key(key) : ci_none) {
+      case ci_model_name:
+        model_id = val;
+        break;
 
-    if(strstr(sl->str, "processor") == sl->str || !sl->next) {		/* EOF */
-      if(*model_id || *vendor_id) {	/* at least one of those */
+      case ci_vendor_id:
+        vendor_id = val;
+        break;
+
+      case ci_flags:
+        flags = cpu_flags(hd_data, val);
+        break;
+
+      case ci_bogomips:
+        sscanf(val, "%lg", &bogo);
+        break;
+
+      case ci_mhz:
+        sscanf(val, "%u", &mhz);
+        break;
+
+      case ci_cache:
+        sscanf(val, "%u", &cache);
+        break;
+
+      case ci_family:
+        sscanf(val, "%u", &family);
+        break;
+
+      case ci_model:
+        sscanf(val, "%u", &model);
+        break;
+
+      case ci_stepping:
+        sscanf(val, "%u", &stepping);
+        break;
+
+      default:
+        break;
+    }
+
+    if(!strncmp(key, "processor", sizeof "processor" - 1) || u + 1 == file->len) {		/* EOF */
+      if(model_id || vendor_id) {	/* at least one of those */
         ct = new_mem(sizeof *ct);
 #ifdef __i386__
 	ct->architecture = arch_intel;
@@ -415,8 +496,8 @@ void read_cpuinfo(hd_data_t *hd_data)
 #ifdef __x86_64__
 	ct->architecture = arch_x86_64;
 #endif
-        if(*model_id) ct->model_name = new_str(model_id);
-        if(*vendor_id) ct->vend_name = new_str(vendor_id);
+        if(model_id) ct->model_name = new_str(model_id);
+        if(vendor_id) ct->vend_name = new_str(vendor_id);
         ct->family = family;
         ct->model = model;
         ct->stepping = stepping;
@@ -462,20 +543,22 @@ void read_cpuinfo(hd_data_t *hd_data)
         hd->detail->type = hd_detail_cpu;
         hd->detail->cpu.data = ct;
 
-        if(*features) {
-          for(t0 = features; (t = strsep(&t0, " ")); ) {
-            add_str_list(&ct->features, t);
-            if(!strcmp(t, "ht")) ct->units = units_per_cpu();
-          }
+        /* shared by all cpus with the same flags */
+        if(flags) {
+          ct->features = flags->features;
+          ct->features_shared = 1;
+          ct->units = flags->units;
         }
 
-        *model_id = *vendor_id = 0;
+        model_id = vendor_id = NULL;
         mhz = cache = family = model= 0;
         bogo = 0;
         cpus++;
       }
     }
   }
+
+  hd_free_file(file);
 #endif /* __i386__ || __x86_64__ */
 
 
@@ -700,6 +783,46 @@ void dump_cpu_data(hd_data_t *hd_data)
 
 
 #if defined(__i386__) || defined(__x86_64__)
+/*
+ * Map /proc/cpuinfo key to enum cpuinfo_key.
+ */
+int cpuinfo_key(char *key)
+{
+  unsigned u;
+
+  for(u = 0; u < sizeof cpuinfo_keys / sizeof *cpuinfo_keys; u++) {
+    if(*key == *cpuinfo_keys[u].name && !strcmp(key, cpuinfo_keys[u].name)) return cpuinfo_keys[u].key;
+  }
+
+  return ci_none;
+}
+
+
+/*
+ * Feature list for a 'flags' line. There's one list per distinct line,
+ * kept in hd_data->cpu_flags.
+ */
+hd_cpu_flags_t *cpu_flags(hd_data_t *hd_data, char *str)
+{
+  hd_cpu_flags_t *flags;
+
+  for(flags = hd_data->cpu_flags; flags; flags = flags->next) {
+    if(!strcmp(flags->str, str)) return flags;
+  }
+
+  flags = new_mem(sizeof *flags);
+  flags->str = new_str(str);
+  flags->features = hd_split(' ', str);
+  if(search_str_list(flags->features, "ht")) flags->units = units_per_cpu();
+
+  /* prepend: hd_data may be a copy (cf. merge_cpu()) */
+  flags->next = hd_data->cpu_flags;
+  hd_data->cpu_flags = flags;
+
+  return flags;
+}
+
+
 inline unsigned units_per_cpu()
 {
   unsigned u;
@@ -27,6 +27,7 @@
 #include "hd.h"
 #include "hd_int.h"
 #include "hal.h"
+#include "cfgdb.h"
 
 /**
  * @defgroup HALint Hardware abstraction (HAL) information
@@ -498,10 +499,51 @@ int check_udi(const char *udi)
 }
 
 
+/*
+ * Properties as text, one per line.
+ */
+char *hal_props2str(hal_prop_t *prop)
+{
+  char *s, *str = NULL;
+
+  for(; prop; prop = prop->next) {
+    if(prop->type == p_invalid) continue;
+    s = hd_hal_print_prop(prop);
+    if(s) str_printf(&str, -2, "%s\n", s);
+  }
+
+  return str;
+}
+
+
 int hd_write_properties(const char *udi, hal_prop_t *prop)
+{
+  return hd_write_properties2(NULL, udi, prop);
+}
+
+
+/*
+ * Write properties; to config.db if it's used (cf. hd_begin_config()).
+ *
+ * hd_data may be NULL.
+ */
+int hd_write_properties2(hd_data_t *hd_data, const char *udi, hal_prop_t *prop)
 {
   FILE *f;
   char *s;
+  int err;
+
+  if(hd_cfgdb_active()) {
+    if(!udi) return 1;
+    while(*udi == '/') udi++;
+    if(!check_udi(udi)) return 1;
+
+    s = hal_props2str(prop);
+    err = hd_cfgdb_put(hd_data, udi, s);
+    free_mem(s);
+
+    return err;
+  }
 
   f = hd_open_properties(udi, "w");
 
@@ -531,9 +573,14 @@ hal_prop_t *hd_read_properties(const char *udi)
 
   if(!check_udi(udi)) return NULL;
 
-  str_printf(&path, 0, "%s/%s", hd_get_hddb_path("udi"), udi);
+  if((path = hd_cfgdb_get(udi))) {
+    sl0 = hd_split('\n', path);
+  }
+  else {
+    str_printf(&path, 0, "%s/%s", hd_get_hddb_path("udi"), udi);
 
-  sl0 = read_file(path, 0, 0);
+    sl0 = read_file(path, 0, 0);
+  }
 
   free_mem(path);
 
@@ -599,6 +646,7 @@ FILE *hd_open_properties(const char *udi, const char *mode)
   }
 
   free_mem(dir);
+  free_str_list(path);
 
   return f;
 }
@@ -1,3 +1,5 @@
 void hd_scan_hal(hd_data_t *hd_data);
 void hd_scan_hal_basic(hd_data_t *hd_data);
 void hd_scan_hal_assign_udi(hd_data_t *hd_data);
+char *hal_props2str(hal_prop_t *prop);
+int hd_write_properties2(hd_data_t *hd_data, const char *udi, hal_prop_t *prop);
@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <dirent.h>
 #include <time.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -19,6 +20,9 @@
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 #include <linux/pci.h>
 #include <linux/hdreg.h>
 #define _LINUX_AUDIT_H_
@@ -93,6 +97,10 @@
 #include "hal.h"
 #include "klog.h"
 #include "drm.h"
+#include "cache.h"
+#include "acpi.h"
+#include "sysfs.h"
+#include "cfgdb.h"
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  * various functions commmon to all probing modules
@@ -174,18 +182,32 @@ static int set_probe_val(hd_data_t *hd_data, enum probe_feature feature, char *v
 static void fix_probe_features(hd_data_t *hd_data);
 static void set_probe_feature(hd_data_t *hd_data, enum probe_feature feature, unsigned val);
 static void free_old_hd_entries(hd_data_t *hd_data);
+static void free_scan_data(hd_data_t *hd_data);
 static hd_t *free_hd_entry(hd_t *hd);
 static hd_t *add_hd_entry2(hd_t **hd, hd_t *new_hd);
+static hd_t *append_hd_entry(hd_data_t *hd_data, hd_t *hd);
 static void timeout_alarm_handler(int signal);
 static void get_probe_env(hd_data_t *hd_data);
 static void hd_scan_xtra(hd_data_t *hd_data);
 static hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id);
+static char *hd_index_key(hd_t *hd, unsigned type);
+static int hd_join_hash(hd_t *hd, unsigned type, unsigned *hv);
+static hd_t *hd_index_find(hd_data_t *hd_data, hddb2_hash_t *hash, unsigned type, char *key, char *devname);
 static int has_item(hd_hw_item_t *items, hd_hw_item_t item);
 static int has_hw_class(hd_t *hd, hd_hw_item_t *items);
 static void hd_scan_with_hal(hd_data_t *hd_data);
 static void hd_scan_no_hal(hd_data_t *hd_data);
+static void hd_scan_steps(hd_data_t *hd_data);
+static void *scan_step_thread(void *arg);
+static void hd_scan_wave(hd_data_t *hd_data, struct scan_step_s *steps, unsigned len);
+static void hd_scan_merge(hd_data_t *hd_data, hd_data_t *sub, struct scan_step_s *step);
+#ifndef LIBHD_TINY
+static void scan_parport(hd_data_t *hd_data);
+#endif
+static void merge_cpu(hd_data_t *hd_data, hd_data_t *sub);
+static void merge_pci(hd_data_t *hd_data, hd_data_t *sub);
 
-static void test_read_block0_open(void *arg);
+static void *read_block0_thread(void *arg);
 static void get_kernel_version(hd_data_t *hd_data);
 static int is_modem(hd_data_t *hd_data, hd_t *hd);
 static int is_audio(hd_data_t *hd_data, hd_t *hd);
@@ -194,7 +216,12 @@ static void assign_hw_class(hd_data_t *hd_data, hd_t *hd);
 static void short_vendor(char *vendor);
 static void create_model_name(hd_data_t *hd_data, hd_t *hd);
 
+static void log_drop(hd_data_t *hd_data, size_t len);
 static void copy_log2shm(hd_data_t *hd_data);
+static void hd_fork_thread(hd_data_t *hd_data, int timeout, int total_timeout, hd_probe_func_t func, void *arg);
+static void *probe_thread(void *arg);
+static int hd_timeout_thread(void(*func)(void *), void *arg, int timeout);
+static void *timeout_thread(void *arg);
 static void sigchld_handler(int);
 static void sigusr1_handler(int);
 static pid_t child_id;
@@ -204,9 +231,52 @@ static str_list_t *hd_shm_add_str_list(hd_data_t *hd_data, str_list_t *sl);
 
 static hd_udevinfo_t *hd_free_udevinfo(hd_udevinfo_t *ui);
 static hd_sysfsdrv_t *hd_free_sysfsdrv(hd_sysfsdrv_t *sf);
+static void sysfs_shim_done(void);
+static void sysfs_shim_cleanup(void *arg);
+static int entry_in_scope(hd_data_t *hd_data, hd_t *hd);
+static void add_parent_idx(unsigned **list, unsigned *len, unsigned idx);
+static void rescan_drop_out_of_scope(hd_data_t *hd_data, unsigned last_idx);
+static char *sysfs_read_fd(hd_sysfs_dir_t *dir, int fd, unsigned *len);
+
+static void *arena_alloc(hd_data_t *hd_data, size_t size);
+static hd_arena_t *arena_chunk(void *p);
+static void arena_free(hd_data_t *hd_data);
 
 static hd_data_t *hd_data_sig;
 
+/*
+ * Allocation arena, cf. hd_data->flags.arena.
+ *
+ * While hd_scan() runs, new_mem() and new_str() take memory from the
+ * arena of the hd_data being scanned (only in the scanning thread). free_mem()
+ * ignores arena memory; hd_free_hd_data() and hd_reset_scan() release the
+ * whole arena.
+ */
+#define ARENA_CHUNK_SIZE	(256 << 10)
+#define ARENA_MAX_OBJ		(ARENA_CHUNK_SIZE / 16)
+#define ARENA_ALIGN		16
+#define ARENA_CHUNKS_MAX	1024		/* beyond that, use the heap */
+
+struct hd_arena_s {
+  hd_arena_t *next;		/* older chunk of the same hd_data */
+  hd_data_t *hd_data;		/* owner */
+  size_t used;			/* bytes used in data[] */
+  unsigned char data[ARENA_CHUNK_SIZE] __attribute__ ((aligned (ARENA_ALIGN)));
+};
+
+static __thread hd_data_t *arena_data;		/* arena in use (in this thread) */
+
+/*
+ * All arena chunks of all hd_data, sorted by address, cf. arena_chunk().
+ *
+ * arena_chunk() doesn't lock: it retries if arena_seq changed while it
+ * looked (odd: update in progress). Updates are serialized by arena_lock.
+ */
+static hd_arena_t *arena_list[ARENA_CHUNKS_MAX];
+static unsigned arena_list_len;
+static unsigned arena_seq;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Names of the probing modules.
  * Cf. enum mod_idx in hd_int.h.
@@ -334,6 +404,7 @@ static pr_flags_t pr_flags[] = {
   { pr_scan,          0,                  0, "scan",         p_bool },
   { pr_pcmcia,        0,            8|4|2|1, "pcmcia",       p_bool },
   { pr_fork,          0,                  0, "fork",         p_bool },
+  { pr_fork_threads,  pr_fork,            0, "fork.threads", p_bool }, /* isolate probes in threads, not processes */
   { pr_cpuemu,        0,                  0, "cpuemu",       p_bool },
   { pr_cpuemu_debug,  pr_cpuemu,          0, "cpuemu.debug", p_bool },
   { pr_sysfs,         0,                  0, "sysfs",        p_bool },
@@ -349,6 +420,101 @@ static pr_flags_t pr_flags[] = {
   { pr_hal,           0,                  0, "hal",          p_bool },
   { pr_modules_pata,  0,                  0, "modules.pata", p_bool },
   { pr_x86emu,        0,                  0, "x86emu",       p_list },
+  { pr_modules_cache, 0,                  0, "modules.cache", p_bool }, /* cache parsed modules.alias */
+  { pr_threads,       0,                  0, "threads",      p_bool }, /* run isolated probing steps in threads */
+  { pr_scan_cache,    0,                  0, "scan.cache",   p_bool }, /* reuse stored scan results */
+  { pr_arena,         0,                  0, "arena",        p_bool }, /* allocate scan data from an arena */
+};
+
+/*
+ * Probing steps for hd_scan_no_hal(). Cf. hd_scan_steps().
+ */
+enum scan_step_id {
+  step_floppy, step_bios, step_sys, step_misc, step_cpu, step_memory,
+  step_pci, step_prom, step_s390disks, step_s390, step_monitor, step_isapnp,
+  step_isa, step_pcmcia, step_serial, step_misc2, step_parallel, step_block,
+  step_scsi, step_usb, step_edd, step_braille, step_modem, step_mouse,
+  step_sbus, step_input, step_kbd, step_fb, step_net, step_pppoe, step_wlan
+};
+
+#define STEP(a) (1u << step_##a)
+
+typedef struct scan_step_s {
+  enum scan_step_id id;
+  void (*scan)(hd_data_t *hd_data);
+  unsigned after;			/* STEP() mask: steps whose results we need */
+  unsigned isolated:1;			/* see hd_scan_wave() */
+  enum mod_idx mod;			/* isolated steps: module & probe feature */
+  enum probe_feature feature;
+  void (*merge)(hd_data_t *hd_data, hd_data_t *sub);	/* isolated steps: copy hd_data fields back */
+} scan_step_t;
+
+/*
+ * Steps run in table order; 'after' must only reference earlier entries.
+ */
+static scan_step_t scan_steps[] = {
+  /* for various reasons, do it before hd_scan_misc() */
+  { step_floppy,    hd_scan_floppy },
+#if defined(__i386__) || defined (__x86_64__) || defined (__ia64__)
+  /* to be able to read the right parport io, do it before hd_scan_misc() */
+  { step_bios,      hd_scan_bios },
+#endif
+  /* before hd_scan_misc(): we need some ppc info later */
+  { step_sys,       hd_scan_sys,        STEP(bios) },
+  /* get basic system info */
+  { step_misc,      hd_scan_misc,       STEP(floppy) | STEP(bios) | STEP(sys) },
+  /* klog needed */
+  { step_cpu,       hd_scan_cpu,        STEP(misc), 1, mod_cpu, pr_cpu, merge_cpu },
+  { step_memory,    hd_scan_memory,     STEP(misc), 1, mod_memory, pr_memory },
+  { step_pci,       hd_scan_sysfs_pci,  0, 1, mod_pci, pr_pci, merge_pci },
+#if defined(__PPC__)
+  { step_prom,      hd_scan_prom,       STEP(pci) },
+#endif
+#if defined(__s390__) || defined(__s390x__)
+  { step_s390disks, hd_scan_s390disks },
+  { step_s390,      hd_scan_s390 },
+#endif
+  { step_monitor,   hd_scan_monitor,    STEP(bios) | STEP(prom) },
+#ifndef LIBHD_TINY
+#if defined(__i386__) || defined(__alpha__)
+  { step_isapnp,    hd_scan_isapnp },
+#endif
+#if defined(__i386__)
+  { step_isa,       hd_scan_isa },
+#endif
+#endif
+  { step_pcmcia,    hd_scan_pcmcia,     STEP(pci) | STEP(isa) },
+  { step_serial,    hd_scan_serial,     STEP(pci) },
+  /* merge basic system info & the easy stuff */
+  { step_misc2,     hd_scan_misc2,      STEP(misc) | STEP(pci) | STEP(isapnp) | STEP(isa) | STEP(pcmcia) | STEP(serial) },
+#ifndef LIBHD_TINY
+  { step_parallel,  scan_parport,       STEP(misc) | STEP(misc2) },
+#endif
+  { step_block,     hd_scan_sysfs_block, STEP(pci) },
+  { step_scsi,      hd_scan_sysfs_scsi, STEP(block) },
+  { step_usb,       hd_scan_sysfs_usb,  STEP(pci) },
+#if defined(__i386__) || defined(__x86_64__)
+  { step_edd,       hd_scan_sysfs_edd,  STEP(block) },
+#endif
+#ifndef LIBHD_TINY
+#if !defined(__sparc__)
+  { step_braille,   hd_scan_braille,    STEP(serial) },
+#endif
+  { step_modem,     hd_scan_modem,      STEP(serial) },
+  { step_mouse,     hd_scan_mouse,      STEP(modem) | STEP(usb) },
+#endif
+  { step_sbus,      hd_scan_sbus },
+  { step_input,     hd_scan_input,      STEP(usb) },
+#if !defined(__s390__) && !defined(__s390x__)
+  { step_kbd,       hd_scan_kbd,        STEP(input) },
+#endif
+  { step_fb,        hd_scan_fb,         STEP(monitor) },
+  /* keep these at the end of the list */
+  { step_net,       hd_scan_net,        STEP(pci) | STEP(usb) },
+  { step_pppoe,     hd_scan_pppoe,      STEP(net) },
+#ifndef LIBHD_TINY
+  { step_wlan,      hd_scan_wlan,       STEP(net) },
+#endif
 };
 
 
@@ -972,37 +1138,32 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   modinfo_t *p;
   unsigned u;
 
-  add_hd_entry2(&hd_data->old_hd, hd_data->hd); hd_data->hd = NULL;
+  free_scan_data(hd_data);
+
   hd_data->log = free_mem(hd_data->log);
-  free_old_hd_entries(hd_data);		/* hd_data->old_hd */
-  /* hd_data->pci is always NULL */
-  /* hd_data->isapnp->card is always NULL */
-  hd_data->isapnp = free_mem(hd_data->isapnp);
-  /* hd_data->cdrom is always NULL */
-  hd_data->net = free_str_list(hd_data->net);
-  hd_data->floppy = free_str_list(hd_data->floppy);
-  hd_data->misc = free_misc(hd_data->misc);
-  /* hd_data->serial is always NULL */
-  /* hd_data->scsi is always NULL */
-  /* hd_data->ser_mouse is always NULL */
-  /* hd_data->ser_modem is always NULL */
-  hd_data->cpu = free_str_list(hd_data->cpu);
-  hd_data->klog = free_str_list(hd_data->klog);
-  hd_data->klog_raw = free_str_list(hd_data->klog_raw);
-  hd_data->proc_usb = free_str_list(hd_data->proc_usb);
-  /* hd_data->usb is always NULL */
 
-  if((p = hd_data->modinfo)) {
+  if((p = hd_data->modinfo) && !hd_data->modinfo_map.data) {
     for(; p->type; p++) {
       free_mem(p->module);
       free_mem(p->alias);
     }
   }
   hd_data->modinfo = free_mem(hd_data->modinfo);
+  if(hd_data->modinfo_map.data) {
+    munmap(hd_data->modinfo_map.data, hd_data->modinfo_map.size);
+    hd_data->modinfo_map.data = NULL;
+  }
   if((p = hd_data->modinfo_ext)) {
     for(; p->type; p++) free_mem(p->module);
   }
   hd_data->modinfo = free_mem(hd_data->modinfo_ext);
+  hd_data->modinfo_index = hddb_free_modinfo_index(hd_data->modinfo_index);
+
+  if(hd_data->hddb2_map.data) {
+    munmap(hd_data->hddb2_map.data, hd_data->hddb2_map.size);
+    hd_data->hddb2_map.data = NULL;
+    hd_data->hddb2[0] = free_mem(hd_data->hddb2[0]);
+  }
 
   if(hd_data->hddb2[0]) {
     free_mem(hd_data->hddb2[0]->list);
@@ -1013,13 +1174,11 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   /* hddb2[1] is the static internal database; don't try to free it! */
   hd_data->hddb2[1] = NULL;
 
-  hd_data->kmods = free_str_list(hd_data->kmods);
-  hd_data->bios_rom.data = free_mem(hd_data->bios_rom.data);
-  hd_data->bios_ram.data = free_mem(hd_data->bios_ram.data);
-  hd_data->bios_ebda.data = free_mem(hd_data->bios_ebda.data);
-  hd_data->cmd_line = free_mem(hd_data->cmd_line);
+  for(u = 0; u < sizeof hd_data->hddb2_index / sizeof *hd_data->hddb2_index; u++) {
+    hd_data->hddb2_index[u] = hddb_free_index(hd_data->hddb2_index[u]);
+  }
+
   hd_data->xtra_hd = free_str_list(hd_data->xtra_hd);
-  hd_data->devtree = free_devtree(hd_data);
 
 #if 0
   // always NULL -> manual.c
@@ -1031,6 +1190,99 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   hd_data->manual = NULL;
 #endif
 
+  hd_data->only = free_str_list(hd_data->only);
+
+  /* uncommitted config changes are dropped */
+  hd_cfgdb_free_batch(hd_data->cfgdb_batch);
+  hd_data->cfgdb_batch = free_mem(hd_data->cfgdb_batch);
+
+  hd_data->probe_val = hd_free_hal_properties(hd_data->probe_val);
+
+  hd_data->last_idx = 0;
+
+  hd_shm_done(hd_data);
+
+  /* everything from the arena at once */
+  arena_free(hd_data);
+
+  memset(hd_data, 0, sizeof *hd_data);
+
+  return NULL;
+}
+
+
+/*
+ * Drop all hardware entries and the data gathered while scanning, but keep
+ * settings, hardware database and module info.
+ *
+ * With hd_data->flags.arena, this releases the arena, too. So a long-running
+ * program that scans again and again should call it after each scan, once
+ * all lists returned by hd_list() & co have been freed.
+ */
+void hd_reset_scan(hd_data_t *hd_data)
+{
+  free_scan_data(hd_data);
+  arena_free(hd_data);
+}
+
+
+/*
+ * Memory held by the arena of hd_data (cf. flags.arena).
+ *
+ * It only grows until hd_reset_scan() or hd_free_hd_data() is called.
+ */
+size_t hd_arena_size(hd_data_t *hd_data)
+{
+  hd_arena_t *chunk;
+  size_t size = 0;
+
+  for(chunk = hd_data->arena; chunk; chunk = chunk->next) size += sizeof *chunk;
+
+  return size;
+}
+
+
+/*
+ * Free all data hd_scan() gathers, cf. hd_free_hd_data(), hd_reset_scan().
+ *
+ * Note: hardware database and module info are never allocated from the arena.
+ */
+void free_scan_data(hd_data_t *hd_data)
+{
+  unsigned u;
+
+  add_hd_entry2(&hd_data->old_hd, hd_data->hd); hd_data->hd = NULL;
+  hd_index_drop(hd_data);
+  sysfs_shim_done();
+  hd_sysfs_tree_done(hd_data);
+  hd_data->hd_index.by_idx = free_mem(hd_data->hd_index.by_idx);
+  hd_data->hd_index.by_idx_len = 0;
+  free_old_hd_entries(hd_data);		/* hd_data->old_hd */
+  /* hd_data->pci is always NULL */
+  /* hd_data->isapnp->card is always NULL */
+  hd_data->isapnp = free_mem(hd_data->isapnp);
+  /* hd_data->cdrom is always NULL */
+  hd_data->net = free_str_list(hd_data->net);
+  hd_data->floppy = free_str_list(hd_data->floppy);
+  hd_data->misc = free_misc(hd_data->misc);
+  /* hd_data->serial is always NULL */
+  /* hd_data->scsi is always NULL */
+  /* hd_data->ser_mouse is always NULL */
+  /* hd_data->ser_modem is always NULL */
+  hd_data->cpu = free_str_list(hd_data->cpu);
+  hd_data->cpu_flags = free_cpu_flags(hd_data->cpu_flags);
+  hd_data->klog = free_str_list(hd_data->klog);
+  hd_data->klog_raw = free_str_list(hd_data->klog_raw);
+  hd_data->proc_usb = free_str_list(hd_data->proc_usb);
+  /* hd_data->usb is always NULL */
+
+  hd_data->kmods = free_str_list(hd_data->kmods);
+  hd_data->bios_rom.data = free_mem(hd_data->bios_rom.data);
+  hd_data->bios_ram.data = free_mem(hd_data->bios_ram.data);
+  hd_data->bios_ebda.data = free_mem(hd_data->bios_ebda.data);
+  hd_data->cmd_line = free_mem(hd_data->cmd_line);
+  hd_data->devtree = free_devtree(hd_data);
+
   hd_data->disks = free_str_list(hd_data->disks);
   hd_data->partitions = free_str_list(hd_data->partitions);
   hd_data->cdroms = free_str_list(hd_data->cdroms);
@@ -1038,28 +1290,21 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   hd_data->smbios = smbios_free(hd_data->smbios);
 
   hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
+  hd_data->udevinfo_hash = free_mem(hd_data->udevinfo_hash);
   hd_data->sysfsdrv = hd_free_sysfsdrv(hd_data->sysfsdrv);
+  hd_data->sysfsdrv_id = 0;
 
-  hd_data->only = free_str_list(hd_data->only);
   hd_data->scanner_db = free_str_list(hd_data->scanner_db);
 
   for(u = 0; u < sizeof hd_data->edd / sizeof *hd_data->edd; u++) {
     hd_data->edd[u].sysfs_id = free_mem(hd_data->edd[u].sysfs_id);
   }
+  memset(hd_data->edd, 0, sizeof hd_data->edd);
 
   hd_data->hal = hd_free_hal_devices(hd_data->hal);
 
-  hd_data->lsscsi = free_str_list(hd_data->lsscsi);
-
-  hd_data->probe_val = hd_free_hal_properties(hd_data->probe_val);
-
-  hd_data->last_idx = 0;
-
-  hd_shm_done(hd_data);
-
-  memset(hd_data, 0, sizeof *hd_data);
-
-  return NULL;
+  hd_free_scsi_transport(hd_data);
+  hd_free_acpi_tables(hd_data);
 }
 
 
@@ -1317,7 +1562,7 @@ hd_detail_t *free_hd_detail(hd_detail_t *d)
         free_mem(c->vend_name);
         free_mem(c->model_name);
         free_mem(c->platform);
-        free_str_list(c->features);
+        if(!c->features_shared) free_str_list(c->features);
         free_mem(c);
       }
       break;
@@ -1400,6 +1645,7 @@ hd_t *free_hd_entry(hd_t *hd)
   free_mem(hd->compat_device.name);
   free_mem(hd->model);
   free_mem(hd->sysfs_id);
+  free_mem(hd->sysfs_path);
   free_mem(hd->sysfs_bus_id);
   free_mem(hd->sysfs_device_link);
   free_str_list(hd->unix_dev_names);
@@ -1470,6 +1716,22 @@ misc_t *free_misc(misc_t *m)
   return NULL;
 }
 
+hd_cpu_flags_t *free_cpu_flags(hd_cpu_flags_t *flags)
+{
+  hd_cpu_flags_t *next;
+
+  for(; flags; flags = next) {
+    next = flags->next;
+
+    free_mem(flags->str);
+    free_str_list(flags->features);
+
+    free_mem(flags);
+  }
+
+  return NULL;
+}
+
 scsi_t *free_scsi(scsi_t *scsi, int free_all)
 {
   scsi_t *next;
@@ -1533,12 +1795,26 @@ void free_old_hd_entries(hd_data_t *hd_data)
 }
 
 
+/*
+ * Free entries replaced by a rescan.
+ *
+ * Lists returned by hd_list() & co. may still point to them; so free
+ * those first.
+ */
+void hd_free_old_entries(hd_data_t *hd_data)
+{
+  free_old_hd_entries(hd_data);
+}
+
+
 void *new_mem(size_t size)
 {
   void *p;
 
   if(size == 0) return NULL;
 
+  if(arena_data && size <= ARENA_MAX_OBJ) return arena_alloc(arena_data, size);
+
   p = calloc(size, 1);
 
   if(p) return p;
@@ -1549,9 +1825,23 @@ void *new_mem(size_t size)
   return 0;
 }
 
+/*
+ * Note: arena memory is moved to the heap.
+ */
 void *resize_mem(void *p, size_t n)
 {
-  p = realloc(p, n);
+  void *q;
+  size_t len;
+
+  if(p && arena_chunk(p)) {
+    len = ((size_t *) p)[-1];
+    q = malloc(n);
+    if(q && n) memcpy(q, p, len < n ? len : n);
+    p = q;
+  }
+  else {
+    p = realloc(p, n);
+  }
 
   if(!p) {
     fprintf(stderr, "memory oops 7\n");
@@ -1563,12 +1853,7 @@ void *resize_mem(void *p, size_t n)
 
 void *add_mem(void *p, size_t elem_size, size_t n)
 {
-  p = realloc(p, (n + 1) * elem_size);
-
-  if(!p) {
-    fprintf(stderr, "memory oops 7\n");
-    exit(17);
-  }
+  p = resize_mem(p, (n + 1) * elem_size);
 
   memset(p + n * elem_size, 0, elem_size);
 
@@ -1578,9 +1863,14 @@ void *add_mem(void *p, size_t elem_size, size_t n)
 char *new_str(const char *s)
 {
   char *t;
+  size_t len;
 
   if(!s) return NULL;
 
+  if(arena_data && (len = strlen(s) + 1) <= ARENA_MAX_OBJ) {
+    return memcpy(arena_alloc(arena_data, len), s, len);
+  }
+
   t = strdup(s);
 
   if(t) return t;
@@ -1594,11 +1884,145 @@ char *new_str(const char *s)
 
 void *free_mem(void *p)
 {
-  if(p) free(p);
+  if(p && !arena_chunk(p)) free(p);
 
   return NULL;
 }
 
+
+/*
+ * Get zeroed memory from hd_data's arena.
+ *
+ * Each block is preceded by its size (cf. resize_mem()).
+ */
+void *arena_alloc(hd_data_t *hd_data, size_t size)
+{
+  hd_arena_t *chunk = hd_data->arena;
+  size_t pos;
+  unsigned u;
+
+  pos = chunk ? (chunk->used + sizeof size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1) : 0;
+
+  if(!chunk || pos + size > sizeof chunk->data) {
+    if(!(chunk = calloc(1, sizeof *chunk))) {
+      fprintf(stderr, "memory oops 1\n");
+      exit(11);
+    }
+
+    pthread_mutex_lock(&arena_lock);
+
+    if(arena_list_len == ARENA_CHUNKS_MAX) {
+      pthread_mutex_unlock(&arena_lock);
+      free(chunk);
+
+      /* plain heap memory; free_mem() will free it */
+      if(!(chunk = calloc(size, 1))) {
+        fprintf(stderr, "memory oops 1\n");
+        exit(11);
+      }
+
+      return chunk;
+    }
+
+    for(u = arena_list_len; u && arena_list[u - 1] > chunk; u--);
+
+    __atomic_store_n(&arena_seq, arena_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memmove(arena_list + u + 1, arena_list + u, (arena_list_len - u) * sizeof *arena_list);
+    __atomic_store_n(&arena_list[u], chunk, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena_list_len, arena_list_len + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena_seq, arena_seq + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&arena_lock);
+
+    chunk->hd_data = hd_data;
+    chunk->next = hd_data->arena;
+    hd_data->arena = chunk;
+
+    pos = ARENA_ALIGN;
+  }
+
+  memcpy(chunk->data + pos - sizeof size, &size, sizeof size);
+  chunk->used = pos + size;
+
+  return chunk->data + pos;
+}
+
+
+/*
+ * Arena chunk holding p (or NULL).
+ *
+ * Lock-free binary search in arena_list. Only addresses are compared, so
+ * it doesn't matter if a chunk is released meanwhile.
+ */
+hd_arena_t *arena_chunk(void *p)
+{
+  hd_arena_t *chunk;
+  unsigned seq, lo, hi, mid;
+
+  if(!__atomic_load_n(&arena_list_len, __ATOMIC_RELAXED)) return NULL;
+
+  do {
+    seq = __atomic_load_n(&arena_seq, __ATOMIC_ACQUIRE);
+
+    chunk = NULL;
+    lo = 0;
+    hi = (seq & 1) ? 0 : __atomic_load_n(&arena_list_len, __ATOMIC_RELAXED);
+
+    while(lo < hi) {
+      mid = (lo + hi) / 2;
+      chunk = __atomic_load_n(&arena_list[mid], __ATOMIC_RELAXED);
+      if((unsigned char *) p < chunk->data) {
+        hi = mid;
+      }
+      else if((unsigned char *) p >= chunk->data + sizeof chunk->data) {
+        lo = mid + 1;
+      }
+      else {
+        break;
+      }
+      chunk = NULL;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while((seq & 1) || seq != __atomic_load_n(&arena_seq, __ATOMIC_RELAXED));
+
+  return chunk;
+}
+
+
+/*
+ * Release hd_data's arena.
+ */
+void arena_free(hd_data_t *hd_data)
+{
+  hd_arena_t *chunk, *next;
+  unsigned u, v;
+
+  if(!hd_data->arena) return;
+
+  pthread_mutex_lock(&arena_lock);
+
+  __atomic_store_n(&arena_seq, arena_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for(u = v = 0; u < arena_list_len; u++) {
+    if(arena_list[u]->hd_data != hd_data) __atomic_store_n(&arena_list[v++], arena_list[u], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&arena_list_len, v, __ATOMIC_RELAXED);
+  __atomic_store_n(&arena_seq, arena_seq + 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&arena_lock);
+
+  for(chunk = hd_data->arena; chunk; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  hd_data->arena = NULL;
+
+  if(arena_data == hd_data) arena_data = NULL;
+}
+
 void join_res_io(hd_res_t **res1, hd_res_t *res2)
 {
   hd_res_t *res;
@@ -1779,9 +2203,8 @@ hd_t *add_hd_entry(hd_data_t *hd_data, unsigned line, unsigned count)
 {
   hd_t *hd;
 
-  hd = add_hd_entry2(&hd_data->hd, new_mem(sizeof *hd));
+  hd = append_hd_entry(hd_data, new_mem(sizeof *hd));
 
-  hd->idx = ++(hd_data->last_idx);
   hd->module = hd_data->module;
   hd->line = line;
   hd->count = count;
@@ -1790,12 +2213,38 @@ hd_t *add_hd_entry(hd_data_t *hd_data, unsigned line, unsigned count)
 }
 
 
-hd_t *add_hd_entry2(hd_t **hd, hd_t *new_hd)
+/*
+ * Append 'hd' to hd_data->hd and give it a new idx.
+ */
+hd_t *append_hd_entry(hd_data_t *hd_data, hd_t *hd)
 {
-  while(*hd) hd = &(*hd)->next;
+  hd_index_t *idx = &hd_data->hd_index;
+  unsigned u;
 
-  return *hd = new_hd;
-}
+  add_hd_entry2(&hd_data->hd, hd);
+
+  hd->idx = ++(hd_data->last_idx);
+
+  if(hd->idx >= idx->by_idx_len) {
+    u = idx->by_idx_len;
+    idx->by_idx_len = hd->idx + 0x100;
+    idx->by_idx = resize_mem(idx->by_idx, idx->by_idx_len * sizeof *idx->by_idx);
+    memset(idx->by_idx + u, 0, (idx->by_idx_len - u) * sizeof *idx->by_idx);
+  }
+  idx->by_idx[hd->idx] = hd;
+
+  hd_index_drop(hd_data);
+
+  return hd;
+}
+
+
+hd_t *add_hd_entry2(hd_t **hd, hd_t *new_hd)
+{
+  while(*hd) hd = &(*hd)->next;
+
+  return *hd = new_hd;
+}
 
 
 void hd_scan(hd_data_t *hd_data)
@@ -1806,6 +2255,10 @@ void hd_scan(hd_data_t *hd_data)
   uint64_t irqs;
   str_list_t *sl, *sl0;
   pr_flags_t *pf;
+  scan_cache_id_t cache_id;
+  int use_cache;
+  unsigned last_idx;
+  hd_data_t *arena_save = arena_data;
 
   if(!hd_data->flags.internal) {
   /* log debug & probe flags */
@@ -1818,9 +2271,14 @@ void hd_scan(hd_data_t *hd_data)
 
   get_kernel_version(hd_data);
 
+  /* don't reuse sysfs directories from a previous scan */
+  sysfs_shim_done();
+  hd_sysfs_tree_done(hd_data);
+
   /* needed only on 1st call */
   if(hd_data->last_idx == 0) {
     get_probe_env(hd_data);
+    hd_set_probe_feature(hd_data, pr_modules_cache);
   }
 
   /* init driver info database */
@@ -1830,6 +2288,8 @@ void hd_scan(hd_data_t *hd_data)
   if(hd_data->last_idx == 0) {
     hd_set_probe_feature(hd_data, pr_fork);
     if(!hd_probe_feature(hd_data, pr_fork)) hd_data->flags.nofork = 1;
+    if(hd_probe_feature(hd_data, pr_fork_threads)) hd_data->flags.threads = 1;
+    if(hd_probe_feature(hd_data, pr_arena)) hd_data->flags.arena = 1;
 //    hd_set_probe_feature(hd_data, pr_sysfs);
     if(!hd_probe_feature(hd_data, pr_sysfs)) hd_data->flags.nosysfs = 1;
     hd_set_probe_feature(hd_data, pr_cpuemu);
@@ -1885,12 +2345,35 @@ void hd_scan(hd_data_t *hd_data)
     ADD2LOG(")\n");
   }
 
+  if(hd_data->flags.arena) arena_data = hd_data;
+
+  if((use_cache = hd_scan_cache_init(hd_data, &cache_id))) {
+    if((hd = hd_scan_cache_read(hd_data, &cache_id, &last_idx))) {
+      /* keep the original idx values */
+      for(; hd; hd = hd2) {
+        hd2 = hd->next;
+        hd->next = NULL;
+        hd_data->last_idx = hd->idx - 1;
+        append_hd_entry(hd_data, hd);
+      }
+      hd_data->last_idx = last_idx;
+
+      update_irq_usage(hd_data);
+
+      sysfs_shim_done();
+      arena_data = arena_save;
+
+      return;
+    }
+  }
+
   /* get shm segment, if we didn't do it already */
   hd_shm_init(hd_data);
 
   if(!hd_data->shm.ok && !hd_data->flags.nofork) {
-    hd_data->flags.nofork = 1;
-    ADD2LOG("shm: failed to get shm segment; will not fork\n");
+    hd_data->flags.threads = 1;
+    ADD2LOG("shm: failed to get shm segment; will use threads\n");
+    hd_shm_init(hd_data);
   }
 
   if(hd_data->only) {
@@ -1919,6 +2402,8 @@ void hd_scan(hd_data_t *hd_data)
   for(hd = hd_data->hd; hd; hd = hd->next) hd_add_id(hd_data, hd);
 
   /* assign parent & child ids */
+  hd_index_build(hd_data);
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
     hd->child_ids = free_str_list(hd->child_ids);
     if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
@@ -1939,6 +2424,8 @@ void hd_scan(hd_data_t *hd_data)
     }
   }
 
+  hd_index_drop(hd_data);
+
   /* assign a hw_class & build a useful model string */
   for(hd = hd_data->hd; hd; hd = hd->next) {
     assign_hw_class(hd_data, hd);
@@ -1992,126 +2479,204 @@ void hd_scan(hd_data_t *hd_data)
     }
     ADD2LOG("\n");
   }
+
+  if(use_cache) hd_scan_cache_write(hd_data, &cache_id);
+
+  sysfs_shim_done();
+  arena_data = arena_save;
 }
 
 
-void hd_scan_with_hal(hd_data_t *hd_data)
+/*
+ * Rescan sysfs subtree 'path' (e.g. DEVPATH of a uevent; with or without
+ * leading "/sys").
+ *
+ * Only pci, usb and block devices below 'path' are probed again; entries
+ * outside are kept as they are, except for those whose sysfs device has
+ * gone. Parent and child links are updated for the affected entries only.
+ *
+ * Note that the hd_scan_int() post-processing still runs over all entries.
+ *
+ * Returns a copy of the new entries, cf. hd_list().
+ */
+hd_t *hd_rescan_sysfs_path(hd_data_t *hd_data, char *path)
 {
-  hd_t *hd;
+  hd_t *hd, *hd2, *hd_list = NULL;
+  unsigned char probe_save[sizeof hd_data->probe];
+  unsigned u, last_idx, *parents = NULL, parents_len = 0;
+  hd_data_t *arena_save = arena_data;
 
-  hd_data->hal = hd_free_hal_devices(hd_data->hal);
+  if(!path || !*path) return NULL;
 
-  hd_scan_hal(hd_data);
+  get_kernel_version(hd_data);
+  sysfs_shim_done();
+  hd_sysfs_tree_done(hd_data);
+  hddb_init(hd_data);
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(!hd->persistent_prop) hd->persistent_prop = hd_read_properties(hd->udi);
-  }
+  free_mem(hd_data->scan_scope);
+  hd_data->scan_scope = hd_sysfs_real_id(path);
+  last_idx = hd_data->last_idx;
 
-}
+  if(hd_data->flags.arena) arena_data = hd_data;
 
+  ADD2LOG("rescan: %s\n", hd_data->scan_scope);
 
-void hd_scan_no_hal(hd_data_t *hd_data)
-{
-  hd_t *hd;
+  /* parents of entries that might go away */
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->attached_to && entry_in_scope(hd_data, hd)) {
+      add_parent_idx(&parents, &parents_len, hd->attached_to);
+    }
+  }
 
-  /*
-   * for various reasons, do it befor scan_misc()
-   */
-  hd_scan_floppy(hd_data);
+  memcpy(probe_save, hd_data->probe, sizeof probe_save);
+  hd_clear_probe_feature(hd_data, pr_all);
+  hd_set_probe_feature_hw(hd_data, hw_pci);
+  hd_set_probe_feature_hw(hd_data, hw_usb);
+  hd_set_probe_feature_hw(hd_data, hw_block);
 
   /*
-   * to be able to read the right parport io,
-   * we have to do this before scan_misc()
+   * remove_hd_entries() only drops entries in scope; throw away new entries
+   * outside, too (from probing code that doesn't check the scope itself)
    */
-#if defined(__i386__) || defined (__x86_64__) || defined (__ia64__)
-  hd_scan_bios(hd_data);
-#endif
-  
-  /* before hd_scan_misc(): we need some ppc info later */
-  hd_scan_sys(hd_data);
+  hd_scan_sysfs_pci(hd_data);
+  rescan_drop_out_of_scope(hd_data, last_idx);
 
-  /* get basic system info */
-  hd_scan_misc(hd_data);
+  hd_scan_sysfs_usb(hd_data);
+  rescan_drop_out_of_scope(hd_data, last_idx);
 
-  /* hd_scan_cpu() after hd_scan_misc(): klog needed */
-  hd_scan_cpu(hd_data);
-  hd_scan_memory(hd_data);
+  hd_scan_sysfs_block(hd_data);
+  rescan_drop_out_of_scope(hd_data, last_idx);
 
-  hd_scan_sysfs_pci(hd_data);
+  hd_scan_int(hd_data);
+  rescan_drop_out_of_scope(hd_data, last_idx);
 
-  /* do it _after_ hd_scan_sysfs_pci() */
-#if defined(__PPC__)
-  hd_scan_prom(hd_data);
-#endif
+  memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
 
-#if defined(__s390__) || defined(__s390x__)
-  hd_scan_s390disks(hd_data);
-  hd_scan_s390(hd_data);
-#endif
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->idx > last_idx) hd_add_id(hd_data, hd);
+  }
 
-  /* after hd_scan_prom() and hd_scan_bios() */
-  hd_scan_monitor(hd_data);
+  hd_index_build(hd_data);
 
-#ifndef LIBHD_TINY
-#if defined(__i386__) || defined(__alpha__)
-  hd_scan_isapnp(hd_data);
-#endif
-#endif
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->idx <= last_idx) {
+      /* parent was replaced by a new entry */
+      if(
+        hd->attached_to &&
+        !hd_get_device_by_idx(hd_data, hd->attached_to) &&
+        (hd2 = hd_get_device_by_id(hd_data, hd->parent_id))
+      ) {
+        hd->attached_to = hd2->idx;
+        add_parent_idx(&parents, &parents_len, hd2->idx);
+      }
+      continue;
+    }
 
-#ifndef LIBHD_TINY
-#if defined(__i386__)
-  hd_scan_isa(hd_data);
-#endif
-#endif
+    if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
+      free_mem(hd->parent_id);
+      hd->parent_id = new_str(hd2->unique_id);
+    }
+    else if((hd2 = hd_get_device_by_id(hd_data, hd->parent_id))) {
+      hd->attached_to = hd2->idx;
+    }
+    else {
+      hd->attached_to = 0;
+    }
 
-  /* after pci & isa */
-  hd_scan_pcmcia(hd_data);
+    if(hd->attached_to) add_parent_idx(&parents, &parents_len, hd->attached_to);
 
-  /* after pci */
-  hd_scan_serial(hd_data);
+    assign_hw_class(hd_data, hd);
+    create_model_name(hd_data, hd);
+  }
 
-  /* merge basic system info & the easy stuff */
-  hd_scan_misc2(hd_data);
+  /* new entries may be parents of other new entries */
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->idx > last_idx) add_parent_idx(&parents, &parents_len, hd->idx);
+  }
 
-#ifndef LIBHD_TINY
-  if(!hd_data->flags.no_parport) {
-    hd_scan_parallel(hd_data);	/* after hd_scan_misc*() */
+  for(u = 0; u < parents_len; u++) {
+    if(!(hd2 = hd_get_device_by_idx(hd_data, parents[u]))) continue;
+    hd2->child_ids = free_str_list(hd2->child_ids);
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(hd->attached_to == hd2->idx) add_str_list(&hd2->child_ids, hd->unique_id);
+    }
   }
-#endif
 
-  hd_scan_sysfs_block(hd_data);
-  hd_scan_sysfs_scsi(hd_data);
-  hd_scan_sysfs_usb(hd_data);
-#if defined(__i386__) || defined(__x86_64__)
-  hd_scan_sysfs_edd(hd_data);
-#endif
+  hd_index_drop(hd_data);
 
 #ifndef LIBHD_TINY
-#if !defined(__sparc__)
-  hd_scan_braille(hd_data);
-#endif
-  hd_scan_modem(hd_data);	/* do it before hd_scan_mouse() */
-  hd_scan_mouse(hd_data);
+  hd_scan_manual2(hd_data);
 #endif
-  hd_scan_sbus(hd_data);
 
-  hd_scan_input(hd_data);
+  sysfs_shim_done();
 
-#if !defined(__s390__) && !defined(__s390x__)
-  hd_scan_kbd(hd_data);
-#endif
+  /* copies go to the heap, cf. hd_list() */
+  arena_data = arena_save;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    hd->tag.fixed = 1;
+    if(hd->idx > last_idx) {
+      hd2 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd_copy(hd2, hd);
+    }
+  }
 
-  /* must be after hd_scan_monitor() */
-  hd_scan_fb(hd_data);
+  update_irq_usage(hd_data);
 
-  /* keep these at the end of the list */
-  hd_scan_net(hd_data);
+  hd_data->module = mod_none;
+  hd_data->scan_scope = free_mem(hd_data->scan_scope);
+  free_mem(parents);
 
-  hd_scan_pppoe(hd_data);
+  return hd_list;
+}
 
-#ifndef LIBHD_TINY
-  hd_scan_wlan(hd_data);
-#endif
+
+/*
+ * Remove entries added after 'last_idx' that are not in the rescan scope.
+ */
+void rescan_drop_out_of_scope(hd_data_t *hd_data, unsigned last_idx)
+{
+  hd_t *hd;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->idx > last_idx && !entry_in_scope(hd_data, hd)) hd->tag.remove = 1;
+  }
+
+  remove_tagged_hd_entries(hd_data);
+}
+
+
+void add_parent_idx(unsigned **list, unsigned *len, unsigned idx)
+{
+  unsigned u;
+
+  for(u = 0; u < *len; u++) if((*list)[u] == idx) return;
+
+  *list = resize_mem(*list, (*len + 1) * sizeof **list);
+  (*list)[(*len)++] = idx;
+}
+
+
+void hd_scan_with_hal(hd_data_t *hd_data)
+{
+  hd_t *hd;
+
+  hd_data->hal = hd_free_hal_devices(hd_data->hal);
+
+  hd_scan_hal(hd_data);
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(!hd->persistent_prop) hd->persistent_prop = hd_read_properties(hd->udi);
+  }
+
+}
+
+
+void hd_scan_no_hal(hd_data_t *hd_data)
+{
+  hd_t *hd;
+
+  hd_scan_steps(hd_data);
 
   for(hd = hd_data->hd; hd; hd = hd->next) hd_add_id(hd_data, hd);
 
@@ -2134,103 +2699,325 @@ void hd_scan_no_hal(hd_data_t *hd_data)
 
 
 /*
- * Note: due to byte order problems decoding the id is really a mess...
- * And, we use upper case for hex numbers!
+ * Run scan_steps[].
+ *
+ * Normally one after the other. With probe feature 'threads', adjacent
+ * isolated steps that don't depend on each other form a wave that is run
+ * concurrently by hd_scan_wave().
  */
-char *isa_id2str(unsigned id)
+void hd_scan_steps(hd_data_t *hd_data)
 {
-  char *s = new_mem(8);
-  unsigned u = ((id & 0xff) << 8) + ((id >> 8) & 0xff);
-  unsigned v = ((id >> 8) & 0xff00) + ((id >> 24) & 0xff);
-
-  s[0] = ((u >> 10) & 0x1f) + 'A' - 1;
-  s[1] = ((u >>  5) & 0x1f) + 'A' - 1;
-  s[2] = ( u        & 0x1f) + 'A' - 1;
-
-  sprintf(s + 3, "%04X", v);
+  scan_step_t *step;
+  unsigned u, v, n, len, mask, present, done;
+  int parallel;
 
-  return s;
-}
+  len = sizeof scan_steps / sizeof *scan_steps;
+  parallel = hd_probe_feature(hd_data, pr_threads);
 
-char *eisa_vendor_str(unsigned v)
-{
-  static char s[4];
+  for(present = 0, u = 0; u < len; u++) present |= 1u << scan_steps[u].id;
 
-  s[0] = ((v >> 10) & 0x1f) + 'A' - 1;
-  s[1] = ((v >>  5) & 0x1f) + 'A' - 1;
-  s[2] = ( v        & 0x1f) + 'A' - 1;
-  s[3] = 0;
+  for(done = 0, u = 0; u < len; u += n) {
+    for(n = 0, mask = 0; parallel && u + n < len; n++) {
+      step = scan_steps + u + n;
+      if(
+        !step->isolated ||
+        (step->after & mask) ||
+        !hd_probe_feature(hd_data, step->feature)
+      ) break;
+      mask |= 1u << step->id;
+    }
+    if(n < 2) n = 1;
+
+    for(v = u; v < u + n; v++) {
+      step = scan_steps + v;
+      if(step->after & present & ~done) {
+        ADD2LOG("scan step %u: unmet dependencies 0x%x\n", step->id, step->after & present & ~done);
+      }
+      done |= 1u << step->id;
+    }
 
-  return s;
+    if(n == 1) {
+      scan_steps[u].scan(hd_data);
+    }
+    else {
+      hd_scan_wave(hd_data, scan_steps + u, n);
+    }
+  }
 }
 
 
-/*
- *  Must _not_ check that s is exactly 3 chars.
- */
-unsigned name2eisa_id(char *s)
+void *scan_step_thread(void *arg)
 {
-  int i;
-  unsigned u = 0;
+  hd_data_t *sub = arg;
 
-  for(i = 0; i < 3; i++) {
-    u <<= 5;
-    if(s[i] < 'A' - 1 || s[i] > 'A' - 1 + 0x1f) return 0;
-    u += s[i] - 'A' + 1;
-  }
+  pthread_cleanup_push(sysfs_shim_cleanup, NULL);
 
-  return MAKE_ID(TAG_EISA, u);
+  sub->scan_step->scan(sub);
+
+  pthread_cleanup_pop(1);
+
+  return NULL;
 }
 
 
 /*
- * Create a 'canonical' version, i.e. no spaces at start and end.
+ * Run isolated steps concurrently.
  *
- * Note: removes chars >= 0x80 as well (due to (char *))! This
- * is currently considered a feature.
+ * Each step gets a private copy of hd_data with an empty device list, its
+ * own log and idx counter. Isolated steps must not look at other entries
+ * and may only write hd_data fields that no other step in the wave touches.
+ * Progress messages are passed on as they come, cf. progress().
+ *
+ * The results are merged in table order, so entries, idx and log come out
+ * as if the steps had run one after the other.
+ *
+ * The sysfs tree is built once before and shared read-only. A step that
+ * drops it (after loading a module) gets its own; then the shared one is
+ * dropped afterwards, too.
  */
-char *canon_str(char *s, int len)
+void hd_scan_wave(hd_data_t *hd_data, scan_step_t *steps, unsigned len)
 {
-  char *m2, *m1, *m0;
-  int i;
+  hd_data_t **sub;
+  pthread_t *thread;
+  hd_sysfs_tree_t *tree;
+  int *started, stale = 0;
+  unsigned u;
 
-  if(len < 0) len = 0;		/* just to be safe */
+  tree = hd_sysfs_tree(hd_data);
+  tree->shared = 1;
 
-  m0 = new_mem(len + 1);
+  sub = new_mem(len * sizeof *sub);
+  thread = new_mem(len * sizeof *thread);
+  started = new_mem(len * sizeof *started);
 
-  for(m1 = m0, i = 0; i < len; i++) {
-    if(m1 == m0 && s[i] <= ' ') continue;
-    *m1++ = s[i];
+  for(u = 0; u < len; u++) {
+    /* steps start with removing their old entries; do it here */
+    hd_data->module = steps[u].mod;
+    remove_hd_entries(hd_data);
+
+    sub[u] = new_mem(sizeof **sub);
+    *sub[u] = *hd_data;
+    sub[u]->hd = NULL;
+    sub[u]->old_hd = NULL;
+    sub[u]->last_idx = 0;
+    memset(&sub[u]->hd_index, 0, sizeof sub[u]->hd_index);
+    sub[u]->log = NULL;
+    sub[u]->log_size = sub[u]->log_max = 0;
+    sub[u]->scan_step = steps + u;
+
+    started[u] = !pthread_create(thread + u, NULL, scan_step_thread, sub[u]);
   }
-  *m1 = 0;
-  while(m1 > m0 && m1[-1] <= ' ') {
-    *--m1 = 0;
+
+  for(u = 0; u < len; u++) {
+    if(started[u]) {
+      pthread_join(thread[u], NULL);
+    }
+    else {
+      steps[u].scan(sub[u]);
+    }
+
+    hd_scan_merge(hd_data, sub[u], steps + u);
+
+    if(sub[u]->sysfs_tree != tree) {
+      hd_sysfs_tree_done(sub[u]);
+      stale = 1;
+    }
+
+    free_mem(sub[u]);
   }
 
-  m2 = new_str(m0);
-  free_mem(m0);
+  tree->shared = 0;
+  if(stale) hd_sysfs_tree_done(hd_data);
 
-  return m2;
+  free_mem(started);
+  free_mem(thread);
+  free_mem(sub);
 }
 
 
 /*
- * Convert a n-digit hex number to its numerical value.
+ * Add results of an isolated step to hd_data.
  */
-int hex(char *s, int n)
+void hd_scan_merge(hd_data_t *hd_data, hd_data_t *sub, scan_step_t *step)
 {
-  int i = 0, j;
+  hd_t *hd, *hd_first, *next;
+  unsigned *idx;
 
-  while(n--) {
-    if(sscanf(s++, "%1x", &j) != 1) return -1;
-    i = (i << 4) + j;
+  ADD2LOG("scan step %u: %s (thread)\n", step->id, mod_name_by_idx(step->mod));
+  hd_log(hd_data, sub->log, sub->log_size);
+  free_mem(sub->log);
+
+  /* renumber new entries */
+  idx = new_mem((sub->last_idx + 1) * sizeof *idx);
+
+  hd_data->module = step->mod;
+  for(hd_first = NULL, hd = sub->hd; hd; hd = next) {
+    next = hd->next;
+    hd->next = NULL;
+    if(hd->idx <= sub->last_idx) idx[hd->idx] = hd_data->last_idx + 1;
+    append_hd_entry(hd_data, hd);
+    if(!hd_first) hd_first = hd;
   }
 
-  return i;
-}
+  for(hd = hd_first; hd; hd = hd->next) {
+    if(hd->attached_to) hd->attached_to = hd->attached_to <= sub->last_idx ? idx[hd->attached_to] : 0;
+  }
 
+  free_mem(idx);
 
-/* simple 32 bit fixed point numbers with n decimals */
+  add_hd_entry2(&hd_data->old_hd, sub->old_hd);
+
+  sub->hd_index.by_idx = free_mem(sub->hd_index.by_idx);
+
+  if(sub->klog != hd_data->klog) {
+    if(hd_data->klog) {
+      free_str_list(sub->klog);
+    }
+    else {
+      hd_data->klog = sub->klog;
+    }
+  }
+
+  if(sub->klog_raw != hd_data->klog_raw) {
+    if(hd_data->klog_raw) {
+      free_str_list(sub->klog_raw);
+    }
+    else {
+      hd_data->klog_raw = sub->klog_raw;
+    }
+  }
+
+  if(step->merge) step->merge(hd_data, sub);
+}
+
+
+#ifndef LIBHD_TINY
+void scan_parport(hd_data_t *hd_data)
+{
+  if(!hd_data->flags.no_parport) hd_scan_parallel(hd_data);
+}
+#endif
+
+
+void merge_cpu(hd_data_t *hd_data, hd_data_t *sub)
+{
+  hd_data->cpu = sub->cpu;
+  hd_data->cpu_flags = sub->cpu_flags;
+  hd_data->boot = sub->boot;
+  hd_data->color_code = sub->color_code;
+}
+
+
+/*
+ * Note: the sysfs driver list is built on demand; pci is the only step in
+ * its wave that uses it. The sysfs tree is shared, cf. hd_scan_wave().
+ */
+void merge_pci(hd_data_t *hd_data, hd_data_t *sub)
+{
+  hd_data->pci = sub->pci;
+  hd_data->sysfsdrv = sub->sysfsdrv;
+  hd_data->sysfsdrv_id = sub->sysfsdrv_id;
+}
+
+
+/*
+ * Note: due to byte order problems decoding the id is really a mess...
+ * And, we use upper case for hex numbers!
+ */
+char *isa_id2str(unsigned id)
+{
+  char *s = new_mem(8);
+  unsigned u = ((id & 0xff) << 8) + ((id >> 8) & 0xff);
+  unsigned v = ((id >> 8) & 0xff00) + ((id >> 24) & 0xff);
+
+  s[0] = ((u >> 10) & 0x1f) + 'A' - 1;
+  s[1] = ((u >>  5) & 0x1f) + 'A' - 1;
+  s[2] = ( u        & 0x1f) + 'A' - 1;
+
+  sprintf(s + 3, "%04X", v);
+
+  return s;
+}
+
+char *eisa_vendor_str(unsigned v)
+{
+  static char s[4];
+
+  s[0] = ((v >> 10) & 0x1f) + 'A' - 1;
+  s[1] = ((v >>  5) & 0x1f) + 'A' - 1;
+  s[2] = ( v        & 0x1f) + 'A' - 1;
+  s[3] = 0;
+
+  return s;
+}
+
+
+/*
+ *  Must _not_ check that s is exactly 3 chars.
+ */
+unsigned name2eisa_id(char *s)
+{
+  int i;
+  unsigned u = 0;
+
+  for(i = 0; i < 3; i++) {
+    u <<= 5;
+    if(s[i] < 'A' - 1 || s[i] > 'A' - 1 + 0x1f) return 0;
+    u += s[i] - 'A' + 1;
+  }
+
+  return MAKE_ID(TAG_EISA, u);
+}
+
+
+/*
+ * Create a 'canonical' version, i.e. no spaces at start and end.
+ *
+ * Note: removes chars >= 0x80 as well (due to (char *))! This
+ * is currently considered a feature.
+ */
+char *canon_str(char *s, int len)
+{
+  char *m2, *m1, *m0;
+  int i;
+
+  if(len < 0) len = 0;		/* just to be safe */
+
+  m0 = new_mem(len + 1);
+
+  for(m1 = m0, i = 0; i < len; i++) {
+    if(m1 == m0 && s[i] <= ' ') continue;
+    *m1++ = s[i];
+  }
+  *m1 = 0;
+  while(m1 > m0 && m1[-1] <= ' ') {
+    *--m1 = 0;
+  }
+
+  m2 = new_str(m0);
+  free_mem(m0);
+
+  return m2;
+}
+
+
+/*
+ * Convert a n-digit hex number to its numerical value.
+ */
+int hex(char *s, int n)
+{
+  int i = 0, j;
+
+  while(n--) {
+    if(sscanf(s++, "%1x", &j) != 1) return -1;
+    i = (i << 4) + j;
+  }
+
+  return i;
+}
+
+
+/* simple 32 bit fixed point numbers with n decimals */
 int str2float(char *s, int n)
 {
   int i = 0;
@@ -2290,15 +3077,9 @@ char *float2str(int f, int n)
  */
 hd_t *hd_get_device_by_idx(hd_data_t *hd_data, unsigned idx)
 {
-  hd_t *hd;
-
   if(!idx) return NULL;		/* early out: idx is always != 0 */
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->idx == idx) return hd;
-  }
-
-  return NULL;
+  return idx < hd_data->hd_index.by_idx_len ? hd_data->hd_index.by_idx[idx] : NULL;
 }
 
 
@@ -2311,6 +3092,10 @@ hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id)
 
   if(!id) return NULL;
 
+  if(hd_data->hd_index.list) {
+    return hd_index_find(hd_data, &hd_data->hd_index.unique_id, 0, id, NULL);
+  }
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(hd->unique_id && !strcmp(hd->unique_id, id)) return hd;
   }
@@ -2337,13 +3122,29 @@ void hd_log(hd_data_t *hd_data, char *buf, ssize_t len)
 {
   if (!hd_data) return;
   ssize_t new_size;
+  size_t keep;
   char *p;
 
-  if(len <= 0 || !buf) return;
+  if(len <= 0 || !buf || hd_data->log_level >= log_none) return;
+
+  if(hd_data->log_ring) {
+    /* ring buffer mode: make room by dropping old messages */
+    keep = hd_data->log_ring > 1 ? hd_data->log_ring / 2 : 1;
+    if((size_t) len > keep) {
+      log_drop(hd_data, hd_data->log_size);
+      hd_data->log_dropped += len - keep;
+      buf += len - keep;
+      len = keep;
+    }
+    if(hd_data->log_size + len + 1 > hd_data->log_ring) {
+      log_drop(hd_data, hd_data->log_size + len - keep);
+    }
+  }
 
   if(hd_data->log_size + len + 1 > hd_data->log_max) {
     new_size = hd_data->log_max + len + (1 << 20);
     new_size += new_size / 2;
+    if(hd_data->log_ring && (size_t) new_size > hd_data->log_ring + 1) new_size = hd_data->log_ring + 1;
     p = realloc(hd_data->log, new_size);
     if(p) {
       hd_data->log = p;
@@ -2351,7 +3152,7 @@ void hd_log(hd_data_t *hd_data, char *buf, ssize_t len)
     }
   }
 
-  if(hd_data->log) {
+  if(hd_data->log && hd_data->log_size + len + 1 <= hd_data->log_max) {
     memcpy(hd_data->log + hd_data->log_size, buf, len);
     hd_data->log_size += len;
     hd_data->log[hd_data->log_size] = 0;
@@ -2359,12 +3160,63 @@ void hd_log(hd_data_t *hd_data, char *buf, ssize_t len)
 }
 
 
+/*
+ * Drop (at least) the oldest 'len' bytes from the log, up to the next line
+ * start (ring buffer mode).
+ */
+void log_drop(hd_data_t *hd_data, size_t len)
+{
+  char *s;
+
+  if(!hd_data->log) return;
+
+  if(len < hd_data->log_size) {
+    s = memchr(hd_data->log + len, '\n', hd_data->log_size - len);
+    if(s) len = s + 1 - hd_data->log;
+  }
+
+  if(len > hd_data->log_size) len = hd_data->log_size;
+
+  memmove(hd_data->log, hd_data->log + len, hd_data->log_size - len);
+  hd_data->log_size -= len;
+  hd_data->log_dropped += len;
+  hd_data->log[hd_data->log_size] = 0;
+}
+
+
+/*
+ * Note: use ADD2LOG() to avoid even evaluating the arguments if logging
+ * is disabled.
+ */
 void hd_log_printf(hd_data_t *hd_data, char *format, ...)
 {
   ssize_t l;
+  size_t avail;
   char *s = NULL;
   va_list args;
 
+  if(!hd_data || !LOG_ON(log_info)) return;
+
+  /*
+   * format directly into the log buffer if there's room; in ring buffer
+   * mode only within log_ring (the buffer may have grown before it was set)
+   */
+  avail = hd_data->log ? hd_data->log_max : 0;
+  if(hd_data->log_ring && avail > hd_data->log_ring) avail = hd_data->log_ring;
+  avail = avail > hd_data->log_size ? avail - hd_data->log_size : 0;
+  if(avail) {
+    va_start(args, format);
+    l = vsnprintf(hd_data->log + hd_data->log_size, avail, format, args);
+    va_end(args);
+
+    if(l >= 0 && (size_t) l < avail) {
+      hd_data->log_size += l;
+      return;
+    }
+
+    hd_data->log[hd_data->log_size] = 0;
+  }
+
   va_start(args, format);
   l = vasprintf(&s, format, args);
   va_end(args);
@@ -2379,6 +3231,8 @@ void hd_log_hex(hd_data_t *hd_data, int with_ascii, unsigned data_len, unsigned
 {
   char *buf = NULL;
 
+  if(!LOG_ON(log_data)) return;
+
   hexdump(&buf, with_ascii, data_len, data);
 
   if(buf) hd_log(hd_data, buf, strlen(buf));
@@ -2531,6 +3385,14 @@ str_list_t *read_file(char *file_name, unsigned start_line, unsigned lines)
   char buf[0x10000];
   int pipe = 0;
   str_list_t *sl_start = NULL, *sl_end = NULL, *sl;
+  hd_file_t *file;
+
+  if(*file_name != '|' && (file = hd_read_file(file_name, 0))) {
+    sl_start = hd_file_str_list(file, start_line, lines);
+    hd_free_file(file);
+
+    return sl_start;
+  }
 
   if(*file_name == '|') {
     pipe = 1;
@@ -2572,122 +3434,312 @@ str_list_t *read_file(char *file_name, unsigned start_line, unsigned lines)
 
 
 /*
- * Read directory, return a list of entries with file type 'type'.
+ * Read a regular file in one go; return contents and a line index.
+ *
+ * The file is mmap()ed if possible. If split is set, line ends ('\n') are
+ * replaced by 0, turning the lines into C strings.
+ *
+ * Returns NULL for anything but regular files (use read_file() for those).
  */
-str_list_t *read_dir(char *dir_name, int type)
+hd_file_t *hd_read_file(char *file_name, int split)
 {
-  str_list_t *sl_start = NULL, *sl_end = NULL, *sl;
-  DIR *dir;
-  struct dirent *de;
+  hd_file_t *file;
   struct stat sbuf;
-  char *s;
-  int dir_type, link_allowed = 0;
-
-  if(type == 'D') {
-    type = 'd';
-    link_allowed = 1;
-  }
-
-  if(dir_name && (dir = opendir(dir_name))) {
-    while((de = readdir(dir))) {
-      if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
-      dir_type = 0;
-
-      if(type) {
-        s = NULL;
-        str_printf(&s, 0, "%s/%s", dir_name, de->d_name);
+  char *data = NULL, *s, *t, *end;
+  size_t size = 0, max;
+  ssize_t len;
+  unsigned u;
+  int fd, mapped = 0;
 
-        if(!lstat(s, &sbuf)) {
-          if(S_ISDIR(sbuf.st_mode)) {
-            dir_type = 'd';
-          }
-          else if(S_ISREG(sbuf.st_mode)) {
-            dir_type = 'r';
-          }
-          else if(S_ISLNK(sbuf.st_mode)) {
-            dir_type = 'l';
-          }
-        }
+  if(!file_name || (fd = open(file_name, O_RDONLY | O_CLOEXEC)) < 0) return NULL;
 
-        s = free_mem(s);
-      }
+  if(fstat(fd, &sbuf) || !S_ISREG(sbuf.st_mode)) {
+    close(fd);
+    return NULL;
+  }
 
-      if(dir_type == type || (link_allowed && dir_type == 'l')) {
-        sl = new_mem(sizeof *sl);
-        sl->str = new_str(de->d_name);
-        if(sl_start)
-          sl_end->next = sl;
-        else
-          sl_start = sl;
-        sl_end = sl;
-      }
+  /*
+   * Only if there's room for the final 0 in the last page; proc & sysfs
+   * files can't be mapped anyway.
+   */
+  if(sbuf.st_size > 0 && sbuf.st_size % getpagesize()) {
+    data = mmap(NULL, sbuf.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+      data = NULL;
+    }
+    else {
+      mapped = 1;
+      size = sbuf.st_size;
     }
-    closedir(dir);
   }
 
-  return sl_start;
-}
-
+  if(!mapped) {
+    /* size of proc & sysfs files is unreliable */
+    max = sbuf.st_size > 0 ? sbuf.st_size + 1 : 0x1000;
+    data = new_mem(max);
+    while((len = read(fd, data + size, max - size - 1)) > 0) {
+      size += len;
+      if(size + 1 == max) data = resize_mem(data, max *= 2);
+    }
+    data[size] = 0;
+  }
 
-char *hd_read_sysfs_link(char *base_dir, char *link_name)
-{
-  char *s = NULL;
-  static char *buf = NULL;
+  close(fd);
 
-  if(!base_dir || !link_name) return NULL;
+  end = data + size;
 
-  str_printf(&s, 0, "%s/%s", base_dir, link_name);
+  for(u = 0, s = data; s < end && (s = memchr(s, '\n', end - s)); s++) u++;
+  if(size && end[-1] != '\n') u++;
 
-  free_mem(buf);
-  buf = realpath(s, NULL);
+  file = new_mem(sizeof *file + u * sizeof *file->line);
+  file->data = data;
+  file->size = size;
+  file->mapped = mapped;
+  file->len = u;
 
-  free_mem(s);
+  for(u = 0, s = data; s < end; u++, s = t + 1) {
+    if(!(t = memchr(s, '\n', end - s))) t = end - 1;
+    file->line[u].ofs = s - data;
+    file->line[u].len = t - s + 1;
+    if(split && *t == '\n') *t = 0;
+  }
 
-  return buf;
+  return file;
 }
 
 
 /*
- * Log the hardware detection progress.
+ * Convert (part of) hd_read_file() result to a linked list of lines.
+ *
+ * start_line is zero-based; lines == 0 -> all lines
  */
-void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg)
+str_list_t *hd_file_str_list(hd_file_t *file, unsigned start_line, unsigned lines)
 {
-  if (!hd_data) return;
+  str_list_t *sl_start = NULL, **sl_next = &sl_start;
+  unsigned u;
 
-  char buf1[32], buf2[32], buf3[128], *fn;
+  for(u = start_line; file && u < file->len; u++) {
+    *sl_next = new_mem(sizeof **sl_next);
+    (*sl_next)->str = new_mem(file->line[u].len + 1);
+    memcpy((*sl_next)->str, file->data + file->line[u].ofs, file->line[u].len);
+    sl_next = &(*sl_next)->next;
 
-  if(hd_data->shm.ok && hd_data->flags.forked) {
-    ((hd_data_t *) (hd_data->shm.data))->shm.updated++;
+    if(lines == 1) break;
+    lines--;
   }
 
-  if(!msg) msg = "";
+  return sl_start;
+}
 
-  sprintf(buf1, "%u", hd_data->module);
-  sprintf(buf2, ".%u", count);
-  fn = mod_name_by_idx(hd_data->module);
 
-  sprintf(buf3, "%s.%u%s", *fn ? fn : buf1, pos, count ? buf2 : "");
+hd_file_t *hd_free_file(hd_file_t *file)
+{
+  if(!file) return NULL;
 
-  if((hd_data->debug & HD_DEB_PROGRESS))
-    ADD2LOG(">> %s: %s\n", buf3, msg);
+  if(file->mapped) {
+    munmap(file->data, file->size + 1);
+  }
+  else {
+    free_mem(file->data);
+  }
 
-  if(hd_data->progress) hd_data->progress(buf3, msg);
+  return free_mem(file);
 }
 
 
-
 /*
- * Returns a probe feature suitable for hd_*probe_feature().
- * If name is not a valid probe feature, 0 is returned.
- *
+ * Read directory, return a list of entries with file type 'type'.
  */
-enum probe_feature hd_probe_feature_by_name(char *name)
+str_list_t *read_dir(char *dir_name, int type)
 {
-  pr_flags_t *flags;
+  str_list_t *sl_start = NULL, **sl_next = &sl_start;
+  hd_dir_t *dir;
+  unsigned u;
 
-  flags = pr_flags_by_name(name);
+  dir = hd_read_dir(dir_name, type);
 
-  return flags ? flags->val : 0;
+  for(u = 0; dir && u < dir->len; u++) {
+    *sl_next = new_mem(sizeof **sl_next);
+    (*sl_next)->str = new_str(dir->entry[u].name);
+    sl_next = &(*sl_next)->next;
+  }
+
+  free_mem(dir);
+
+  return sl_start;
+}
+
+
+/*
+ * Read directory; entries are in readdir() order.
+ *
+ * type: 0 (any), 'd' (directory), 'r' (regular file), 'l' (symlink),
+ * 'D' (directory or symlink). Type info comes from getdents64(); only
+ * filesystems that don't provide it need an extra fstatat() per entry.
+ *
+ * Returns NULL if the directory can't be read.
+ */
+hd_dir_t *hd_read_dir(char *dir_name, int type)
+{
+  struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  } *de;
+  char buf[32 << 10] __attribute__ ((aligned (8)));
+  hd_dir_t *dir;
+  struct stat sbuf;
+  char *names = NULL, *s;
+  unsigned *types = NULL;
+  size_t names_len = 0, names_max = 0;
+  unsigned len = 0, len_max = 0, i;
+  int fd, link_allowed = 0, dir_type;
+  long pos, size;
+
+  if(!dir_name || (fd = open(dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return NULL;
+
+  if(type == 'D') {
+    type = 'd';
+    link_allowed = 1;
+  }
+
+  while((size = syscall(SYS_getdents64, fd, buf, sizeof buf)) > 0) {
+    for(pos = 0; pos < size; pos += de->d_reclen) {
+      de = (struct linux_dirent64 *) (buf + pos);
+      if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+      switch(de->d_type) {
+        case DT_DIR: dir_type = 'd'; break;
+        case DT_REG: dir_type = 'r'; break;
+        case DT_LNK: dir_type = 'l'; break;
+        case DT_UNKNOWN: dir_type = -1; break;
+        default: dir_type = 0;
+      }
+
+      if(dir_type == -1) {
+        dir_type = 0;
+        if(type && !fstatat(fd, de->d_name, &sbuf, AT_SYMLINK_NOFOLLOW)) {
+          if(S_ISDIR(sbuf.st_mode)) {
+            dir_type = 'd';
+          }
+          else if(S_ISREG(sbuf.st_mode)) {
+            dir_type = 'r';
+          }
+          else if(S_ISLNK(sbuf.st_mode)) {
+            dir_type = 'l';
+          }
+        }
+      }
+
+      if(type && dir_type != type && !(link_allowed && dir_type == 'l')) continue;
+
+      i = strlen(de->d_name) + 1;
+      if(names_len + i > names_max) {
+        names_max = (names_len + i) * 2 + 256;
+        names = resize_mem(names, names_max);
+      }
+      memcpy(names + names_len, de->d_name, i);
+      names_len += i;
+
+      if(len == len_max) {
+        len_max = len_max * 2 + 16;
+        types = resize_mem(types, len_max * sizeof *types);
+      }
+      types[len++] = dir_type;
+    }
+  }
+
+  close(fd);
+
+  dir = new_mem(sizeof *dir + len * sizeof *dir->entry + names_len);
+  dir->len = len;
+
+  s = (char *) (dir->entry + len);
+  if(names_len) memcpy(s, names, names_len);
+
+  for(i = 0; i < len; i++) {
+    dir->entry[i].name = s;
+    dir->entry[i].type = types[i];
+    s += strlen(s) + 1;
+  }
+
+  free_mem(names);
+  free_mem(types);
+
+  return dir;
+}
+
+
+char *hd_read_sysfs_link(char *base_dir, char *link_name)
+{
+  char *s = NULL;
+  static char *buf = NULL;
+
+  if(!base_dir || !link_name) return NULL;
+
+  str_printf(&s, 0, "%s/%s", base_dir, link_name);
+
+  free_mem(buf);
+  buf = realpath(s, NULL);
+
+  free_mem(s);
+
+  return buf;
+}
+
+
+/* serializes hd_data->progress() calls */
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Log the hardware detection progress.
+ */
+void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg)
+{
+  if (!hd_data) return;
+
+  char buf1[32], buf2[32], buf3[128], *fn;
+
+  if(hd_data->shm.ok && hd_data->flags.forked) {
+    ((hd_data_t *) (hd_data->shm.data))->shm.updated++;
+  }
+
+  if(!msg) msg = "";
+
+  sprintf(buf1, "%u", hd_data->module);
+  sprintf(buf2, ".%u", count);
+  fn = mod_name_by_idx(hd_data->module);
+
+  sprintf(buf3, "%s.%u%s", *fn ? fn : buf1, pos, count ? buf2 : "");
+
+  if((hd_data->debug & HD_DEB_PROGRESS))
+    ADD2LOG(">> %s: %s\n", buf3, msg);
+
+  if(hd_data->progress) {
+    /* steps may run in threads, cf. hd_scan_wave() */
+    pthread_mutex_lock(&progress_lock);
+    pthread_cleanup_push((void (*)(void *)) pthread_mutex_unlock, &progress_lock);
+    hd_data->progress(buf3, msg);
+    pthread_cleanup_pop(1);
+  }
+}
+
+
+
+/*
+ * Returns a probe feature suitable for hd_*probe_feature().
+ * If name is not a valid probe feature, 0 is returned.
+ *
+ */
+enum probe_feature hd_probe_feature_by_name(char *name)
+{
+  pr_flags_t *flags;
+
+  flags = pr_flags_by_name(name);
+
+  return flags ? flags->val : 0;
 }
 
 
@@ -2714,7 +3766,7 @@ void remove_hd_entries(hd_data_t *hd_data)
   hd_t *hd;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->module == hd_data->module) {
+    if(hd->module == hd_data->module && entry_in_scope(hd_data, hd)) {
       hd->tag.remove = 1;
     }
   }
@@ -2730,9 +3782,13 @@ void remove_hd_entries(hd_data_t *hd_data)
 void remove_tagged_hd_entries(hd_data_t *hd_data)
 {
   hd_t *hd, **prev, **h;
+  hd_index_t *idx = &hd_data->hd_index;
 
   for(hd = *(prev = &hd_data->hd); hd;) {
     if(hd->tag.remove) {
+      if(hd->idx < idx->by_idx_len && idx->by_idx[hd->idx] == hd) idx->by_idx[hd->idx] = NULL;
+      hd_index_drop(hd_data);
+
       /* find end of the old list... */
       h = &hd_data->old_hd;
       while(*h) h = &(*h)->next;
@@ -3220,6 +4276,7 @@ void hd_copy(hd_t *dst, hd_t *src)
 hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
 {
   hd_t *hd, *hd1, *hd_list = NULL;
+  hd_join_t old = { };
   unsigned char probe_save[sizeof hd_data->probe];
   unsigned fast_save;
 
@@ -3227,6 +4284,10 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
     memcpy(probe_save, hd_data->probe, sizeof probe_save);
     fast_save = hd_data->flags.fast;
     hd_clear_probe_feature(hd_data, pr_all);
+    /* not a hardware probe; keep it */
+    if(probe_save[pr_scan_cache >> 3] & (1 << (pr_scan_cache & 7))) {
+      hd_set_probe_feature(hd_data, pr_scan_cache);
+    }
 #ifdef __powerpc__
     hd_set_probe_feature(hd_data, pr_sys);
     hd_scan(hd_data);
@@ -3237,6 +4298,8 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
     hd_data->flags.fast = fast_save;
   }
 
+  if(hd_old) hd_join_build(&old, hd_old, HD_JOIN_CMP_HD);
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd_report_this(hd_data, hd)) continue;
 
@@ -3258,16 +4321,15 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
 //      if(hd->is.softraiddisk) continue;		/* don't report them */
 
       /* don't report old entries again */
-      for(hd1 = hd_old; hd1; hd1 = hd1->next) {
-        if(!cmp_hd(hd1, hd)) break;
-      }
-      if(!hd1) {
+      if(hd_join_find(&old, hd, -1) < 0) {
         hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
         hd_copy(hd1, hd);
       }
     }
   }
 
+  hd_join_free(&old);
+
   if(item == hw_manual) {
     for(hd = hd_list; hd; hd = hd->next) {
       hd->status.available = hd->status.available_orig;
@@ -3496,11 +4558,13 @@ const char* hd_busid_to_hwcfg(int busid)
  * This is useful to work around long kernel-timeouts as in the floppy
  * detection and ps/2 mouse detection.
  */
-int hd_timeout(void(*func)(void *), void *arg, int timeout)
+int hd_timeout(hd_data_t *hd_data, void(*func)(void *), void *arg, int timeout)
 {
   int child1, child2;
   int status = 0;
 
+  if(hd_data->flags.threads) return hd_timeout_thread(func, arg, timeout);
+
   child1 = fork();
   if(child1 == -1) return -1;
 
@@ -3546,6 +4610,63 @@ void timeout_alarm_handler(int signal)
 }
 
 
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+} timeout_arg_t;
+
+/*
+ * ta belongs to the thread: the caller may have given up on it.
+ */
+void *timeout_thread(void *arg)
+{
+  timeout_arg_t *ta = arg;
+
+  pthread_cleanup_push(free, ta);
+  pthread_cleanup_push(sysfs_shim_cleanup, NULL);
+
+  ta->func(ta->arg);
+
+  pthread_cleanup_pop(1);
+  pthread_cleanup_pop(1);
+
+  return NULL;
+}
+
+
+/*
+ * hd_timeout() variant that runs (*func)() in a thread.
+ *
+ * If it times out, the thread is cancelled and left alone.
+ */
+int hd_timeout_thread(void(*func)(void *), void *arg, int timeout)
+{
+  pthread_t thread;
+  struct timespec ts;
+  timeout_arg_t *ta;
+
+  /* plain malloc: the thread frees it, maybe after a scan arena is gone */
+  if(!(ta = calloc(1, sizeof *ta))) return -1;
+  ta->func = func;
+  ta->arg = arg;
+
+  if(pthread_create(&thread, NULL, timeout_thread, ta)) {
+    free(ta);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeout;
+
+  if(!pthread_timedjoin_np(thread, NULL, &ts)) return 0;
+
+  pthread_cancel(thread);
+  pthread_detach(thread);
+
+  return 1;
+}
+
+
 /*
  * Return list of loaded modules. Converts '-' to '_'.
  */
@@ -3753,13 +4874,13 @@ unsigned hd_boot_disk(hd_data_t *hd_data, int *matches)
   }
 
   if(i == 1 && dl1 && (hd_data->debug & HD_DEB_BOOT)) {
-    ADD2LOG("----- MBR -----\n");
+    ADD2LOG_DATA("----- MBR -----\n");
     for(j = 0; j < 512; j += 0x10) {
-      ADD2LOG("  %03x  ", j);
+      ADD2LOG_DATA("  %03x  ", j);
       hd_log_hex(hd_data, 1, 0x10, dl1->data + j);
-      ADD2LOG("\n");
+      ADD2LOG_DATA("\n");
     }
-    ADD2LOG("----- MBR end -----\n");
+    ADD2LOG_DATA("----- MBR end -----\n");
   }
 
   free_disk_list(dl0);
@@ -3852,6 +4973,9 @@ int load_module_with_params(hd_data_t *hd_data, char *module, char *params)
 
   i = run_cmd(hd_data, cmd);
 
+  /* driver bindings have changed */
+  hd_sysfs_tree_done(hd_data);
+
   free_mem(cmd);
 
   return i;
@@ -3873,6 +4997,8 @@ int unload_module(hd_data_t *hd_data, char *module)
 
   i = run_cmd(hd_data, cmd);
 
+  hd_sysfs_tree_done(hd_data);
+
   free_mem(cmd);
   
   return i;
@@ -4325,55 +5451,285 @@ devtree_t *free_devtree(hd_data_t *hd_data)
 }
 
 
-void test_read_block0_open(void *arg)
+#define BLOCK0_WORKERS	4	/* max. concurrent, non-hanging block 0 reads */
+
+typedef struct {
+  char *dev;
+  int timeout;
+  /* all fields below are protected by block0_lock */
+  enum { block0_queued, block0_open, block0_read, block0_done } state;
+  struct timespec start;	/* start of current state (CLOCK_REALTIME) */
+  int abandoned;		/* given up by read_block0_list() */
+  int open_failed;
+  int read_failed;
+  int read_timeout;
+  int err;			/* read() errno */
+  int len;
+  unsigned msecs;
+  unsigned char buf[512];
+} block0_job_t;
+
+/* job list shared by read_block0_list() & its workers */
+typedef struct {
+  unsigned len;
+  unsigned next;		/* next job to start */
+  unsigned workers;		/* running workers, not counting hanging ones */
+  block0_job_t **job;
+} block0_queue_t;
+
+/* protects block0_job_t & block0_queue_t */
+static pthread_mutex_t block0_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t block0_cond = PTHREAD_COND_INITIALIZER;
+
+static void start_block0_worker(block0_queue_t *q);
+
+/*
+ * Read block 0 of a single device, cf. read_block0_list().
+ *
+ * *timeout: in: timeout in seconds; out: -1: open timed out, -2: read
+ * timed out
+ */
+unsigned char *read_block0(hd_data_t *hd_data, char *dev, int *timeout)
 {
-  open((char *) arg, O_RDONLY);
+  hd_block0_t b0 = { .dev = dev, .timeout = *timeout };
+
+  read_block0_list(hd_data, &b0, 1);
+
+  *timeout = b0.timeout;
+
+  return b0.block0;
 }
 
-unsigned char *read_block0(hd_data_t *hd_data, char *dev, int *timeout)
+
+/*
+ * Read block 0 of several devices in parallel.
+ *
+ * Up to BLOCK0_WORKERS threads do open() and read(), so one hanging device
+ * doesn't hold up the others. A device whose open() hasn't returned after
+ * 'timeout' seconds (or whose read hasn't finished 2 * 'timeout' seconds
+ * after open() returned) is given up; its thread cleans up after itself
+ * whenever it returns and is replaced by a new one.
+ *
+ * Results are logged in list order.
+ */
+void read_block0_list(hd_data_t *hd_data, hd_block0_t *list, unsigned len)
 {
-  int fd, len, buf_size = 512, k, sel;
-  unsigned char *buf = NULL;
-  struct timeval to;
-  fd_set set, set0;
+  block0_queue_t q = { };
+  block0_job_t *job;
+  struct timespec now, deadline, ts;
+  unsigned u, pending;
+
+  if(!len) return;
 
-  if(hd_timeout(test_read_block0_open, dev, *timeout) > 0) {
-    ADD2LOG("  read_block0: open(%s) timed out\n", dev);
-    *timeout = -1;
-    fd = -2;
+  q.len = len;
+  q.job = new_mem(len * sizeof *q.job);
+
+  for(u = 0; u < len; u++) {
+    /* plain malloc: a hanging thread frees it, maybe after hd_data is gone */
+    q.job[u] = calloc(1, sizeof **q.job);
+    q.job[u]->dev = strdup(list[u].dev);
+    q.job[u]->timeout = list[u].timeout;
   }
-  else {
-    fd = open(dev, O_RDONLY);
-    if(fd < 0) ADD2LOG("  read_block0: open(%s) failed\n", dev);
+
+  pthread_mutex_lock(&block0_lock);
+
+  for(u = 0; u < BLOCK0_WORKERS && u < len; u++) start_block0_worker(&q);
+
+  for(;;) {
+    if(!q.workers && q.next < q.len) {
+      /* no threads: do it ourselves, without timeouts */
+      q.workers++;
+      pthread_mutex_unlock(&block0_lock);
+      read_block0_thread(&q);
+      pthread_mutex_lock(&block0_lock);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    deadline.tv_sec = 0;
+
+    for(pending = u = 0; u < len; u++) {
+      job = q.job[u];
+
+      if(!job || job->state == block0_done) continue;
+
+      pending++;
+
+      if(job->state == block0_queued) continue;
+
+      ts = job->start;
+      ts.tv_sec += job->state == block0_open ? job->timeout : 2 * job->timeout;
+
+      if(now.tv_sec > ts.tv_sec || (now.tv_sec == ts.tv_sec && now.tv_nsec >= ts.tv_nsec)) {
+        /* the thread frees it */
+        job->abandoned = 1;
+        q.job[u] = NULL;
+        list[u].timeout = job->state == block0_open ? -1 : -2;
+        pending--;
+        /* its thread is lost for now */
+        q.workers--;
+        if(q.next < q.len) start_block0_worker(&q);
+        continue;
+      }
+
+      if(!deadline.tv_sec || ts.tv_sec < deadline.tv_sec) deadline = ts;
+    }
+
+    /* wait for idle workers, too: they still look at q */
+    if(!pending && !q.workers) break;
+
+    if(deadline.tv_sec) {
+      pthread_cond_timedwait(&block0_cond, &block0_lock, &deadline);
+    }
+    else {
+      pthread_cond_wait(&block0_cond, &block0_lock);
+    }
   }
-  if(fd >= 0) {
-    buf = new_mem(buf_size);
-    len = k = 0;
 
-    FD_ZERO(&set0);
-    FD_SET(fd, &set0);
+  for(u = 0; u < len; u++) {
+    job = q.job[u];
+    list[u].block0 = NULL;
 
-    to.tv_sec = *timeout; to.tv_usec = 0;
-    for(;;) {
-      set = set0;
-      if((sel = select(fd + 1, &set, NULL, NULL, &to)) > 0) {
-        if((k = read(fd, buf + len, buf_size - len)) > 0) len += k;
-        ADD2LOG("  read_block0: %d bytes (%ds, %dus)\n", k, (int) to.tv_sec, (int) to.tv_usec);
-        if(k <= 0 || buf_size == len) break;
+    if(!job) {
+      ADD2LOG("  read_block0: %s(%s) timed out\n", list[u].timeout == -1 ? "open" : "read", list[u].dev);
+      continue;
+    }
+
+    if(job->open_failed) {
+      ADD2LOG("  read_block0: open(%s) failed\n", list[u].dev);
+    }
+    else if(job->read_failed) {
+      ADD2LOG("  read_block0: read error(%s, %d, %d): errno %d\n", list[u].dev, job->len, 512 - job->len, job->err);
+    }
+    else {
+      ADD2LOG(
+        "  read_block0: %s: %d bytes (%ums%s)\n",
+        list[u].dev, job->len, job->msecs, job->read_timeout ? ", timed out" : ""
+      );
+      if(job->read_timeout) list[u].timeout = -2;
+      list[u].block0 = new_mem(512);
+      memcpy(list[u].block0, job->buf, job->len);
+    }
+
+    free(job->dev);
+    free(job);
+  }
+
+  pthread_mutex_unlock(&block0_lock);
+
+  free_mem(q.job);
+}
+
+
+/*
+ * Start another worker for q; block0_lock must be held.
+ */
+void start_block0_worker(block0_queue_t *q)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 << 10);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if(!pthread_create(&thread, &attr, read_block0_thread, q)) q->workers++;
+
+  pthread_attr_destroy(&attr);
+}
+
+
+/*
+ * Worker: open devices & read block 0 (or until timeout) as long as there
+ * are jobs left, cf. read_block0_list().
+ *
+ * If our job is given up while we're in open() or read(), q may be gone
+ * when we return: free the job and leave without touching q.
+ */
+void *read_block0_thread(void *arg)
+{
+  block0_queue_t *q = arg;
+  block0_job_t *job;
+  struct pollfd pfd;
+  struct timespec open_start, start, now;
+  unsigned char buf[512];
+  int fd, k, len, remaining, open_failed, read_failed, read_timeout, err;
+
+  pthread_mutex_lock(&block0_lock);
+
+  while(q->next < q->len) {
+    job = q->job[q->next++];
+    job->state = block0_open;
+    clock_gettime(CLOCK_REALTIME, &job->start);
+    pthread_mutex_unlock(&block0_lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &open_start);
+
+    fd = open(job->dev, O_RDONLY | O_CLOEXEC);
+
+    /* the read timeout starts now */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&block0_lock);
+    job->state = block0_read;
+    clock_gettime(CLOCK_REALTIME, &job->start);
+    pthread_mutex_unlock(&block0_lock);
+
+    k = len = read_failed = read_timeout = err = 0;
+    open_failed = fd < 0;
+
+    if(fd >= 0) {
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+
+      while(len < (int) sizeof buf) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = job->timeout * 1000 - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+        if(remaining <= 0 || poll(&pfd, 1, remaining) == 0) {
+          read_timeout = 1;
+          break;
+        }
+        if((k = read(fd, buf + len, sizeof buf - len)) <= 0) break;
+        len += k;
       }
-      if(sel == 0) {
-        *timeout = -2; break;
+
+      if(k < 0) {
+        read_failed = 1;
+        err = errno;
       }
+
+      close(fd);
     }
 
-    if(k < 0) {
-      ADD2LOG("  read_block0: read error(%s, %d, %d): errno %d\n", dev, len, buf_size - len, errno);
-      buf = free_mem(buf);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&block0_lock);
+
+    if(job->abandoned) {
+      free(job->dev);
+      free(job);
+      pthread_mutex_unlock(&block0_lock);
+
+      return NULL;
     }
-    close(fd);
+
+    job->open_failed = open_failed;
+    job->read_failed = read_failed;
+    job->read_timeout = read_timeout;
+    job->err = err;
+    job->len = len;
+    memcpy(job->buf, buf, len);
+    job->msecs = (now.tv_sec - open_start.tv_sec) * 1000 + (now.tv_nsec - open_start.tv_nsec) / 1000000;
+    job->state = block0_done;
+
+    pthread_cond_broadcast(&block0_cond);
   }
 
-  return buf;
+  q->workers--;
+  pthread_cond_broadcast(&block0_cond);
+
+  pthread_mutex_unlock(&block0_lock);
+
+  return NULL;
 }
 
 
@@ -5385,17 +6741,133 @@ void hd_fork_done(hd_data_t *hd_data)
 
 
 /*
- * Copy log to shm segment.
+ * Run potentially hanging code.
+ *
+ * func() runs in a subprocess (cf. hd_fork()) or, if flags.threads is set,
+ * in a thread (cf. hd_fork_thread()). Either way it must pass its results
+ * back through the shm segment (hd_shm_add(), hd_move_to_shm()).
+ *
+ * If flags.forked is still set afterwards, func() ran directly and its
+ * results are in hd_data.
  */
-void copy_log2shm(hd_data_t *hd_data)
+void hd_isolate(hd_data_t *hd_data, int timeout, int total_timeout, hd_probe_func_t func, void *arg)
 {
-  hd_data_t *hd_data_shm;
+  if(hd_data->flags.threads && !hd_data->flags.nofork && !hd_data->flags.forked) {
+    hd_fork_thread(hd_data, timeout, total_timeout, func, arg);
 
-  hd_data_shm = hd_data->shm.data;
+    return;
+  }
 
-  if(hd_data->log) {
-    hd_data_shm->log_size = hd_data->log_size;
-    hd_data_shm->log_max = hd_data->log_size + 1;
+  hd_fork(hd_data, timeout, total_timeout);
+
+  if(hd_data->flags.forked) func(hd_data, arg);
+
+  hd_fork_done(hd_data);
+}
+
+
+typedef struct {
+  hd_data_t *hd_data;
+  hd_probe_func_t func;
+  void *arg;
+} probe_thread_t;
+
+void *probe_thread(void *arg)
+{
+  probe_thread_t *pt = arg;
+
+  pthread_cleanup_push(sysfs_shim_cleanup, NULL);
+
+  pt->func(pt->hd_data, pt->arg);
+
+  pthread_cleanup_pop(1);
+
+  return NULL;
+}
+
+
+/*
+ * Run func() in a thread, with the same timeout rules as hd_fork().
+ *
+ * The thread works on a private copy of hd_data; its log is added to ours.
+ * The shm segment is just private memory here, so hd_move_to_shm() hands
+ * over pointers instead of copying.
+ *
+ * The copy still points into our data, so a cancelled thread is always
+ * waited for: it must not outlive hd_data.
+ */
+void hd_fork_thread(hd_data_t *hd_data, int timeout, int total_timeout, hd_probe_func_t func, void *arg)
+{
+  hd_data_t *hd_data_shm;
+  probe_thread_t *pt;
+  pthread_t thread;
+  struct timespec ts;
+  time_t stop_time;
+  int updated, rem_time, wait_time;
+
+  hd_data_shm = hd_data->shm.data;
+
+  pt = new_mem(sizeof *pt);
+  pt->hd_data = new_mem(sizeof *pt->hd_data);
+  *pt->hd_data = *hd_data;
+  pt->hd_data->log = NULL;
+  pt->hd_data->log_size = pt->hd_data->log_max = 0;
+  pt->hd_data->flags.forked = 1;
+  pt->func = func;
+  pt->arg = arg;
+
+  stop_time = time(NULL) + total_timeout;
+  rem_time = total_timeout;
+  wait_time = timeout;
+
+  updated = hd_data_shm->shm.updated;
+
+  if(pthread_create(&thread, NULL, probe_thread, pt)) {
+    ADD2LOG("******  failed to start thread, probing directly  ******\n");
+    probe_thread(pt);
+  }
+  else {
+    ADD2LOG("******  started probe thread (%ds/%ds)  ******\n", timeout, total_timeout);
+
+    for(;;) {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += wait_time;
+      if(!pthread_timedjoin_np(thread, NULL, &ts)) break;
+      rem_time = stop_time - time(NULL);
+      if(updated == hd_data_shm->shm.updated || rem_time < 0) {
+        ADD2LOG("******  cancelled probe thread (%ds)  ******\n", rem_time);
+        pthread_cancel(thread);
+        pthread_join(thread, NULL);
+        break;
+      }
+      /* reset time if there was some progress and we've got some time left  */
+      rem_time++;
+      wait_time = rem_time > timeout ? timeout : rem_time;
+      updated = hd_data_shm->shm.updated;
+    }
+  }
+
+  hd_log(hd_data, pt->hd_data->log, pt->hd_data->log_size);
+  free_mem(pt->hd_data->log);
+  free_mem(pt->hd_data);
+  free_mem(pt);
+
+  ADD2LOG("******  stopped probe thread (%ds)  ******\n", rem_time);
+}
+
+
+/*
+ * Copy log to shm segment.
+ */
+void copy_log2shm(hd_data_t *hd_data)
+{
+  hd_data_t *hd_data_shm;
+
+  hd_data_shm = hd_data->shm.data;
+
+  if(hd_data->log) {
+    hd_data_shm->log_size = hd_data->log_size;
+    hd_data_shm->log_max = hd_data->log_size + 1;
     hd_data_shm->log = hd_shm_add(hd_data, hd_data->log, hd_data_shm->log_max);
   }
 }
@@ -5440,6 +6912,19 @@ void hd_shm_init(hd_data_t *hd_data)
 
   hd_data->shm.size = 256*1024;
 
+  if(hd_data->flags.threads) {
+    /* no need to share anything with a subprocess */
+    hd_data->shm.id = -1;
+    hd_data->shm.data = new_mem(hd_data->shm.size);
+    hd_data->shm.ok = 1;
+
+    ADD2LOG("shm: using private memory at %p\n", hd_data->shm.data);
+
+    hd_shm_clean(hd_data);
+
+    return;
+  }
+
   hd_data->shm.id = shmget(IPC_PRIVATE, hd_data->shm.size, IPC_CREAT | 0600);
 
   if(hd_data->shm.id == -1) {
@@ -5496,7 +6981,12 @@ void hd_shm_done(hd_data_t *hd_data)
 {
   if(!hd_data->shm.ok) return;
 
-  shmdt(hd_data->shm.data);
+  if(hd_data->shm.id == -1) {
+    free_mem(hd_data->shm.data);
+  }
+  else {
+    shmdt(hd_data->shm.data);
+  }
 
   hd_data->shm.ok = 0;
 }
@@ -5576,6 +7066,14 @@ void hd_move_to_shm(hd_data_t *hd_data)
 
   hd_data_shm = hd_data->shm.data;
 
+  if(hd_data->flags.threads) {
+    /* same address space, cf. hd_fork_thread() */
+    hd_data_shm->ser_mouse = hd_data->ser_mouse;
+    hd_data_shm->ser_modem = hd_data->ser_modem;
+
+    return;
+  }
+
   ser_dev[0].src = &hd_data->ser_mouse;
   ser_dev[0].dst = &hd_data_shm->ser_mouse;
   ser_dev[1].src = &hd_data->ser_modem;
@@ -5629,110 +7127,478 @@ hd_udevinfo_t *hd_free_udevinfo(hd_udevinfo_t *ui)
 }
 
 
-void read_udevinfo(hd_data_t *hd_data)
+#define UDEVINFO_HASH_SIZE	256
+
+/*
+ * Drop udev data read so far and check if there's a udev database.
+ *
+ * return:
+ *   0/1: no udev/udev
+ */
+int hd_udevinfo_init(hd_data_t *hd_data)
+{
+  struct stat sbuf;
+
+  hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
+  hd_data->udevinfo_hash = free_mem(hd_data->udevinfo_hash);
+
+  if(stat(UDEV_DATA_DIR, &sbuf) || !S_ISDIR(sbuf.st_mode)) {
+    ADD2LOG("udev: no database\n");
+
+    return 0;
+  }
+
+  hd_data->udevinfo_hash = new_mem(UDEVINFO_HASH_SIZE * sizeof *hd_data->udevinfo_hash);
+
+  return 1;
+}
+
+
+/*
+ * Get udev info for sysfs_id (without leading "/sys").
+ *
+ * The udev database is read directly (UDEV_DATA_DIR/<b|c><major>:<minor>),
+ * one device at a time; results (also negative ones) are kept in
+ * hd_data->udevinfo_hash.
+ *
+ * Call hd_udevinfo_init() first.
+ */
+hd_udevinfo_t *hd_udevinfo(hd_data_t *hd_data, char *sysfs_id)
+{
+  hd_udevinfo_t *ui, **uip;
+  unsigned major, minor;
+  char *s, *t, *path = NULL, *devname = NULL;
+  int type = 'c';
+  str_list_t *sl, *sl0;
+
+  if(!hd_data->udevinfo_hash || !sysfs_id || !*sysfs_id) return NULL;
+
+  uip = hd_data->udevinfo_hash + hd_index_hash(sysfs_id) % UDEVINFO_HASH_SIZE;
+
+  for(ui = *uip; ui; ui = ui->hash_next) {
+    if(!strcmp(ui->sysfs, sysfs_id)) return ui;
+  }
+
+  ui = new_mem(sizeof *ui);
+  ui->sysfs = new_str(sysfs_id);
+  ui->next = hd_data->udevinfo;
+  hd_data->udevinfo = ui;
+  ui->hash_next = *uip;
+  *uip = ui;
+
+  str_printf(&path, 0, "/sys%s", sysfs_id);
+
+  if(
+    !(s = get_sysfs_attr_by_path(path, "dev")) ||
+    sscanf(s, "%u:%u", &major, &minor) != 2
+  ) {
+    free_mem(path);
+
+    return ui;
+  }
+
+  if((s = hd_read_sysfs_link(path, "subsystem")) && (t = strrchr(s, '/')) && !strcmp(t, "/block")) {
+    type = 'b';
+  }
+
+  /* the kernel's device name; udev doesn't rename nodes anymore */
+  for(sl = hd_attr_list(get_sysfs_attr_by_path(path, "uevent")); sl; sl = sl->next) {
+    if(!strncmp(sl->str, "DEVNAME=", sizeof "DEVNAME=" - 1)) {
+      devname = new_str(sl->str + sizeof "DEVNAME=" - 1);
+      break;
+    }
+  }
+
+  str_printf(&path, 0, "%s/%c%u:%u", UDEV_DATA_DIR, type, major, minor);
+
+  sl0 = read_file(path, 0, 0);
+
+  for(sl = sl0; sl; sl = sl->next) {
+    if((s = strchr(sl->str, '\n'))) *s = 0;
+    if(!strncmp(sl->str, "N:", 2)) {
+      free_mem(devname);
+      devname = new_str(sl->str + 2);
+    }
+    else if(!strncmp(sl->str, "S:", 2)) {
+      s = NULL;
+      str_printf(&s, 0, "/dev/%s", sl->str + 2);
+      add_str_list(&ui->links, s);
+      free_mem(s);
+    }
+  }
+
+  if(devname) str_printf(&ui->name, 0, "/dev/%s", devname);
+
+  ADD2LOG_DATA("udev: %s\n", ui->sysfs);
+  if(ui->name) ADD2LOG_DATA("  name: %s\n", ui->name);
+  if(ui->links && LOG_ON(log_data)) {
+    s = hd_join(", ", ui->links);
+    ADD2LOG("  links: %s\n", s);
+    free_mem(s);
+  }
+
+  free_str_list(sl0);
+  free_mem(devname);
+  free_mem(path);
+
+  return ui;
+}
+
+
+/*
+ * Get udev info for device node.
+ */
+hd_udevinfo_t *hd_udevinfo_by_name(hd_data_t *hd_data, char *dev_name)
 {
-  str_list_t *sl, *udevinfo;
-  hd_udevinfo_t **uip, *ui;
-  char *s = NULL, buf[256];
+  struct stat sbuf;
+  char *s = NULL, *t;
+  hd_udevinfo_t *ui = NULL;
+
+  if(!hd_data->udevinfo_hash || !dev_name || lstat(dev_name, &sbuf)) return NULL;
 
-  udevinfo = read_file("| " PROG_UDEVADM " info -e 2>/dev/null", 0, 0);
-  if(!udevinfo) udevinfo = read_file("| " PROG_UDEVINFO " -e 2>/dev/null", 0, 0);
+  if(S_ISBLK(sbuf.st_mode) || S_ISCHR(sbuf.st_mode)) {
+    str_printf(&s, 0, "/sys/dev/%s/%u:%u",
+      S_ISBLK(sbuf.st_mode) ? "block" : "char",
+      major(sbuf.st_rdev), minor(sbuf.st_rdev)
+    );
+    t = realpath(s, NULL);
+    if(t) ui = hd_udevinfo(hd_data, hd_sysfs_id(t));
+    free_mem(t);
+    free_mem(s);
+  }
+
+  return ui && ui->name && !strcmp(ui->name, dev_name) ? ui : NULL;
+}
+
+
+/*
+ * Return libhd version.
+ */
+char *hd_version()
+{
+  return HD_VERSION_STRING;
+}
+
+
+hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id)
+{
+  hd_t *hd;
+
+  if(id && *id) {
+    if(hd_data->hd_index.list) {
+      return hd_index_find(hd_data, &hd_data->hd_index.sysfs_id, 1, id, NULL);
+    }
+
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(hd->sysfs_id && !strcmp(hd->sysfs_id, id)) return hd;
+    }
+  }
+
+  return NULL;
+}
+
+
+hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname)
+{
+  hd_t *hd;
+
+  if(id && *id && devname) {
+    if(hd_data->hd_index.list) {
+      return hd_index_find(hd_data, &hd_data->hd_index.sysfs_id, 1, id, devname);
+    }
+
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(
+        hd->sysfs_id &&
+        !strcmp(hd->sysfs_id, id) &&
+        (
+          !hd->unix_dev_name ||
+          (
+            hd->unix_dev_name &&
+            !strcmp(hd->unix_dev_name, devname)
+          )
+        )
+      ) return hd;
+    }
+  }
+
+  return NULL;
+}
+
+
+hd_t *hd_find_udi(hd_data_t *hd_data, char *udi)
+{
+  hd_t *hd;
+
+  if(!udi) return NULL;
+
+  if(hd_data->hd_index.list) {
+    return hd_index_find(hd_data, &hd_data->hd_index.udi, 2, udi, NULL);
+  }
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->udi && !strcmp(hd->udi, udi)) return hd;
+  }
+
+  return NULL;
+}
+
+
+unsigned hd_index_hash(char *str)
+{
+  unsigned h = 2166136261u;
+
+  while(*str) {
+    h ^= (unsigned char) *str++;
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+
+/*
+ * Index hd_data->hd by unique_id, sysfs_id & udi.
+ *
+ * Until the next add_hd_entry() or remove_tagged_hd_entries() call,
+ * hd_get_device_by_id(), hd_find_sysfs_id(), hd_find_sysfs_id_devname() and
+ * hd_find_udi() use the index instead of walking the list. So don't
+ * change these ids while the index exists; call hd_index_drop() before.
+ */
+void hd_index_build(hd_data_t *hd_data)
+{
+  hd_index_t *idx = &hd_data->hd_index;
+  hd_t *hd;
+  unsigned u, i, len[3], *ent[3], *hv[3];
+  char *key;
+
+  hd_index_drop(hd_data);
+
+  for(hd = hd_data->hd; hd; hd = hd->next) idx->list_len++;
+
+  idx->list = new_mem((idx->list_len + 1) * sizeof *idx->list);
+
+  for(i = 0; i < 3; i++) {
+    len[i] = 0;
+    ent[i] = new_mem((idx->list_len + 1) * sizeof **ent);
+    hv[i] = new_mem((idx->list_len + 1) * sizeof **hv);
+  }
+
+  for(u = 0, hd = hd_data->hd; hd; hd = hd->next, u++) {
+    idx->list[u] = hd;
+    for(i = 0; i < 3; i++) {
+      if(!(key = hd_index_key(hd, i))) continue;
+      ent[i][len[i]] = u;
+      hv[i][len[i]++] = hd_index_hash(key);
+    }
+  }
+
+  hddb_build_hash(&idx->unique_id, len[0], ent[0], hv[0]);
+  hddb_build_hash(&idx->sysfs_id, len[1], ent[1], hv[1]);
+  hddb_build_hash(&idx->udi, len[2], ent[2], hv[2]);
+
+  for(i = 0; i < 3; i++) {
+    free_mem(ent[i]);
+    free_mem(hv[i]);
+  }
+}
+
+
+/*
+ * Remove hash tables created by hd_index_build().
+ */
+void hd_index_drop(hd_data_t *hd_data)
+{
+  hd_index_t *idx = &hd_data->hd_index;
+
+  if(!idx->list) return;
+
+  idx->list = free_mem(idx->list);
+  idx->list_len = 0;
+
+  idx->unique_id.start = free_mem(idx->unique_id.start);
+  idx->unique_id.entry = free_mem(idx->unique_id.entry);
+  idx->sysfs_id.start = free_mem(idx->sysfs_id.start);
+  idx->sysfs_id.entry = free_mem(idx->sysfs_id.entry);
+  idx->udi.start = free_mem(idx->udi.start);
+  idx->udi.entry = free_mem(idx->udi.entry);
+}
+
+
+/*
+ * Id used for index 'type' (0: unique_id, 1: sysfs_id, 2: udi).
+ */
+char *hd_index_key(hd_t *hd, unsigned type)
+{
+  switch(type) {
+    case 0:
+      return hd->unique_id;
+
+    case 1:
+      return hd->sysfs_id;
+
+    case 2:
+      return hd->udi;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Look up first list entry whose id of index 'type' is 'key'.
+ *
+ * If 'devname' is set, apply hd_find_sysfs_id_devname() rules.
+ */
+hd_t *hd_index_find(hd_data_t *hd_data, hddb2_hash_t *hash, unsigned type, char *key, char *devname)
+{
+  unsigned *ent, *end;
+  hd_t *hd;
+  char *s;
+
+  for(ent = hddb_bucket(hash, hd_index_hash(key), &end); ent < end; ent++) {
+    hd = hd_data->hd_index.list[*ent];
+    s = hd_index_key(hd, type);
+    if(
+      s &&
+      !strcmp(s, key) &&
+      (!devname || !hd->unix_dev_name || !strcmp(hd->unix_dev_name, devname))
+    ) return hd;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Build hash table over list 'hd' to join other lists with it.
+ *
+ * Join key 'type' is HD_JOIN_UNIQUE_ID or HD_JOIN_CMP_HD; entries without
+ * key are kept in join->list but can't be found. Unlike hd_index_build()
+ * this works on any list. The list must not change until hd_join_free().
+ */
+void hd_join_build(hd_join_t *join, hd_t *hd, unsigned type)
+{
+  hd_t *hd1;
+  unsigned u, len = 0, *ent, *hv;
 
-  ADD2LOG("-----  udevinfo -----\n");
-  for(sl = udevinfo; sl; sl = sl->next) {
-    ADD2LOG("  %s", sl->str);
-  }
-  ADD2LOG("-----  udevinfo end -----\n");
+  memset(join, 0, sizeof *join);
 
-  hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
+  join->type = type;
 
-  uip = &hd_data->udevinfo;
+  for(hd1 = hd; hd1; hd1 = hd1->next) join->len++;
 
-  for(ui = NULL, sl = udevinfo; sl; sl = sl->next) {
-    if(sscanf(sl->str, "P: %255s", buf) == 1) {
-      ui = *uip = new_mem(sizeof **uip);
-      uip = &(*uip)->next;
-      ui->sysfs = new_str(buf);
+  join->list = new_mem((join->len + 1) * sizeof *join->list);
+  ent = new_mem((join->len + 1) * sizeof *ent);
+  hv = new_mem((join->len + 1) * sizeof *hv);
 
-      continue;
-    }
+  for(u = 0; hd; hd = hd->next, u++) {
+    join->list[u] = hd;
+    if(hd_join_hash(hd, type, hv + len)) ent[len++] = u;
+  }
 
-    if(!ui) continue;
+  hddb_build_hash(&join->hash, len, ent, hv);
 
-    if(sscanf(sl->str, "N: %255s", buf) == 1) {
-      str_printf(&ui->name, 0, "/dev/%s", buf);
+  free_mem(ent);
+  free_mem(hv);
+}
 
-      continue;
-    }
 
-    if(sscanf(sl->str, "S: %255s", buf) == 1) {
-      str_printf(&s, 0, "/dev/%s", buf);
-      add_str_list(&ui->links, s);
+/*
+ * Index of the first entry in join->list after 'pos' whose key matches
+ * that of 'hd'; -1 if there's none. Start with pos = -1.
+ */
+int hd_join_find(hd_join_t *join, hd_t *hd, int pos)
+{
+  unsigned *ent, *end, hv;
+  hd_t *hd1;
 
-      continue;
-    }
-  }
+  if(join->type == HD_JOIN_UNIQUE_ID) return hd_join_find_id(join, hd->unique_id, pos);
 
-  s = free_mem(s);
+  if(!join->list || !hd_join_hash(hd, join->type, &hv)) return -1;
 
-  for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-    ADD2LOG("%s\n", ui->sysfs);
-    if(ui->name) ADD2LOG("  name: %s\n", ui->name);
-    if(ui->links) {
-      s = hd_join(", ", ui->links);
-      ADD2LOG("  links: %s\n", s);
-      free_mem(s);
-    }
+  for(ent = hddb_bucket(&join->hash, hv, &end); ent < end; ent++) {
+    if((int) *ent <= pos) continue;
+    hd1 = join->list[*ent];
+    if(!cmp_hd(hd1, hd)) return *ent;
   }
 
-  free_str_list(udevinfo);
+  return -1;
 }
 
 
 /*
- * Return libhd version.
+ * Same as hd_join_find(), for HD_JOIN_UNIQUE_ID and a given unique id.
  */
-char *hd_version()
+int hd_join_find_id(hd_join_t *join, char *id, int pos)
 {
-  return HD_VERSION_STRING;
+  unsigned *ent, *end;
+  hd_t *hd1;
+
+  if(!id || !join->list || join->type != HD_JOIN_UNIQUE_ID) return -1;
+
+  for(ent = hddb_bucket(&join->hash, hd_index_hash(id), &end); ent < end; ent++) {
+    if((int) *ent <= pos) continue;
+    hd1 = join->list[*ent];
+    if(hd1->unique_id && !strcmp(hd1->unique_id, id)) return *ent;
+  }
+
+  return -1;
 }
 
 
-hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id)
+/*
+ * Free hash table created by hd_join_build().
+ */
+void hd_join_free(hd_join_t *join)
 {
-  hd_t *hd;
-
-  if(id && *id) {
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(hd->sysfs_id && !strcmp(hd->sysfs_id, id)) return hd;
-    }
-  }
+  join->list = free_mem(join->list);
+  join->len = 0;
 
-  return NULL;
+  join->hash.start = free_mem(join->hash.start);
+  join->hash.entry = free_mem(join->hash.entry);
 }
 
 
-hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname)
+/*
+ * Hash value of join key 'type'; return 0 if hd has no such key.
+ */
+int hd_join_hash(hd_t *hd, unsigned type, unsigned *hv)
 {
-  hd_t *hd;
+  unsigned u, h, val[14];
 
-  if(id && *id && devname) {
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(
-        hd->sysfs_id &&
-        !strcmp(hd->sysfs_id, id) &&
-        (
-          !hd->unix_dev_name ||
-          (
-            hd->unix_dev_name &&
-            !strcmp(hd->unix_dev_name, devname)
-          )
-        )
-      ) return hd;
-    }
+  if(type == HD_JOIN_UNIQUE_ID) {
+    if(!hd->unique_id) return 0;
+    *hv = hd_index_hash(hd->unique_id);
+
+    return 1;
   }
 
-  return NULL;
+  /* cmp_hd() fields */
+  u = 0;
+  val[u++] = hd->bus.id;
+  val[u++] = hd->slot;
+  val[u++] = hd->func;
+  val[u++] = hd->base_class.id;
+  val[u++] = hd->sub_class.id;
+  val[u++] = hd->prog_if.id;
+  val[u++] = hd->device.id;
+  val[u++] = hd->vendor.id;
+  val[u++] = hd->sub_vendor.id;
+  val[u++] = hd->revision.id;
+  val[u++] = hd->compat_device.id;
+  val[u++] = hd->compat_vendor.id;
+  val[u++] = hd->module;
+  val[u++] = hd->line;
+
+  h = hd_index_hash(hd->unix_dev_name ?: "");
+  while(u--) {
+    h ^= val[u];
+    h *= 16777619;
+  }
+  *hv = h;
+
+  return 1;
 }
 
 
@@ -5759,8 +7625,9 @@ void hd_sysfs_driver_list(hd_data_t *hd_data)
   hd_sysfsdrv_t **sfp, *sf;
   str_list_t *sl, *sl0;
   uint64_t id = 0;
-  char *drv_dir = NULL, *drv = NULL, *module, *s;
-  str_list_t *sf_bus, *sf_bus_e, *sf_drv, *sf_drv_e, *sf_drv2, *sf_drv2_e;
+  char *drv_dir = NULL, *drv = NULL, *dev_dir = NULL, *module, *s, *bus_name, *drv_name, *name;
+  hd_dir_t *sf_bus, *sf_drv, *sf_drv2;
+  unsigned u1, u2, u3;
 
   for(sl = sl0 = read_file(PROC_MODULES, 0, 0); sl; sl = sl->next) {
     crc64(&id, sl->str, strlen(sl->str) + 1);
@@ -5779,50 +7646,58 @@ void hd_sysfs_driver_list(hd_data_t *hd_data)
 
   ADD2LOG("----- sysfs driver list (id 0x%016"PRIx64") -----\n", id);
 
-  sf_bus = read_dir("/sys/bus", 'd');
+  sf_bus = hd_read_dir("/sys/bus", 'd');
 
-  for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    str_printf(&drv_dir, 0, "/sys/bus/%s/drivers", sf_bus_e->str);
-    sf_drv = read_dir(drv_dir, 'd');
+  for(u1 = 0; sf_bus && u1 < sf_bus->len; u1++) {
+    bus_name = sf_bus->entry[u1].name;
+    str_printf(&drv_dir, 0, "/sys/bus/%s/drivers", bus_name);
+    str_printf(&dev_dir, 0, "/sys/bus/%s/devices", bus_name);
+    sf_drv = hd_read_dir(drv_dir, 'd');
 
-    for(sf_drv_e = sf_drv; sf_drv_e; sf_drv_e = sf_drv_e->next) {
-      str_printf(&drv, 0, "/sys/bus/%s/drivers/%s", sf_bus_e->str, sf_drv_e->str);
+    for(u2 = 0; sf_drv && u2 < sf_drv->len; u2++) {
+      drv_name = sf_drv->entry[u2].name;
+      str_printf(&drv, 0, "/sys/bus/%s/drivers/%s", bus_name, drv_name);
 
-      sf_drv2 = read_dir(drv, 'l');
+      sf_drv2 = hd_read_dir(drv, 'l');
 
-      for(sf_drv2_e = sf_drv2; sf_drv2_e; sf_drv2_e = sf_drv2_e->next) {
-        if(!strcmp(sf_drv2_e->str, "module")) {
-          s = hd_read_sysfs_link(drv, sf_drv2_e->str);
+      for(u3 = 0; sf_drv2 && u3 < sf_drv2->len; u3++) {
+        name = sf_drv2->entry[u3].name;
+        if(!strcmp(name, "module")) {
+          s = hd_read_sysfs_link(drv, name);
           module = s ? strrchr(s, '/') : NULL;
           if(module) {
             sf = *sfp = new_mem(sizeof **sfp);
             sfp = &(*sfp)->next;
-            sf->driver = new_str(sf_drv_e->str);
+            sf->driver = new_str(drv_name);
             sf->module = new_str(module + 1);
-            ADD2LOG("%16s: module = %s\n", sf->driver, sf->module);
+            ADD2LOG_DATA("%16s: module = %s\n", sf->driver, sf->module);
           }
         }
         else {
           sf = *sfp = new_mem(sizeof **sfp);
           sfp = &(*sfp)->next;
-          sf->driver = new_str(sf_drv_e->str);
-          sf->device = new_str(hd_sysfs_id(hd_read_sysfs_link(drv, sf_drv2_e->str)));
-          ADD2LOG("%16s: %s\n", sf->driver, sf->device);
+          sf->driver = new_str(drv_name);
+          /* the links are named after the devices on the bus */
+          s = hd_sysfs_link(hd_data, dev_dir, name);
+          if(!s) s = hd_read_sysfs_link(drv, name);
+          sf->device = new_str(hd_sysfs_id(s));
+          ADD2LOG_DATA("%16s: %s\n", sf->driver, sf->device);
         }
       }
 
-      free_str_list(sf_drv2);
+      free_mem(sf_drv2);
 
     }
 
-    free_str_list(sf_drv);
+    free_mem(sf_drv);
 
   }
 
-  free_str_list(sf_bus);
+  free_mem(sf_bus);
 
   drv = free_mem(drv);
   drv_dir = free_mem(drv_dir);
+  dev_dir = free_mem(dev_dir);
 
   ADD2LOG("----- sysfs driver list end -----\n");
 }
@@ -5979,10 +7854,17 @@ int hd_attr_uint(char* attr, uint64_t* u, int base)
 str_list_t *hd_attr_list(char *str)
 {
   static str_list_t *sl = NULL;
+  hd_data_t *arena_save = arena_data;
+
+  /* static data must outlive any arena */
+  arena_data = NULL;
 
   free_str_list(sl);
+  sl = hd_split('\n', str);
+
+  arena_data = arena_save;
 
-  return sl = hd_split('\n', str);
+  return sl;
 }
 
 
@@ -5998,6 +7880,90 @@ char *hd_sysfs_id(char *path)
 }
 
 
+/*
+ * Canonical sysfs id for path (with or without leading "/sys").
+ *
+ * Symlinks are resolved as long as path exists.
+ */
+char *hd_sysfs_real_id(char *path)
+{
+  char *s = NULL, *buf;
+  unsigned len;
+
+  if(strncmp(path, "/sys/", sizeof "/sys/" - 1)) {
+    str_printf(&s, 0, "/sys%s%s", *path == '/' ? "" : "/", path);
+  }
+  else {
+    s = new_str(path);
+  }
+
+  if((buf = realpath(s, NULL))) {
+    free_mem(s);
+    s = buf;
+  }
+
+  buf = new_str(hd_sysfs_id(s) ?: "/");
+  free_mem(s);
+
+  len = strlen(buf);
+  while(len > 1 && buf[len - 1] == '/') buf[--len] = 0;
+
+  return buf;
+}
+
+
+/*
+ * Check if sysfs path is in the rescan scope (cf. hd_rescan_sysfs_path()).
+ *
+ * Always true if there's no scope.
+ */
+int hd_sysfs_in_scope(hd_data_t *hd_data, char *path)
+{
+  char *s;
+  unsigned len;
+  int ok;
+
+  if(!hd_data->scan_scope) return 1;
+  if(!path || !*path) return 0;
+
+  s = hd_sysfs_real_id(path);
+  len = strlen(hd_data->scan_scope);
+  ok = !strncmp(s, hd_data->scan_scope, len) && (s[len] == 0 || s[len] == '/' || len == 1);
+  free_mem(s);
+
+  return ok;
+}
+
+
+/*
+ * Check if entry is in the rescan scope (cf. hd_rescan_sysfs_path()).
+ *
+ * Entries whose sysfs device is gone are always in scope: they must be
+ * dropped, whatever path the (remove) event had.
+ */
+int entry_in_scope(hd_data_t *hd_data, hd_t *hd)
+{
+  char *s = NULL, *id;
+  int gone = 0;
+
+  if(!hd_data->scan_scope) return 1;
+
+  if(
+    hd_sysfs_in_scope(hd_data, hd->sysfs_path) ||
+    hd_sysfs_in_scope(hd_data, hd->sysfs_id) ||
+    hd_sysfs_in_scope(hd_data, hd->sysfs_device_link)
+  ) return 1;
+
+  if((id = hd->sysfs_path ?: hd->sysfs_id)) {
+    str_printf(&s, 0, "/sys%s", id);
+    gone = access(s, F_OK) && errno == ENOENT;
+    free_mem(s);
+  }
+
+  return gone;
+}
+
+
 /*
  * Convert '!' to '/'.
  */
@@ -6007,8 +7973,9 @@ char *hd_sysfs_name2_dev(char *str)
 
   if(!str) return NULL;
 
-  free_mem(s);
-  s = str = new_str(str);
+  /* not new_str(): static data must outlive any arena */
+  str_printf(&s, 0, "%s", str);
+  str = s;
 
   while(*str) {
     if(*str == '!') *str = '/';
@@ -6028,8 +7995,9 @@ char *hd_sysfs_dev2_name(char *str)
 
   if(!str) return NULL;
 
-  free_mem(s);
-  s = str = new_str(str);
+  /* not new_str(): static data must outlive any arena */
+  str_printf(&s, 0, "%s", str);
+  str = s;
 
   while(*str) {
     if(*str == '/') *str = '!';
@@ -6062,45 +8030,319 @@ char *get_sysfs_attr_by_path(const char *path, const char *attr)
 }  
 
 
+/* per thread; threads drop it when they end, cf. sysfs_shim_cleanup() */
+static __thread hd_sysfs_dir_t sysfs_shim_dir = { fd: -1 };
+
 /*
  * binary data version; return data length, too
+ *
+ * Note: kept for compatibility; it is a wrapper around hd_sysfs_attr() that
+ * keeps the directory of the last path open.
  */
 char *get_sysfs_attr_by_path2(const char *path, const char *attr, unsigned *len)
 {
-  static char *buf = NULL;
-  char * ptr;
-  int i, fd, max;
+  hd_sysfs_dir_t *dir = &sysfs_shim_dir;
+
+  if(len) *len = 0;
+
+  if(!path) return NULL;
+
+  if(!dir->path || strcmp(dir->path, path)) {
+    if(dir->fd >= 0) close(dir->fd);
+    free_mem(dir->path);
+    dir->path = new_str(path);
+    dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+
+  return hd_sysfs_attr(dir, attr, len);
+}
+
+
+/*
+ * Drop the directory cached by get_sysfs_attr_by_path2().
+ *
+ * Called at the start and at the end of each scan, so no directory fd is
+ * kept open in between.
+ *
+ * Note: drops the read buffer, too - it may belong to an arena.
+ */
+static void sysfs_shim_done()
+{
+  hd_sysfs_dir_t *dir = &sysfs_shim_dir;
+
+  if(dir->fd >= 0) close(dir->fd);
+  dir->fd = -1;
+  dir->path = free_mem(dir->path);
+  dir->buf = free_mem(dir->buf);
+  dir->old_buf = free_str_list(dir->old_buf);
+  dir->buf_size = 0;
+}
+
+
+/*
+ * Thread cleanup handler for sysfs_shim_done().
+ */
+static void sysfs_shim_cleanup(void *arg)
+{
+  sysfs_shim_done();
+}
+
+
+/*
+ * Open sysfs directory 'path' for attribute lookups.
+ *
+ * Attributes are then opened relative to the directory fd (no path
+ * walk per attribute). If 'path' can't be opened as directory, attribute
+ * lookups fall back to absolute paths.
+ */
+hd_sysfs_dir_t *hd_sysfs_open(const char *path)
+{
+  hd_sysfs_dir_t *dir;
+
+  if(!path) return NULL;
+
+  dir = new_mem(sizeof *dir);
+  dir->path = new_str(path);
+  dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  return dir;
+}
+
+
+hd_sysfs_dir_t *hd_sysfs_close(hd_sysfs_dir_t *dir)
+{
+  hd_sysfs_attr_t *attr, *next;
+
+  if(!dir) return NULL;
+
+  if(dir->fd >= 0) close(dir->fd);
+
+  for(attr = dir->attr; attr; attr = next) {
+    next = attr->next;
+    free_mem(attr->name);
+    free_mem(attr->value);
+    free_mem(attr);
+  }
+
+  free_mem(dir->path);
+  free_mem(dir->buf);
+  free_str_list(dir->old_buf);
+
+  return free_mem(dir);
+}
+
+
+/*
+ * Open attribute 'attr' in sysfs directory 'dir'.
+ *
+ * 'attr' may be a relative path ("device/vendor").
+ */
+int hd_sysfs_openat(hd_sysfs_dir_t *dir, const char *attr, int flags)
+{
+  char *s = NULL;
+  int fd;
+
+  if(!dir || !attr) return -1;
+
+  if(dir->fd >= 0) return openat(dir->fd, attr, flags | O_CLOEXEC);
+
+  str_printf(&s, 0, "%s/%s", dir->path, attr);
+  fd = open(s, flags | O_CLOEXEC);
+  free_mem(s);
+
+  return fd;
+}
+
+
+/*
+ * Read file into dir->buf (at most MAX_ATTR_SIZE bytes) and close it.
+ *
+ * The buffer is not resized in place: a larger one replaces it and the old
+ * one is kept in dir->old_buf until the directory is closed, so pointers
+ * returned earlier stay valid.
+ */
+static char *sysfs_read_fd(hd_sysfs_dir_t *dir, int fd, unsigned *len)
+{
+  str_list_t *sl;
+  unsigned pos = 0;
+  int i;
+
+  if(!dir->buf) dir->buf = new_mem((dir->buf_size = 0x1000) + 1);
+
+  while(1) {
+    if(pos == dir->buf_size) {
+      if(dir->buf_size >= MAX_ATTR_SIZE) break;
+      dir->buf_size <<= 1;
+      if(dir->buf_size > MAX_ATTR_SIZE) dir->buf_size = MAX_ATTR_SIZE;
+      sl = new_mem(sizeof *sl);
+      sl->str = dir->buf;
+      sl->next = dir->old_buf;
+      dir->old_buf = sl;
+      dir->buf = new_mem(dir->buf_size + 1);
+      memcpy(dir->buf, sl->str, pos);
+    }
+    if((i = read(fd, dir->buf + pos, dir->buf_size - pos)) <= 0) break;
+    pos += i;
+  }
+
+  close(fd);
+
+  // even if there was some read error, accept partial data
+  if(!pos && i < 0) return NULL;
+
+  dir->buf[pos] = 0;
+  if(len) *len = pos;
+
+  return dir->buf;
+}
+
+
+/*
+ * Read sysfs attribute; return data length in 'len' (if not NULL).
+ *
+ * The returned buffer belongs to 'dir'; it is valid until 'dir' is closed
+ * but may be overwritten by the next call.
+ */
+char *hd_sysfs_attr(hd_sysfs_dir_t *dir, const char *attr, unsigned *len)
+{
+  hd_sysfs_attr_t *a;
+  int fd;
 
   if(len) *len = 0;
 
-  // init static buffer on first run
-  if(!buf) buf = new_mem(MAX_ATTR_SIZE + 1);
+  if(!dir || !attr) return NULL;
+
+  for(a = dir->attr; a; a = a->next) {
+    if(!strcmp(a->name, attr)) break;
+  }
+
+  if(a && !a->unread) {
+    // missing or unreadable
+    if(!a->value) return NULL;
+    if(len) *len = a->len;
+    return a->value;
+  }
+
+  // no such file
+  if(!a && dir->all && !strchr(attr, '/')) return NULL;
+
+  if((fd = hd_sysfs_openat(dir, attr, O_RDONLY)) < 0) return NULL;
+
+  return sysfs_read_fd(dir, fd, len);
+}
+
+
+/*
+ * Read the attributes in the NULL-terminated list 'attrs' and keep them.
+ *
+ * Subsequent hd_sysfs_attr() calls for them are answered from memory and
+ * the returned values stay valid until 'dir' is closed. Other attributes
+ * are read on demand.
+ *
+ * Return number of attributes read.
+ */
+int hd_sysfs_read_attrs(hd_sysfs_dir_t *dir, const char **attrs)
+{
+  hd_sysfs_attr_t *a;
+  char *s;
+  unsigned len;
+  int fd, cnt = 0;
+
+  if(!dir || !attrs) return 0;
+
+  for(; *attrs; attrs++) {
+    for(a = dir->attr; a; a = a->next) {
+      if(!strcmp(a->name, *attrs)) break;
+    }
+    if(a) continue;
+
+    a = new_mem(sizeof *a);
+    a->name = new_str(*attrs);
+    a->next = dir->attr;
+    dir->attr = a;
+
+    if(
+      (fd = hd_sysfs_openat(dir, *attrs, O_RDONLY)) >= 0 &&
+      (s = sysfs_read_fd(dir, fd, &len))
+    ) {
+      a->value = new_mem(len + 1);
+      memcpy(a->value, s, len);
+      a->len = len;
+      cnt++;
+    }
+  }
+
+  return cnt;
+}
+
+
+/*
+ * Read all world-readable regular files in 'dir' in a single pass.
+ *
+ * Subsequent hd_sysfs_attr() calls are answered from memory. Files that
+ * are not world-readable (e.g. 'vpd', 'rom') are not touched but remembered;
+ * they are read on demand.
+ *
+ * Return number of files read or -1 if 'dir' is not open.
+ */
+int hd_sysfs_read_all(hd_sysfs_dir_t *dir)
+{
+  DIR *d;
+  struct dirent *de;
+  struct stat sbuf;
+  hd_sysfs_attr_t *a;
+  char *s;
+  unsigned len;
+  int fd, cnt = 0;
+
+  if(!dir || dir->fd < 0 || dir->all) return -1;
 
-  if(!buf) return NULL;
+  if((fd = dup(dir->fd)) < 0) return -1;
 
-  sprintf(buf, "%s/%s", path, attr);
-  fd = open(buf, O_RDONLY);
-  if(fd >= 0) {
-    max = MAX_ATTR_SIZE;
-    ptr = buf;
-    while((i = read(fd, ptr, max)) > 0) max -= i, ptr += i;
+  if(!(d = fdopendir(fd))) {
     close(fd);
-    // even if there was some read error, accept partial data
-    if(ptr != buf) i = ptr - buf;
-    if(i >= 0) {
-      if(len) *len = i;
-      buf[i] = 0;
+    return -1;
+  }
+
+  rewinddir(d);
+
+  while((de = readdir(d))) {
+    if(de->d_type != DT_REG && de->d_type != DT_UNKNOWN) continue;
+    if(fstatat(dir->fd, de->d_name, &sbuf, AT_SYMLINK_NOFOLLOW)) continue;
+    if(!S_ISREG(sbuf.st_mode)) continue;
+
+    // already read by hd_sysfs_read_attrs()
+    for(a = dir->attr; a; a = a->next) {
+      if(!strcmp(a->name, de->d_name)) break;
+    }
+    if(a) continue;
+
+    a = new_mem(sizeof *a);
+    a->name = new_str(de->d_name);
+    a->next = dir->attr;
+    dir->attr = a;
+
+    if(
+      (sbuf.st_mode & S_IROTH) &&
+      (fd = openat(dir->fd, de->d_name, O_RDONLY | O_CLOEXEC)) >= 0 &&
+      (s = sysfs_read_fd(dir, fd, &len))
+    ) {
+      a->value = new_mem(len + 1);
+      memcpy(a->value, s, len);
+      a->len = len;
+      cnt++;
     }
     else {
-      return NULL;
+      a->unread = 1;
     }
   }
-  else {
-    return NULL;
-  }
 
-  return buf;
-}  
+  closedir(d);
+
+  dir->all = 1;
+
+  return cnt;
+}
 
 
 /*
@@ -56,6 +56,17 @@ extern "C" {
 #define HD_DEB_HDDB		(1 << 23)
 /** @} */
 
+/**
+ * Log levels.
+ * Messages below hd_data_t::log_level are dropped without being formatted.
+ * @see hd_data_t::log_level
+ */
+typedef enum log_level {
+  log_data,		/**< bulk data (hexdumps, raw tables); the default */
+  log_info,		/**< regular log messages */
+  log_none		/**< logging disabled */
+} hd_log_level_t;
+
 #include <stdio.h>
 #include <inttypes.h>
 #include <termios.h>
@@ -123,7 +134,8 @@ typedef enum probe_feature {
   pr_bios_fb, pr_bios_mode, pr_input, pr_block_mods, pr_bios_vesa,
   pr_cpuemu_debug, pr_scsi_noserial, pr_wlan, pr_bios_crc, pr_hal,
   pr_bios_vram, pr_bios_acpi, pr_bios_ddc_ports, pr_modules_pata,
-  pr_net_eeprom, pr_x86emu,
+  pr_net_eeprom, pr_x86emu, pr_modules_cache, pr_threads, pr_fork_threads,
+  pr_scan_cache, pr_arena,
   pr_max, pr_lxrc, pr_default, 
   pr_all		/**< pr_all must be last */
 } hd_probe_feature_t;
@@ -989,6 +1001,7 @@ typedef struct s_udevinfo_t {
   char *sysfs;
   char *name;
   str_list_t *links;
+  struct s_udevinfo_t *hash_next;	/**< (Internal) next entry in hash bucket */
 } hd_udevinfo_t;
 
 
@@ -1003,6 +1016,29 @@ typedef struct s_sysfsdrv_t {
 } hd_sysfsdrv_t;
 
 
+/**
+ * SCSI transport info of a device, as 'lsscsi -t' reports it: fc port
+ * name & id, sas address or iscsi target name.
+ */
+typedef struct {
+  unsigned host, channel, id, lun;	/**< H:C:T:L */
+  char type[8];			/**< "fc", "sas", "iscsi" */
+  char *address;		/**< sas address or iscsi target */
+  uint64_t wwpn;		/**< fc port name */
+  unsigned port_id;		/**< fc port id */
+} hd_scsi_transport_t;
+
+
+/**
+ * ACPI table (cf. hd_acpi_table())
+ */
+typedef struct {
+  char name[16];		/**< name in /sys/firmware/acpi/tables, e.g. "SSDT2" */
+  unsigned len;			/**< table size, including header */
+  unsigned char *data;		/**< table */
+} hd_acpi_table_t;
+
+
 /**
  * device number; type is either 0 or 'b' or 'c'.
  *
@@ -1480,6 +1516,7 @@ typedef struct {
   char *platform;		/**< x86: NULL */
   str_list_t *features;		/**< x86: flags */
   double bogo;			/**< bogo mips */
+  unsigned features_shared:1;	/**< (Internal) features belongs to hd_data_t::cpu_flags */
 } cpu_info_t;
 
 
@@ -1547,6 +1584,25 @@ typedef struct {
   char *strings;
 } hddb2_data_t;
 
+/**
+ * Hardware DB (v2) hash table
+ */
+typedef struct {
+  unsigned bits;		/**< hash size is 1 << bits */
+  unsigned *start;		/**< (1 << bits) + 1 offsets into entry */
+  unsigned *entry;		/**< hddb2_data_t::list indices, grouped by hash value, ascending */
+} hddb2_hash_t;
+
+/**
+ * Hardware DB (v2) search index
+ */
+typedef struct {
+  hddb2_hash_t device;		/**< entries with exact vendor & device id */
+  hddb2_hash_t vendor;		/**< entries with exact vendor id but no exact device id */
+  unsigned other_len;
+  unsigned *other;		/**< everything else (ranges, masks, non-vendor keys) */
+} hddb2_index_t;
+
 
 /**
  * module information type
@@ -1595,6 +1651,16 @@ typedef struct {
   };
 } modinfo_t;
 
+/**
+ * module.alias search index
+ */
+typedef struct {
+  hddb2_hash_t pci;		/**< mi_pci entries with vendor id, by vendor id */
+  hddb2_hash_t alias[3];	/**< mi_other entries, by fixed alias prefix */
+  unsigned other_len;
+  unsigned *other;		/**< everything else (wildcard prefixes) */
+} modinfo_index_t;
+
 
 /**
  * HAL device property types
@@ -1913,6 +1979,7 @@ typedef struct s_ser_device_t {
   char *serial, *class_name, *dev_id, *user_name, *vend, *init_string1, *init_string2, *pppd_option;
   unsigned pnp_rev;
   unsigned bits;
+  unsigned numeric_resp:1;	/**< ATV0 sent: numeric result codes */
 } ser_device_t;
 
 /**
@@ -2599,9 +2666,33 @@ typedef struct s_hd_t {
    */
   unsigned ref_cnt;		/**< (Internal) memory reference count. */
   struct s_hd_t *ref;		/**< (Internal) if set, this is only a reference. */
+
+  /**
+   * (Internal) Canonical sysfs path (below /devices) if \ref sysfs_id is a class link.
+   * Kept to recognize the entry after the device is gone, cf. hd_rescan_sysfs_path().
+   */
+  char *sysfs_path;
 } hd_t;
 
 
+/**
+ * (Internal) Lookup index for hd_data_t::hd.
+ *
+ * by_idx is kept up to date by add_hd_entry() & remove_tagged_hd_entries().
+ * The hash tables are a snapshot made by hd_index_build(); they are
+ * dropped as soon as the list changes.
+ */
+typedef struct {
+  unsigned by_idx_len;		/**< size of by_idx */
+  hd_t **by_idx;		/**< list entries, by hd_t::idx */
+  unsigned list_len;		/**< hash tables are valid if list != NULL */
+  hd_t **list;			/**< list entries, in list order */
+  hddb2_hash_t unique_id;	/**< list indices, by unique_id */
+  hddb2_hash_t sysfs_id;	/**< list indices, by sysfs_id */
+  hddb2_hash_t udi;		/**< list indices, by udi */
+} hd_index_t;
+
+
 /**
  * Holds all data accumulated during hardware probing.
  */
@@ -2665,6 +2756,8 @@ typedef struct {
     unsigned vbox:1;		/**< running in virtual box  */
     unsigned vmware:1;		/**< running in vmware  */
     unsigned vmware_mouse:1;	/**< has vmware mouse */
+    unsigned threads:1;		/**< run potentially hanging code in a thread, not a subprocess */
+    unsigned arena:1;		/**< allocate scan data from an arena, released by \ref hd_free_hd_data() or \ref hd_reset_scan() */
   } flags;
 
 
@@ -2734,11 +2827,40 @@ typedef struct {
   str_list_t *scanner_db;	/**< (Internal) list of scanner modules */
   edd_info_t edd[0x80];		/**< (Internal) enhanced disk drive data */
   hal_device_t *hal;		/**< (Internal) HAL data (if any) */
-  str_list_t *lsscsi;		/**< (Internal) lsscsi result (if any) */
+  str_list_t *lsscsi;		/**< (Internal) unused, always NULL */
   struct vm_s *vm;		/**< (Internal) x86emu vm */
   size_t log_size;		/**< (Internal) current log size (including final 0) */
   size_t log_max;		/**< (Internal) log buffer size */
   str_list_t *klog_raw;		/**< (Internal) unmodified kernel log */
+  hddb2_index_t *hddb2_index[2];	/**< (Internal) search index for hddb2 */
+  struct {
+    void *data;
+    size_t size;
+  } hddb2_map;			/**< (Internal) mmap'ed binary hddb2[0] (if any) */
+  modinfo_index_t *modinfo_index;	/**< (Internal) search index for modinfo */
+  struct {
+    void *data;
+    size_t size;
+  } modinfo_map;		/**< (Internal) mmap'ed modinfo cache (if any) */
+  hd_index_t hd_index;		/**< (Internal) lookup index for hd */
+  struct scan_step_s *scan_step;	/**< (Internal) probing step run by a worker thread */
+  char *scan_scope;		/**< (Internal) sysfs subtree a rescan is limited to, cf. hd_rescan_sysfs_path() */
+  hd_udevinfo_t **udevinfo_hash;	/**< (Internal) udevinfo by sysfs path, cf. hd_udevinfo() */
+  struct hd_cfgdb_batch_s *cfgdb_batch;	/**< (Internal) config changes not yet written, cf. hd_begin_config() */
+  struct hd_cpu_flags_s *cpu_flags;	/**< (Internal) x86 cpu feature lists, shared by identical cpus */
+  struct {
+    unsigned len;
+    hd_scsi_transport_t *list;
+  } scsi_transport;		/**< (Internal) SCSI transport info, sorted by H:C:T:L */
+  hd_log_level_t log_level;	/**< drop log messages below this level */
+  size_t log_ring;		/**< if set, keep only the most recent log messages within this size (ring buffer mode) */
+  size_t log_dropped;		/**< (Internal) log bytes dropped in ring buffer mode */
+  struct hd_arena_s *arena;	/**< (Internal) allocation arena, cf. flags.arena */
+  struct hd_sysfs_tree_s *sysfs_tree;	/**< (Internal) /sys/devices snapshot, cf. hd_sysfs_tree() */
+  struct {
+    unsigned len;
+    hd_acpi_table_t *list;
+  } acpi;			/**< (Internal) ACPI tables, sorted by name */
 } hd_data_t;
 
 
@@ -2754,8 +2876,16 @@ typedef struct {
 /** the actual hardware scan */
 void hd_scan(hd_data_t *hd_data);
 
+/** rescan a sysfs subtree (e.g. after a uevent) */
+hd_t *hd_rescan_sysfs_path(hd_data_t *hd_data, char *path);
+
 //! Free all data.
 hd_data_t *hd_free_hd_data(hd_data_t *hd_data);
+void hd_reset_scan(hd_data_t *hd_data);
+size_t hd_arena_size(hd_data_t *hd_data);
+
+//! Free entries left over from earlier scans (for long-running programs).
+void hd_free_old_entries(hd_data_t *hd_data);
 
 //! Free hardware items returned by e.g. \ref hd_list().
 hd_t *hd_free_hd_list(hd_t *hd);
@@ -2847,6 +2977,9 @@ int hd_manual_write_entry(hd_data_t *hd_data, hd_manual_t *entry);
 hd_manual_t *hd_free_manual(hd_manual_t *manual);
 hd_t *hd_read_config(hd_data_t *hd_data, const char *id);
 int hd_write_config(hd_data_t *hd_data, hd_t *hd);
+void hd_begin_config(hd_data_t *hd_data);
+int hd_commit_config(hd_data_t *hd_data);
+int hd_save_config(hd_data_t *hd_data);
 char *hd_hw_item_name(hd_hw_item_t item);
 hd_hw_item_t hd_hw_item_type(char *name);
 char *hd_status_value_name(hd_status_value_t status);
@@ -42,8 +42,7 @@
 #define PROG_MODPROBE		"/sbin/modprobe"
 #define PROG_RMMOD		"/sbin/rmmod"
 #define PROG_CARDCTL		"/sbin/cardctl"
-#define PROG_UDEVINFO		"/usr/bin/udevinfo"
-#define PROG_UDEVADM		"/sbin/udevadm"
+#define UDEV_DATA_DIR		"/run/udev/data"
 
 #define KLOG_BOOT		"/var/log/boot.msg"
 #define ISAPNP_CONF		"/etc/isapnp.conf"
@@ -63,7 +62,9 @@
 #define MAX_ATTR_SIZE		0x10000
 
 #define PROGRESS(a, b, c) progress(hd_data, a, b, c)
-#define ADD2LOG(a...) hd_log_printf(hd_data, a)
+#define LOG_ON(level) (hd_data->log_level <= (level))
+#define ADD2LOG(a...) (LOG_ON(log_info) ? hd_log_printf(hd_data, a) : (void) 0)
+#define ADD2LOG_DATA(a...) (LOG_ON(log_data) ? hd_log_printf(hd_data, a) : (void) 0)
 
 /*
  * define to make (hd_t).unique_id a hex string, otherwise it is a
@@ -83,6 +84,58 @@ enum mod_idx {
   mod_sysfs, mod_dsl, mod_block, mod_edd, mod_input, mod_wlan, mod_hal
 };
 
+typedef struct hd_arena_s hd_arena_t;
+
+/*
+ * Hash join of a hd list, cf. hd_join_build().
+ */
+typedef struct {
+  unsigned type;	/* join key, cf. hd_join_build() */
+  unsigned len;		/* number of entries */
+  hd_t **list;		/* list entries, in list order */
+  hddb2_hash_t hash;	/* list indices, by key */
+} hd_join_t;
+
+/*
+ * Feature list for a /proc/cpuinfo 'flags' line, cf. read_cpuinfo().
+ */
+typedef struct hd_cpu_flags_s {
+  struct hd_cpu_flags_s *next;
+  char *str;		/* 'flags' line */
+  str_list_t *features;	/* str, split */
+  unsigned units;	/* cf. cpu_info_t::units */
+} hd_cpu_flags_t;
+
+#define HD_JOIN_UNIQUE_ID	0	/* hd_t::unique_id */
+#define HD_JOIN_CMP_HD		1	/* everything cmp_hd() looks at */
+
+/*
+ * Directory entries, cf. hd_read_dir().
+ *
+ * Entries and names are a single memory block, free it with free_mem().
+ */
+typedef struct {
+  unsigned len;		/* number of entries */
+  struct {
+    char *name;
+    int type;		/* 'd', 'r', 'l' or 0 (something else) */
+  } entry[];
+} hd_dir_t;
+
+/*
+ * File contents with line index, cf. hd_read_file().
+ */
+typedef struct {
+  char *data;		/* file contents, 0-terminated */
+  size_t size;		/* file size */
+  unsigned mapped:1;	/* data is mmap()ed */
+  unsigned len;		/* number of lines */
+  struct {
+    unsigned ofs;	/* line start in data */
+    unsigned len;	/* line length, including '\n' (if any) */
+  } line[];
+} hd_file_t;
+
 void *new_mem(size_t size);
 void *resize_mem(void *, size_t);
 void *add_mem(void *, size_t, size_t);
@@ -96,6 +149,7 @@ hd_res_t *free_res_list(hd_res_t *res);
 hd_res_t *add_res_entry(hd_res_t **res, hd_res_t *new_res);
 hd_t *add_hd_entry(hd_data_t *hd_data, unsigned line, unsigned count);
 misc_t *free_misc(misc_t *m);
+hd_cpu_flags_t *free_cpu_flags(hd_cpu_flags_t *flags);
 scsi_t *free_scsi(scsi_t *scsi, int free_all);
 hd_detail_t *free_hd_detail(hd_detail_t *d);
 devtree_t *free_devtree(hd_data_t *hd_data);
@@ -120,6 +174,10 @@ str_list_t *free_str_list(str_list_t *list);
 str_list_t *reverse_str_list(str_list_t *list);
 str_list_t *read_file(char *file_name, unsigned start_line, unsigned lines);
 str_list_t *read_dir(char *dir_name, int type);
+hd_dir_t *hd_read_dir(char *dir_name, int type);
+hd_file_t *hd_read_file(char *file_name, int split);
+str_list_t *hd_file_str_list(hd_file_t *file, unsigned start_line, unsigned lines);
+hd_file_t *hd_free_file(hd_file_t *file);
 char *hd_read_sysfs_link(char *base_dir, char *link_name);
 void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg);
 
@@ -134,7 +192,7 @@ char *float2str(int i, int n);
 /* return the file name of a module */
 char *mod_name_by_idx(unsigned idx);
 
-int hd_timeout(void(*func)(void *), void *arg, int timeout);
+int hd_timeout(hd_data_t *hd_data, void(*func)(void *), void *arg, int timeout);
 
 str_list_t *read_kmods(hd_data_t *hd_data);
 char *get_cmd_param(hd_data_t *hd_data, int field);
@@ -159,7 +217,17 @@ str_list_t *get_cmdline(hd_data_t *hd_data, char *key);
 int detect_smp_bios(hd_data_t *hd_data);
 int detect_smp_prom(hd_data_t *hd_data);
 
+/*
+ * block 0 read request, cf. read_block0_list()
+ */
+typedef struct {
+  char *dev;			/* device name */
+  int timeout;			/* in: timeout (s); out: -1: open timed out, -2: read timed out */
+  unsigned char *block0;	/* out: 512 bytes or NULL */
+} hd_block0_t;
+
 unsigned char *read_block0(hd_data_t *hd_data, char *dev, int *timeout);
+void read_block0_list(hd_data_t *hd_data, hd_block0_t *list, unsigned len);
 
 void hd_copy(hd_t *dst, hd_t *src);
 
@@ -181,8 +249,11 @@ int is_pnpinfo(ser_device_t *mi, int ofs);
 
 int is_pcmcia_ctrl(hd_data_t *hd_data, hd_t *hd);
 
+typedef void (*hd_probe_func_t)(hd_data_t *hd_data, void *arg);
+
 void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout);
 void hd_fork_done(hd_data_t *hd_data);
+void hd_isolate(hd_data_t *hd_data, int timeout, int total_timeout, hd_probe_func_t func, void *arg);
 void hd_shm_init(hd_data_t *hd_data);
 void hd_shm_clean(hd_data_t *hd_data);
 void hd_shm_done(hd_data_t *hd_data);
@@ -190,13 +261,25 @@ void *hd_shm_add(hd_data_t *hd_data, void *ptr, unsigned len);
 int hd_is_shm_ptr(hd_data_t *hd_data, void *ptr);
 void hd_move_to_shm(hd_data_t *hd_data);
 
-void read_udevinfo(hd_data_t *hd_data);
+int hd_udevinfo_init(hd_data_t *hd_data);
+hd_udevinfo_t *hd_udevinfo(hd_data_t *hd_data, char *sysfs_id);
+hd_udevinfo_t *hd_udevinfo_by_name(hd_data_t *hd_data, char *dev_name);
 
 hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id);
 hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname);
+hd_t *hd_find_udi(hd_data_t *hd_data, char *udi);
+void hd_index_build(hd_data_t *hd_data);
+void hd_index_drop(hd_data_t *hd_data);
+unsigned hd_index_hash(char *str);
+void hd_join_build(hd_join_t *join, hd_t *hd, unsigned type);
+int hd_join_find(hd_join_t *join, hd_t *hd, int pos);
+int hd_join_find_id(hd_join_t *join, char *id, int pos);
+void hd_join_free(hd_join_t *join);
 int hd_attr_uint(char* attr, uint64_t* u, int base);
 str_list_t *hd_attr_list(char *str);
 char *hd_sysfs_id(char *path);
+char *hd_sysfs_real_id(char *path);
+int hd_sysfs_in_scope(hd_data_t *hd_data, char *path);
 char *hd_sysfs_name2_dev(char *str);
 char *hd_sysfs_dev2_name(char *str);
 void hd_sysfs_driver_list(hd_data_t *hd_data);
@@ -208,6 +291,63 @@ char* get_sysfs_attr(const char* bus, const char* device, const char* attr);
 char *get_sysfs_attr_by_path(const char *path, const char *attr);
 char *get_sysfs_attr_by_path2(const char *path, const char *attr, unsigned *len);
 
+/*
+ * sysfs device directory; attributes are read relative to the open
+ * directory (see hd_sysfs_open())
+ */
+typedef struct hd_sysfs_attr_s {
+  struct hd_sysfs_attr_s *next;
+  char *name;
+  char *value;		/* 0-terminated; NULL: missing or unreadable */
+  unsigned len;
+  unsigned unread:1;	/* not read by hd_sysfs_read_all(), read on demand */
+} hd_sysfs_attr_t;
+
+typedef struct {
+  int fd;		/* directory fd */
+  char *path;
+  char *buf;		/* attribute buffer, buf_size + 1 bytes */
+  unsigned buf_size;
+  str_list_t *old_buf;	/* buffers replaced by a larger one */
+  hd_sysfs_attr_t *attr;	/* attributes read by hd_sysfs_read_attrs() or hd_sysfs_read_all() */
+  unsigned all:1;	/* attr holds all regular files */
+} hd_sysfs_dir_t;
+
+/*
+ * Device in the sysfs tree snapshot (cf. hd_sysfs_tree()).
+ */
+typedef struct hd_sysfs_node_s {
+  struct hd_sysfs_node_s *next;		/* next node, in walk order */
+  struct hd_sysfs_node_s *parent;	/* next device further up (if any) */
+  struct hd_sysfs_node_s *path_next;	/* hash chain, by path */
+  struct hd_sysfs_node_s *name_next;	/* hash chain, by subsystem & name */
+  char *path;		/* canonical path, "/sys/devices/..." */
+  char *name;		/* last path element (bus id or class device name) */
+  char *subsystem;	/* canonical path of 'subsystem' link (bus or class) */
+  char *driver;		/* canonical path of 'driver' link (if any) */
+  char *module;		/* canonical path of driver module (if any) */
+  char *modalias;
+  char *device;		/* canonical path of 'device' link (if any) */
+  dev_t dev;		/* device number; 0: none */
+} hd_sysfs_node_t;
+
+typedef struct hd_sysfs_tree_s {
+  hd_sysfs_node_t *list;
+  hd_sysfs_node_t **last;	/* list end */
+  hd_sysfs_node_t **by_path;	/* hash_size entries */
+  hd_sysfs_node_t **by_name;	/* hash_size entries */
+  unsigned nodes;
+  unsigned hash_size;
+  unsigned shared:1;	/* used by a wave of scan steps, cf. hd_scan_wave() */
+} hd_sysfs_tree_t;
+
+hd_sysfs_dir_t *hd_sysfs_open(const char *path);
+hd_sysfs_dir_t *hd_sysfs_close(hd_sysfs_dir_t *dir);
+char *hd_sysfs_attr(hd_sysfs_dir_t *dir, const char *attr, unsigned *len);
+int hd_sysfs_read_attrs(hd_sysfs_dir_t *dir, const char **attrs);
+int hd_sysfs_read_all(hd_sysfs_dir_t *dir);
+int hd_sysfs_openat(hd_sysfs_dir_t *dir, const char *attr, int flags);
+
 void hd_pci_complete_data(hd_t *hd);
 void hd_pci_read_data(hd_data_t *hd_data);
 
@@ -228,6 +368,7 @@ hal_prop_t *hal_add_new(hal_prop_t **prop);
 
 char *hd_get_hddb_dir(void);
 char *hd_get_hddb_path(char *sub);
+void crc64(uint64_t *id, void *p, int len);
 
 int hd_mod_cmp(char *str1, char *str2);
 
@@ -5,7 +5,11 @@
 #include <string.h>
 #include <ctype.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/utsname.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "hd.h"
 #include "hd_int.h"
@@ -40,7 +44,6 @@ typedef struct line_s {
   prefix_t prefix;
   hddb_entry_t key;
   char *value;
-  char *raw;
 } line_t;
 
 typedef struct {
@@ -48,6 +51,42 @@ typedef struct {
   unsigned val[32];	/**< arbitrary (approx. max. number of modules/xf86 config lines) */
 } tmp_entry_t;
 
+/**
+ * Cached modules.alias, see read_modinfo_cache().
+ *
+ * Header, then 'entries' modinfo_cache_entry_t, then strings.
+ */
+#define MODINFO_CACHE_NAME	"modules.alias.cache"
+#define MODINFO_CACHE_MAGIC	0x6f6d6468	/* "hdmo" */
+#define MODINFO_CACHE_VERSION	1
+
+typedef struct {
+  unsigned magic;
+  unsigned version;
+  unsigned size;			/**< file size */
+  char kernel[64];			/**< kernel release */
+  uint64_t alias_size;			/**< modules.alias size & mtime */
+  uint64_t alias_mtime_sec;
+  uint64_t alias_mtime_nsec;
+  unsigned entries;
+  unsigned strings_ofs, strings_len;
+} modinfo_cache_header_t;
+
+typedef struct {
+  unsigned type;
+  unsigned module, alias;		/**< string offsets */
+  unsigned has;				/**< bit n: val[n] is valid */
+  unsigned val[7];			/**< pci: vendor, device, sub_vendor, sub_device, base_class, sub_class, prog_if */
+} modinfo_cache_entry_t;
+
+/**
+ * Walk several sorted lists of modinfo indices in parallel.
+ */
+typedef struct {
+  unsigned len;
+  unsigned *ent[4], *end[4];
+} modinfo_iter_t;
+
 /**
  * Hardware DB search struct.
  * @note except for driver, all strings are static and _must not_ be freed
@@ -75,10 +114,20 @@ typedef struct {
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 static void hddb_init_pci(hd_data_t *hd_data);
 static char *get_mi_field(char *str, char *tag, int field_len, unsigned *value, unsigned *has_value);
-static modinfo_t *parse_modinfo(str_list_t *file);
-static driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd, driver_info_t *drv_info);
+static modinfo_t *parse_modinfo(hd_file_t *file);
+static modinfo_t *read_modinfo_cache(hd_data_t *hd_data, char *kernel, struct stat *sbuf);
+static void write_modinfo_cache(hd_data_t *hd_data, modinfo_t *modinfo, char *kernel, struct stat *sbuf);
+static driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, modinfo_index_t *idx, hd_t *hd, driver_info_t *drv_info);
+static unsigned modinfo_prefix_hash(char *str, unsigned len);
+static modinfo_index_t *build_modinfo_index(modinfo_t *modinfo);
+static void modinfo_lookup(modinfo_index_t *idx, modinfo_t *match, modinfo_iter_t *it);
+static unsigned modinfo_next(modinfo_iter_t *it);
 static int cmp_dir_entry_s(const void *p0, const void *p1);
 static void hddb_init_external(hd_data_t *hd_data);
+static int hddb_is_newer(struct stat *sbuf, struct timespec *mtime);
+static int hddb_bin_is_current(struct timespec *bin_mtime);
+static int hddb_init_bin(hd_data_t *hd_data);
+static int hddb_bin_is_valid(hddb_bin_header_t *h, unsigned char *data);
 
 static line_t *parse_line(char *str);
 static unsigned store_string(hddb2_data_t *x, char *str);
@@ -90,7 +139,14 @@ static void add_value(tmp_entry_t *te, hddb_entry_t idx, unsigned val);
 static hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t idx, char *str);
 static int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, unsigned key);
 static void complete_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t key_mask, hddb_entry_mask_t mask, unsigned val_idx);
+static void hddb_search_entry(hddb2_data_t *hddb, hddb_search_t *hs, unsigned u);
 static int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions);
+static int hddb_exact_id(hddb2_data_t *hddb, hddb_entry_mask_t mask, unsigned key, hddb_entry_t id_ent, unsigned *id);
+static unsigned hddb_hash(unsigned vendor, unsigned device);
+static hddb2_index_t *hddb_build_index(hddb2_data_t *hddb);
+
+/* alias prefix lengths used for modinfo_index_t::alias */
+static unsigned modinfo_prefix_len[] = { 6, 10, 14 };
 #ifdef HDDB_TEST
 static void test_db(hd_data_t *hd_data);
 #endif
@@ -114,30 +170,41 @@ static char *module_cmd(hd_t *hd, char *cmd);
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 void hddb_init_pci(hd_data_t *hd_data)
 {
-  str_list_t *sl = NULL;
+  hd_file_t *file = NULL;
   char *s = NULL, *r;
   struct utsname ubuf;
+  struct stat sbuf;
+  int use_cache;
 
   if(!hd_data->modinfo) {
+    use_cache = hd_probe_feature(hd_data, pr_modules_cache);
+
     if(!uname(&ubuf)) {
       r = getenv("LIBHD_KERNELVERSION");
       if(!r || !*r) r = ubuf.release;
       str_printf(&s, 0, "/lib/modules/%s/modules.alias", r);
-      sl = read_file(s, 0, 0);
+      if(stat(s, &sbuf)) use_cache = 0;
+      if(use_cache) hd_data->modinfo = read_modinfo_cache(hd_data, r, &sbuf);
+      if(!hd_data->modinfo) file = hd_read_file(s, 1);
       s = free_mem(s);
     }
 
-    hd_data->modinfo = parse_modinfo(sl);
+    if(!hd_data->modinfo) {
+      hd_data->modinfo = parse_modinfo(file);
+      if(use_cache && file) write_modinfo_cache(hd_data, hd_data->modinfo, r, &sbuf);
+    }
 
-    sl = free_str_list(sl);
+    file = hd_free_file(file);
   }
 
+  if(!hd_data->modinfo_index) hd_data->modinfo_index = build_modinfo_index(hd_data->modinfo);
+
 #if 0
   // currently nothing
   if(!hd_data->modinfo_ext) {
-    sl = read_file("/WHATEVER", 0, 0);
-    hd_data->modinfo_ext = parse_modinfo(sl);
-    sl = free_str_list(sl);
+    file = hd_read_file("/WHATEVER", 1);
+    hd_data->modinfo_ext = parse_modinfo(file);
+    file = hd_free_file(file);
   }
 #endif
 }
@@ -168,22 +235,26 @@ char *get_mi_field(char *str, char *tag, int field_len, unsigned *value, unsigne
 }
 
 
-modinfo_t *parse_modinfo(str_list_t *file)
+/*
+ * Parse modules.alias; file must have been read with split lines.
+ */
+modinfo_t *parse_modinfo(hd_file_t *file)
 {
-  str_list_t *sl;
-  unsigned len;
+  unsigned len, line;
   modinfo_t *modinfo, *m;
   char *s;
   unsigned u;
   char alias[256], module[256];
 
   /* length + 1! */
-  for(len = 1, sl = file; sl; sl = sl->next) len++;
+  len = (file ? file->len : 0) + 1;
 
   modinfo = new_mem(len * sizeof *modinfo);
 
-  for(m = modinfo, sl = file; sl; sl = sl->next) {
-    if(sscanf(sl->str, "alias %255s %255s", alias, module) != 2) continue;
+  for(m = modinfo, line = 0; line < len - 1; line++) {
+    s = file->data + file->line[line].ofs;
+    if(strncmp(s, "alias", sizeof "alias" - 1)) continue;
+    if(sscanf(s, "alias %255s %255s", alias, module) != 2) continue;
 
     m->module = new_str(module);
     m->alias = new_str(alias);
@@ -254,6 +325,200 @@ modinfo_t *parse_modinfo(str_list_t *file)
 }
 
 
+/*
+ * Map cached modules.alias data written by write_modinfo_cache().
+ *
+ * The cache is valid only for kernel release 'kernel' and if modules.alias
+ * ('sbuf') has not changed. Strings point into the mapped file.
+ */
+modinfo_t *read_modinfo_cache(hd_data_t *hd_data, char *kernel, struct stat *sbuf)
+{
+  int fd;
+  struct stat cbuf;
+  unsigned char *data;
+  char *strings;
+  modinfo_cache_header_t *h;
+  modinfo_cache_entry_t *e;
+  modinfo_t *modinfo, *m;
+  unsigned u, size;
+
+  if((fd = open(hd_get_hddb_path(MODINFO_CACHE_NAME), O_RDONLY)) == -1) return NULL;
+
+  if(
+    fstat(fd, &cbuf) ||
+    !S_ISREG(cbuf.st_mode) ||
+    cbuf.st_size < (off_t) sizeof *h ||
+    cbuf.st_size > 0x7fffffff
+  ) {
+    close(fd);
+    return NULL;
+  }
+
+  size = cbuf.st_size;
+  data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(data == MAP_FAILED) return NULL;
+
+  h = (modinfo_cache_header_t *) data;
+
+  if(
+    h->magic != MODINFO_CACHE_MAGIC ||
+    h->version != MODINFO_CACHE_VERSION ||
+    h->size != size ||
+    strncmp(h->kernel, kernel, sizeof h->kernel) ||
+    h->alias_size != (uint64_t) sbuf->st_size ||
+    h->alias_mtime_sec != (uint64_t) sbuf->st_mtim.tv_sec ||
+    h->alias_mtime_nsec != (uint64_t) sbuf->st_mtim.tv_nsec ||
+    sizeof *h + (uint64_t) h->entries * sizeof *e > h->strings_ofs ||
+    h->strings_ofs + (uint64_t) h->strings_len != size ||
+    !h->strings_len ||
+    data[size - 1]
+  ) {
+    ADD2LOG("modinfo cache: outdated\n");
+    munmap(data, size);
+    return NULL;
+  }
+
+  e = (modinfo_cache_entry_t *) (data + sizeof *h);
+  strings = (char *) data + h->strings_ofs;
+
+  /* length + 1! */
+  modinfo = new_mem((h->entries + 1) * sizeof *modinfo);
+
+  for(u = 0, m = modinfo; u < h->entries; u++, e++, m++) {
+    if(
+      e->module >= h->strings_len ||
+      e->alias >= h->strings_len ||
+      (e->type != mi_pci && e->type != mi_other)
+    ) {
+      ADD2LOG("modinfo cache: invalid entry %u\n", u);
+      free_mem(modinfo);
+      munmap(data, size);
+      return NULL;
+    }
+
+    m->type = e->type;
+    m->module = strings + e->module;
+    m->alias = strings + e->alias;
+
+    if(m->type == mi_pci) {
+      m->pci.has.vendor = (e->has >> 0) & 1;
+      m->pci.has.device = (e->has >> 1) & 1;
+      m->pci.has.sub_vendor = (e->has >> 2) & 1;
+      m->pci.has.sub_device = (e->has >> 3) & 1;
+      m->pci.has.base_class = (e->has >> 4) & 1;
+      m->pci.has.sub_class = (e->has >> 5) & 1;
+      m->pci.has.prog_if = (e->has >> 6) & 1;
+      m->pci.vendor = e->val[0];
+      m->pci.device = e->val[1];
+      m->pci.sub_vendor = e->val[2];
+      m->pci.sub_device = e->val[3];
+      m->pci.base_class = e->val[4];
+      m->pci.sub_class = e->val[5];
+      m->pci.prog_if = e->val[6];
+    }
+  }
+
+  hd_data->modinfo_map.data = data;
+  hd_data->modinfo_map.size = size;
+
+  ADD2LOG("modinfo cache: %u entries\n", h->entries);
+
+  return modinfo;
+}
+
+
+/*
+ * Store parsed modules.alias for read_modinfo_cache().
+ *
+ * Failure to write it (e.g. read-only file system) is not an error.
+ */
+void write_modinfo_cache(hd_data_t *hd_data, modinfo_t *modinfo, char *kernel, struct stat *sbuf)
+{
+  modinfo_cache_header_t h = {};
+  modinfo_cache_entry_t *ent, *e;
+  modinfo_t *m;
+  char *strings = NULL, *tmp = NULL;
+  unsigned len, strings_max = 0;
+  int fd, ok;
+
+  if(!modinfo || strlen(kernel) >= sizeof h.kernel) return;
+
+  for(h.entries = 0; modinfo[h.entries].type; h.entries++);
+
+  ent = new_mem((h.entries + 1) * sizeof *ent);
+
+  h.strings_len = 1;
+  for(m = modinfo, e = ent; m->type; m++, e++) {
+    len = strlen(m->module) + strlen(m->alias) + 2;
+    if(h.strings_len + len > strings_max) {
+      strings_max = h.strings_len + len + 0x10000;
+      strings = resize_mem(strings, strings_max);
+    }
+
+    e->type = m->type;
+    strcpy(strings + (e->module = h.strings_len), m->module);
+    h.strings_len += strlen(m->module) + 1;
+    strcpy(strings + (e->alias = h.strings_len), m->alias);
+    h.strings_len += strlen(m->alias) + 1;
+
+    if(m->type == mi_pci) {
+      e->has =
+        (m->pci.has.vendor << 0) +
+        (m->pci.has.device << 1) +
+        (m->pci.has.sub_vendor << 2) +
+        (m->pci.has.sub_device << 3) +
+        (m->pci.has.base_class << 4) +
+        (m->pci.has.sub_class << 5) +
+        (m->pci.has.prog_if << 6);
+      e->val[0] = m->pci.vendor;
+      e->val[1] = m->pci.device;
+      e->val[2] = m->pci.sub_vendor;
+      e->val[3] = m->pci.sub_device;
+      e->val[4] = m->pci.base_class;
+      e->val[5] = m->pci.sub_class;
+      e->val[6] = m->pci.prog_if;
+    }
+  }
+
+  /* offset 0: empty string */
+  if(!strings) strings = new_mem(1);
+  *strings = 0;
+
+  h.magic = MODINFO_CACHE_MAGIC;
+  h.version = MODINFO_CACHE_VERSION;
+  strcpy(h.kernel, kernel);
+  h.alias_size = sbuf->st_size;
+  h.alias_mtime_sec = sbuf->st_mtim.tv_sec;
+  h.alias_mtime_nsec = sbuf->st_mtim.tv_nsec;
+  h.strings_ofs = sizeof h + h.entries * sizeof *ent;
+  h.size = h.strings_ofs + h.strings_len;
+
+  /* write to temporary file & rename, there might be concurrent readers */
+  str_printf(&tmp, 0, "%s.XXXXXX", hd_get_hddb_path(MODINFO_CACHE_NAME));
+
+  if((fd = mkstemp(tmp)) != -1) {
+    ok =
+      fchmod(fd, 0644) == 0 &&
+      write(fd, &h, sizeof h) == sizeof h &&
+      write(fd, ent, h.entries * sizeof *ent) == (ssize_t) (h.entries * sizeof *ent) &&
+      write(fd, strings, h.strings_len) == (ssize_t) h.strings_len;
+    if(close(fd)) ok = 0;
+    if(ok && !rename(tmp, hd_get_hddb_path(MODINFO_CACHE_NAME))) {
+      ADD2LOG("modinfo cache: %u entries written\n", h.entries);
+    }
+    else {
+      unlink(tmp);
+    }
+  }
+
+  free_mem(tmp);
+  free_mem(strings);
+  free_mem(ent);
+}
+
+
 /**
  *  return prio, 0: no match 
  */
@@ -358,14 +623,165 @@ int match_modinfo(hd_data_t *hd_data, modinfo_t *db, modinfo_t *match)
 }
 
 
-driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd, driver_info_t *drv_info)
+/*
+ * Hash first 'len' chars of 'str'.
+ */
+unsigned modinfo_prefix_hash(char *str, unsigned len)
+{
+  unsigned h = 2166136261u;
+
+  while(len--) h = (h ^ (unsigned char) *str++) * 16777619;
+
+  return h;
+}
+
+
+/*
+ * Index module aliases.
+ *
+ * pci entries are grouped by vendor id, other entries by the part of the
+ * alias before the first wildcard. Entries that can't be sorted in either
+ * way end up in idx->other.
+ */
+modinfo_index_t *build_modinfo_index(modinfo_t *modinfo)
+{
+  modinfo_index_t *idx;
+  modinfo_t *m;
+  unsigned u, i, len, cnt, *ent[4], *hv[4], ent_len[4] = { };
+  int j;
+
+  idx = new_mem(sizeof *idx);
+
+  if(!modinfo) return idx;
+
+  for(cnt = 0; modinfo[cnt].type; cnt++);
+
+  for(i = 0; i < 4; i++) {
+    ent[i] = new_mem(cnt * sizeof **ent);
+    hv[i] = new_mem(cnt * sizeof **hv);
+  }
+  idx->other = new_mem(cnt * sizeof *idx->other);
+
+  for(u = 0; u < cnt; u++) {
+    m = modinfo + u;
+    i = -1;
+    if(m->type == mi_pci) {
+      if(m->pci.has.vendor) {
+        i = 0;
+        hv[i][ent_len[i]] = hddb_hash(m->pci.vendor, 0);
+      }
+    }
+    else if(m->alias) {
+      /* use the longest prefix without wildcards */
+      len = strcspn(m->alias, "*?[\\");
+      for(j = sizeof modinfo_prefix_len / sizeof *modinfo_prefix_len - 1; j >= 0; j--) {
+        if(len >= modinfo_prefix_len[j]) {
+          i = j + 1;
+          hv[i][ent_len[i]] = modinfo_prefix_hash(m->alias, modinfo_prefix_len[j]);
+          break;
+        }
+      }
+    }
+    if(i == -1u) {
+      idx->other[idx->other_len++] = u;
+    }
+    else {
+      ent[i][ent_len[i]++] = u;
+    }
+  }
+
+  hddb_build_hash(&idx->pci, ent_len[0], ent[0], hv[0]);
+  for(i = 1; i < 4; i++) {
+    hddb_build_hash(&idx->alias[i - 1], ent_len[i], ent[i], hv[i]);
+  }
+
+  for(i = 0; i < 4; i++) {
+    free_mem(ent[i]);
+    free_mem(hv[i]);
+  }
+
+  return idx;
+}
+
+
+modinfo_index_t *hddb_free_modinfo_index(modinfo_index_t *idx)
+{
+  unsigned u;
+
+  if(!idx) return NULL;
+
+  free_mem(idx->pci.start);
+  free_mem(idx->pci.entry);
+  for(u = 0; u < sizeof idx->alias / sizeof *idx->alias; u++) {
+    free_mem(idx->alias[u].start);
+    free_mem(idx->alias[u].entry);
+  }
+  free_mem(idx->other);
+
+  return free_mem(idx);
+}
+
+
+/*
+ * Set up 'it' to walk all entries that could possibly match.
+ */
+void modinfo_lookup(modinfo_index_t *idx, modinfo_t *match, modinfo_iter_t *it)
+{
+  unsigned u, len;
+
+  it->len = 0;
+
+  if(match->type == mi_pci) {
+    if(match->pci.has.vendor) {
+      it->ent[it->len] = hddb_bucket(&idx->pci, hddb_hash(match->pci.vendor, 0), &it->end[it->len]);
+      it->len++;
+    }
+  }
+  else if(match->alias) {
+    len = strlen(match->alias);
+    for(u = 0; u < sizeof modinfo_prefix_len / sizeof *modinfo_prefix_len; u++) {
+      if(len < modinfo_prefix_len[u]) break;
+      it->ent[it->len] = hddb_bucket(&idx->alias[u], modinfo_prefix_hash(match->alias, modinfo_prefix_len[u]), &it->end[it->len]);
+      it->len++;
+    }
+  }
+
+  it->ent[it->len] = idx->other;
+  it->end[it->len] = idx->other + idx->other_len;
+  it->len++;
+}
+
+
+/*
+ * Next entry, in modinfo order (-1u: no more entries).
+ */
+unsigned modinfo_next(modinfo_iter_t *it)
+{
+  unsigned u, i, min = -1u;
+
+  for(u = 0; u < it->len; u++) {
+    if(it->ent[u] < it->end[u] && *it->ent[u] < min) {
+      min = *it->ent[u];
+      i = u;
+    }
+  }
+
+  if(min != -1u) it->ent[i]++;
+
+  return min;
+}
+
+
+driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, modinfo_index_t *idx, hd_t *hd, driver_info_t *drv_info)
 {
   driver_info_t **di = NULL, *di2;
   pci_t *pci;
   char *mod_list[16 /* arbitrary, > 0 */];
   int mod_prio[sizeof mod_list / sizeof *mod_list];
   int i, prio, mod_list_len;
-  modinfo_t match = { };
+  modinfo_t match = { }, *m;
+  modinfo_iter_t it = { };
+  unsigned u;
 
   if(!modinfo_db) return drv_info;
 
@@ -415,8 +831,18 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
     }
   }
 
-  for(mod_list_len = 0; modinfo_db->type; modinfo_db++) {
-    if((prio = match_modinfo(hd_data, modinfo_db, &match))) {
+  /* with an index, look only at entries that can match; the order stays the same */
+  if(idx) modinfo_lookup(idx, &match, &it);
+
+  for(mod_list_len = 0, m = modinfo_db; ; m++) {
+    if(idx) {
+      if((u = modinfo_next(&it)) == -1u) break;
+      m = modinfo_db + u;
+    }
+
+    if(!m->type) break;
+
+    if((prio = match_modinfo(hd_data, m, &match))) {
       for(di2 = drv_info; di2; di2 = di2->next) {
         if(
           di2->any.type == di_module &&
@@ -424,12 +850,12 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
           (
             (
               di2->any.hddb0->str &&
-              !hd_mod_cmp(di2->any.hddb0->str, modinfo_db->module)
+              !hd_mod_cmp(di2->any.hddb0->str, m->module)
             ) ||
             (
               di2->any.hddb0->next &&
               di2->any.hddb0->next->str &&
-              !hd_mod_cmp(di2->any.hddb0->next->str, modinfo_db->module)
+              !hd_mod_cmp(di2->any.hddb0->next->str, m->module)
             )
           )
         ) break;
@@ -438,7 +864,7 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
       if(di2) continue;
 
       for(i = 0; i < mod_list_len; i++) {
-        if(!strcmp(mod_list[i], modinfo_db->module)) {
+        if(!strcmp(mod_list[i], m->module)) {
           if(prio > mod_prio[i]) mod_prio[i] = prio;
           break;
         }
@@ -447,7 +873,7 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
       if(i < mod_list_len) continue;
 
       mod_prio[mod_list_len] = prio;
-      mod_list[mod_list_len++] = modinfo_db->module;
+      mod_list[mod_list_len++] = m->module;
 
       if(mod_list_len >= sizeof mod_list / sizeof *mod_list) break;
     }
@@ -489,6 +915,8 @@ int cmp_dir_entry_s(const void *p0, const void *p1)
 
 void hddb_init(hd_data_t *hd_data)
 {
+  unsigned u;
+
   hddb_init_pci(hd_data);
   hddb_init_external(hd_data);
 
@@ -496,6 +924,12 @@ void hddb_init(hd_data_t *hd_data)
   hd_data->hddb2[1] = &hddb_internal;
 #endif
 
+  for(u = 0; u < sizeof hd_data->hddb2 / sizeof *hd_data->hddb2; u++) {
+    if(hd_data->hddb2[u] && !hd_data->hddb2_index[u]) {
+      hd_data->hddb2_index[u] = hddb_build_index(hd_data->hddb2[u]);
+    }
+  }
+
 #ifdef HDDB_TEST
   test_db(hd_data);
 #endif
@@ -504,10 +938,12 @@ void hddb_init(hd_data_t *hd_data)
 
 void hddb_init_external(hd_data_t *hd_data)
 {
-  str_list_t *sl, *sl0, *sl1, *sl2, *id_dir;
+  str_list_t *sl, *id_dir;
+  hd_file_t **id_file = NULL, *file;
+  char **id_line = NULL;
   line_t *l;
   unsigned l_start, l_end /* end points _past_ last element */;
-  unsigned u, ent, l_nr = 1;
+  unsigned u, ent, l_nr = 1, id_files = 0, lines = 0, line;
   tmp_entry_t tmp_entry[he_nomask /* _must_ be he_nomask! */];
   hddb_entry_mask_t entry_mask = 0;
   int state;
@@ -517,11 +953,15 @@ void hddb_init_external(hd_data_t *hd_data)
 
   if(hd_data->hddb2[0]) return;
 
-  hddb2 = hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
+  if(hddb_init_bin(hd_data)) return;
 
-  sl0 = read_file(hd_get_hddb_path("hd.ids"), 0, 0);
+  hddb2 = hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
 
-  if(sl0) ADD2LOG("id file: hd.ids\n");
+  if((file = hd_read_file(hd_get_hddb_path("hd.ids"), 1))) {
+    ADD2LOG("id file: hd.ids\n");
+    id_file = add_mem(id_file, sizeof *id_file, id_files);
+    id_file[id_files++] = file;
+  }
 
   id_dir = read_dir(hd_get_hddb_path("ids"), 0);
 
@@ -531,21 +971,31 @@ void hddb_init_external(hd_data_t *hd_data)
     for(sl = id_dir; sl; sl = sl->next) {
       asprintf(&s, "ids/%s", sl->str);
       ADD2LOG("id file: %s\n", s);
-      sl1 = sl2 = read_file(hd_get_hddb_path(s), 0, 0);
+      file = hd_read_file(hd_get_hddb_path(s), 1);
       free(s);
-      if(sl1) {
-        while(sl1->next) sl1 = sl1->next;
-        sl1->next = sl0;
-        sl0 = sl2;
+      if(file) {
+        id_file = add_mem(id_file, sizeof *id_file, id_files);
+        id_file[id_files++] = file;
       }
     }
+
+    free_str_list(id_dir);
+  }
+
+  /* all lines, last id file first */
+  for(u = 0; u < id_files; u++) lines += id_file[u]->len;
+  id_line = new_mem(lines * sizeof *id_line);
+  for(line = 0, u = id_files; u-- > 0;) {
+    for(ent = 0; ent < id_file[u]->len; ent++) {
+      id_line[line++] = id_file[u]->data + id_file[u]->line[ent].ofs;
+    }
   }
 
   l_start = l_end = 0;
   state = 0;
 
-  for(sl = sl0; sl; sl = sl->next, l_nr++) {
-    l = parse_line(sl->str);
+  for(line = 0; line < lines; line++, l_nr++) {
+    l = parse_line(id_line[line]);
     if(!l) {
       ADD2LOG("id line %d: invalid line\n", l_nr);
       state = 4;
@@ -658,13 +1108,14 @@ void hddb_init_external(hd_data_t *hd_data)
 
     if(state == 4) {	/* error */
       state = 0;
+      /* note: parse_line() has cut the current line into pieces */
       u = 10;	/* log max 10 lines context */
-      while(sl->next && *sl->str != '\n') {
+      while(line + 1 < lines && *id_line[line]) {
         if(u) {
-          ADD2LOG("  %s", sl->str);
+          ADD2LOG("  %s\n", id_line[line]);
           u--;
         }
-        sl = sl->next;
+        line++;
       }
     }
   }
@@ -684,7 +1135,9 @@ void hddb_init_external(hd_data_t *hd_data)
     }
   }
 
-  sl0 = free_str_list(sl0);
+  for(u = 0; u < id_files; u++) hd_free_file(id_file[u]);
+  free_mem(id_file);
+  free_mem(id_line);
 
   if(state == 4) {
     /* there was an error */
@@ -697,15 +1150,165 @@ void hddb_init_external(hd_data_t *hd_data)
 }
 
 
+int hddb_is_newer(struct stat *sbuf, struct timespec *mtime)
+{
+  return
+    sbuf->st_mtim.tv_sec > mtime->tv_sec ||
+    (sbuf->st_mtim.tv_sec == mtime->tv_sec && sbuf->st_mtim.tv_nsec > mtime->tv_nsec);
+}
+
+
+/*
+ * Check that the binary data base is newer than hd.ids and the files in ids/.
+ */
+int hddb_bin_is_current(struct timespec *bin_mtime)
+{
+  struct stat sbuf;
+  str_list_t *sl, *id_dir;
+  char *s;
+  int ok = 1;
+
+  if(!stat(hd_get_hddb_path("hd.ids"), &sbuf) && hddb_is_newer(&sbuf, bin_mtime)) return 0;
+
+  /* catches removed files, too */
+  if(!stat(hd_get_hddb_path("ids"), &sbuf) && hddb_is_newer(&sbuf, bin_mtime)) return 0;
+
+  id_dir = read_dir(hd_get_hddb_path("ids"), 0);
+
+  for(sl = id_dir; sl && ok; sl = sl->next) {
+    asprintf(&s, "ids/%s", sl->str);
+    if(!stat(hd_get_hddb_path(s), &sbuf) && hddb_is_newer(&sbuf, bin_mtime)) ok = 0;
+    free(s);
+  }
+
+  free_str_list(id_dir);
+
+  return ok;
+}
+
+
+/*
+ * Map the precompiled data base (see 'check_hd --bin') instead of parsing
+ * hd.ids and the files in ids/.
+ *
+ * return 1 if ok, 0 to fall back to the text files
+ */
+int hddb_init_bin(hd_data_t *hd_data)
+{
+  int fd;
+  struct stat sbuf;
+  unsigned char *data;
+  hddb_bin_header_t *h;
+  hddb2_data_t *hddb2;
+  uint64_t size;
+
+  if((fd = open(hd_get_hddb_path("hd.ids.bin"), O_RDONLY)) == -1) return 0;
+
+  if(
+    fstat(fd, &sbuf) ||
+    !S_ISREG(sbuf.st_mode) ||
+    sbuf.st_size < (off_t) sizeof *h ||
+    sbuf.st_size > 0x7fffffff
+  ) {
+    close(fd);
+    return 0;
+  }
+
+  if(!hddb_bin_is_current(&sbuf.st_mtim)) {
+    ADD2LOG("id file: hd.ids.bin is outdated\n");
+    close(fd);
+    return 0;
+  }
+
+  size = sbuf.st_size;
+  data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(data == MAP_FAILED) return 0;
+
+  h = (hddb_bin_header_t *) data;
+
+  if(
+    h->magic != HDDB_BIN_MAGIC ||
+    h->version != HDDB_BIN_VERSION ||
+    h->size != size ||
+    (h->list_ofs | h->ids_ofs) & 3 ||
+    h->list_ofs + (uint64_t) h->list_len * sizeof (hddb_list_t) > size ||
+    h->ids_ofs + (uint64_t) h->ids_len * sizeof (unsigned) > size ||
+    h->strings_ofs + (uint64_t) h->strings_len > size ||
+    (h->strings_len && data[h->strings_ofs + h->strings_len - 1]) ||
+    !hddb_bin_is_valid(h, data)
+  ) {
+    ADD2LOG("id file: hd.ids.bin: invalid format\n");
+    munmap(data, size);
+    return 0;
+  }
+
+  hddb2 = hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
+
+  hddb2->list_len = hddb2->list_max = h->list_len;
+  hddb2->list = (hddb_list_t *) (data + h->list_ofs);
+  hddb2->ids_len = hddb2->ids_max = h->ids_len;
+  hddb2->ids = (unsigned *) (data + h->ids_ofs);
+  hddb2->strings_len = hddb2->strings_max = h->strings_len;
+  hddb2->strings = (char *) (data + h->strings_ofs);
+
+  hd_data->hddb2_map.data = data;
+  hd_data->hddb2_map.size = size;
+
+  ADD2LOG("id file: hd.ids.bin (%u entries)\n", hddb2->list_len);
+
+  return 1;
+}
+
+
+/*
+ * Check that all offsets in the mapped data base stay inside it: the list
+ * entries' key & value chains must be in ids[], string offsets in strings[].
+ */
+int hddb_bin_is_valid(hddb_bin_header_t *h, unsigned char *data)
+{
+  hddb_list_t *list = (hddb_list_t *) (data + h->list_ofs);
+  unsigned *ids = (unsigned *) (data + h->ids_ofs);
+  hddb_entry_mask_t mask;
+  unsigned u, v, ofs;
+
+  for(u = 0; u < h->ids_len; u++) {
+    if(
+      (DATA_FLAG(ids[u]) & ~FLAG_CONT) == FLAG_STRING &&
+      DATA_VALUE(ids[u]) >= h->strings_len
+    ) return 0;
+  }
+
+  for(u = 0; u < h->list_len; u++) {
+    for(v = 0; v < 2; v++) {
+      mask = v ? list[u].value_mask : list[u].key_mask;
+      ofs = v ? list[u].value : list[u].key;
+      /* one value per mask bit; FLAG_CONT values belong to the next one */
+      for(; mask; mask >>= 1) {
+        if(!(mask & 1)) continue;
+        do {
+          if(ofs >= h->ids_len) return 0;
+        } while(DATA_FLAG(ids[ofs++]) & FLAG_CONT);
+      }
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+ * Parse id file line.
+ *
+ * Note: 'str' is modified; the returned key & value point into it.
+ */
 line_t *parse_line(char *str)
 {
   static line_t l;
   char *s;
   int i;
 
-  free_mem(l.raw);
-  str = l.raw = new_str(str);
-
   /* drop leading spaces */
   while(isspace(*str)) str++;
 
@@ -1729,12 +2332,36 @@ void complete_ids(
   }
 }
 
+void hddb_search_entry(hddb2_data_t *hddb, hddb_search_t *hs, unsigned u)
+{
+  if(
+    (hs->key & hddb->list[u].key_mask) == hddb->list[u].key_mask
+    /* && (hs->value & hddb->list[u].value_mask) != hddb->list[u].value_mask */
+  ) {
+    if(!compare_ids(hddb, hs, hddb->list[u].key_mask, hddb->list[u].key)) {
+      complete_ids(hddb, hs,
+        hddb->list[u].key_mask,
+        hddb->list[u].value_mask, hddb->list[u].value
+      );
+    }
+  }
+}
+
+
+/*
+ * Walk the search list.
+ *
+ * If there is an index, only the entries that can possibly match are
+ * looked at. They are merged in list order, so the result is identical
+ * to a full scan.
+ */
 int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
 {
-  unsigned u;
-  int i;
+  unsigned u, vendor, device;
+  unsigned *dev, *dev_end, *ven, *ven_end, *other, *other_end;
   hddb2_data_t *hddb;
-  int db_idx;
+  hddb2_index_t *idx;
+  int db_idx, has_vendor, has_device;
   hddb_entry_mask_t all_values = 0;
 
   if(!hs) return 0;
@@ -1742,20 +2369,49 @@ int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
   if(!max_recursions) max_recursions = 2;
 
   while(max_recursions--) {
+    has_vendor = (hs->key & (1 << he_vendor_id)) ? 1 : 0;
+    has_device = has_vendor && (hs->key & (1 << he_device_id)) ? 1 : 0;
+
     for(db_idx = 0; (unsigned) db_idx < sizeof hd_data->hddb2 / sizeof *hd_data->hddb2; db_idx++) {
       if(!(hddb = hd_data->hddb2[db_idx])) continue;
 
-      for(u = 0; u < hddb->list_len; u++) {
-        if(
-          (hs->key & hddb->list[u].key_mask) == hddb->list[u].key_mask
-          /* && (hs->value & hddb->list[u].value_mask) != hddb->list[u].value_mask */
-        ) {
-          i = compare_ids(hddb, hs, hddb->list[u].key_mask, hddb->list[u].key);
-          if(!i) {
-            complete_ids(hddb, hs,
-              hddb->list[u].key_mask,
-              hddb->list[u].value_mask, hddb->list[u].value
-            );
+      if(!(idx = hd_data->hddb2_index[db_idx])) {
+        for(u = 0; u < hddb->list_len; u++) hddb_search_entry(hddb, hs, u);
+
+        continue;
+      }
+
+      dev = dev_end = ven = ven_end = NULL;
+      vendor = hs->vendor.id;
+      device = hs->device.id;
+      if(has_device) dev = hddb_bucket(&idx->device, hddb_hash(vendor, device), &dev_end);
+      if(has_vendor) ven = hddb_bucket(&idx->vendor, hddb_hash(vendor, 0), &ven_end);
+      other = idx->other;
+      other_end = other + idx->other_len;
+
+      for(;;) {
+        u = -1u;
+        if(dev < dev_end && *dev < u) u = *dev;
+        if(ven < ven_end && *ven < u) u = *ven;
+        if(other < other_end && *other < u) u = *other;
+
+        if(u == -1u) break;
+
+        if(dev < dev_end && *dev == u) dev++;
+        else if(ven < ven_end && *ven == u) ven++;
+        else other++;
+
+        hddb_search_entry(hddb, hs, u);
+
+        /* ids may have been updated; continue with the matching buckets */
+        if(vendor != hs->vendor.id || device != hs->device.id) {
+          vendor = hs->vendor.id;
+          device = hs->device.id;
+          if(has_device) {
+            for(dev = hddb_bucket(&idx->device, hddb_hash(vendor, device), &dev_end); dev < dev_end && *dev <= u; dev++);
+          }
+          if(has_vendor) {
+            for(ven = hddb_bucket(&idx->vendor, hddb_hash(vendor, 0), &ven_end); ven < ven_end && *ven <= u; ven++);
           }
         }
       }
@@ -1775,6 +2431,160 @@ int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
   return 1;
 }
 
+/*
+ * Get the value of 'id_ent' if it is part of the search key and is a
+ * plain id (no range or mask).
+ *
+ * return 1 if there is such an id
+ */
+int hddb_exact_id(hddb2_data_t *hddb, hddb_entry_mask_t mask, unsigned key, hddb_entry_t id_ent, unsigned *id)
+{
+  hddb_entry_t ent;
+  unsigned fl, *ids;
+
+  if(key >= hddb->ids_len || !(mask & (1 << id_ent))) return 0;
+
+  ids = hddb->ids + key;
+
+  for(ent = 0; ent < he_nomask && mask; ent++, mask >>= 1) {
+    if(!(mask & 1)) continue;
+
+    if(ent == id_ent) {
+      fl = DATA_FLAG(*ids);
+
+      /* see compare_ids() */
+      if(fl == (FLAG_CONT | FLAG_RANGE) || fl == (FLAG_CONT | FLAG_MASK)) return 0;
+      if((fl & ~FLAG_CONT) != FLAG_ID) return 0;
+
+      *id = DATA_VALUE(*ids);
+
+      return 1;
+    }
+
+    while((*ids & (1 << 31))) ids++;
+
+    ids++;
+  }
+
+  return 0;
+}
+
+
+unsigned hddb_hash(unsigned vendor, unsigned device)
+{
+  unsigned h;
+
+  h = vendor * 0x9e3779b1 ^ device * 0x85ebca77;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6d;
+  h ^= h >> 12;
+
+  return h;
+}
+
+
+/*
+ * Sort entries into hash buckets.
+ *
+ * 'ent' must be in ascending order; each bucket will then be, too.
+ */
+void hddb_build_hash(hddb2_hash_t *hash, unsigned len, unsigned *ent, unsigned *hv)
+{
+  unsigned u, size, mask, *pos;
+
+  for(hash->bits = 4; (1u << hash->bits) < len; hash->bits++);
+
+  size = 1 << hash->bits;
+  mask = size - 1;
+
+  hash->start = new_mem((size + 1) * sizeof *hash->start);
+  hash->entry = new_mem(len * sizeof *hash->entry);
+
+  for(u = 0; u < len; u++) hash->start[(hv[u] & mask) + 1]++;
+  for(u = 0; u < size; u++) hash->start[u + 1] += hash->start[u];
+
+  pos = new_mem(size * sizeof *pos);
+  memcpy(pos, hash->start, size * sizeof *pos);
+
+  for(u = 0; u < len; u++) hash->entry[pos[hv[u] & mask]++] = ent[u];
+
+  free_mem(pos);
+}
+
+
+/*
+ * Index search list by vendor & device id.
+ *
+ * Entries with range/mask ids or without vendor id go into idx->other.
+ */
+hddb2_index_t *hddb_build_index(hddb2_data_t *hddb)
+{
+  hddb2_index_t *idx;
+  hddb_list_t *list;
+  unsigned u, vendor, device, dev_len, ven_len;
+  unsigned *dev_ent, *dev_hv, *ven_ent, *ven_hv;
+
+  idx = new_mem(sizeof *idx);
+
+  dev_ent = new_mem(hddb->list_len * sizeof *dev_ent);
+  dev_hv = new_mem(hddb->list_len * sizeof *dev_hv);
+  ven_ent = new_mem(hddb->list_len * sizeof *ven_ent);
+  ven_hv = new_mem(hddb->list_len * sizeof *ven_hv);
+  idx->other = new_mem(hddb->list_len * sizeof *idx->other);
+
+  for(dev_len = ven_len = u = 0; u < hddb->list_len; u++) {
+    list = hddb->list + u;
+    if(hddb_exact_id(hddb, list->key_mask, list->key, he_vendor_id, &vendor)) {
+      if(hddb_exact_id(hddb, list->key_mask, list->key, he_device_id, &device)) {
+        dev_hv[dev_len] = hddb_hash(vendor, device);
+        dev_ent[dev_len++] = u;
+      }
+      else {
+        ven_hv[ven_len] = hddb_hash(vendor, 0);
+        ven_ent[ven_len++] = u;
+      }
+    }
+    else {
+      idx->other[idx->other_len++] = u;
+    }
+  }
+
+  hddb_build_hash(&idx->device, dev_len, dev_ent, dev_hv);
+  hddb_build_hash(&idx->vendor, ven_len, ven_ent, ven_hv);
+
+  free_mem(dev_ent);
+  free_mem(dev_hv);
+  free_mem(ven_ent);
+  free_mem(ven_hv);
+
+  return idx;
+}
+
+
+unsigned *hddb_bucket(hddb2_hash_t *hash, unsigned hv, unsigned **end)
+{
+  hv &= (1 << hash->bits) - 1;
+
+  *end = hash->entry + hash->start[hv + 1];
+
+  return hash->entry + hash->start[hv];
+}
+
+
+hddb2_index_t *hddb_free_index(hddb2_index_t *idx)
+{
+  if(!idx) return NULL;
+
+  free_mem(idx->device.start);
+  free_mem(idx->device.entry);
+  free_mem(idx->vendor.start);
+  free_mem(idx->vendor.entry);
+  free_mem(idx->other);
+
+  return free_mem(idx);
+}
+
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 #ifdef HDDB_TEST
 void test_db(hd_data_t *hd_data)
@@ -2085,7 +2895,7 @@ void hddb_add_info(hd_data_t *hd_data, hd_t *hd)
 #endif
 
   if(!new_driver_info) {
-    new_driver_info = hd_modinfo_db(hd_data, hd_data->modinfo_ext, hd, new_driver_info);
+    new_driver_info = hd_modinfo_db(hd_data, hd_data->modinfo_ext, NULL, hd, new_driver_info);
   }
 
 #if 1
@@ -2138,7 +2948,7 @@ void hddb_add_info(hd_data_t *hd_data, hd_t *hd)
     new_driver_info = monitor_driver(hd_data, hd);
   }
 
-  new_driver_info = hd_modinfo_db(hd_data, hd_data->modinfo, hd, new_driver_info);
+  new_driver_info = hd_modinfo_db(hd_data, hd_data->modinfo, hd_data->modinfo_index, hd, new_driver_info);
 
   if(new_driver_info) {
     if(!hd->ref) {
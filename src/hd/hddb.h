@@ -1,4 +1,8 @@
 void hddb_init(hd_data_t *hd_data);
+hddb2_index_t *hddb_free_index(hddb2_index_t *idx);
+modinfo_index_t *hddb_free_modinfo_index(modinfo_index_t *idx);
+void hddb_build_hash(hddb2_hash_t *hash, unsigned len, unsigned *ent, unsigned *hv);
+unsigned *hddb_bucket(hddb2_hash_t *hash, unsigned hv, unsigned **end);
 
 unsigned device_class(hd_data_t *hd_data, unsigned vendor, unsigned device);
 unsigned sub_device_class(hd_data_t *hd_data, unsigned vendor, unsigned device, unsigned sub_vendor, unsigned sub_device);
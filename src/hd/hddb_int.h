@@ -16,6 +16,24 @@
 /* 5 - 7 reserved */
 #define FLAG_CONT	8	/* bit mask, _must_ be bit 31 */
 
+/*
+ * Binary data base image, as written by 'check_hd --bin'.
+ *
+ * Offsets are relative to the image start, so it can be mapped anywhere.
+ * list, ids and strings have the same layout as in hddb2_data_t.
+ */
+#define HDDB_BIN_MAGIC		0x62646468	/* "hddb", little endian */
+#define HDDB_BIN_VERSION	1
+
+typedef struct {
+  unsigned magic;
+  unsigned version;
+  unsigned size;		/* image size */
+  unsigned list_ofs, list_len;
+  unsigned ids_ofs, ids_len;
+  unsigned strings_ofs, strings_len;
+} hddb_bin_header_t;
+
 
 typedef enum hddb_entry_e {
   he_other, he_bus_id, he_baseclass_id, he_subclass_id, he_progif_id,
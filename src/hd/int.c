@@ -475,8 +475,9 @@ void int_bios(hd_data_t *hd_data)
  */
 void int_media_check(hd_data_t *hd_data)
 {
-  hd_t *hd;
-  int i, j = 0;
+  hd_t *hd, **hds = NULL;
+  hd_block0_t *b0 = NULL;
+  unsigned u, len = 0;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd_report_this(hd_data, hd)) continue;
@@ -492,17 +493,34 @@ void int_media_check(hd_data_t *hd_data)
       !hd->is.notready &&
       hd->status.available != status_no
     ) {
-      i = 5;
-      PROGRESS(4, ++j, hd->unix_dev_name);
-      hd->block0 = read_block0(hd_data, hd->unix_dev_name, &i);
-      hd->is.notready = hd->block0 ? 0 : 1;
+      hds = add_mem(hds, sizeof *hds, len);
+      b0 = add_mem(b0, sizeof *b0, len);
+      hds[len] = hd;
+      b0[len].dev = hd->unix_dev_name;
+      b0[len].timeout = 5;
+      len++;
+    }
+  }
+
+  if(!len) return;
+
+  /* all at once */
+  PROGRESS(4, len, "block0");
+  read_block0_list(hd_data, b0, len);
+
+  for(u = 0; u < len; u++) {
+    hd = hds[u];
+    hd->block0 = b0[u].block0;
+    hd->is.notready = hd->block0 ? 0 : 1;
 #if defined(__i386__) || defined(__x86_64__)
-      if(hd->block0) {
-        ADD2LOG("  mbr sig: 0x%08x\n", edd_disk_signature(hd));
-      }
-#endif
+    if(hd->block0) {
+      ADD2LOG("  %s: mbr sig: 0x%08x\n", hd->unix_dev_name, edd_disk_signature(hd));
     }
+#endif
   }
+
+  free_mem(hds);
+  free_mem(b0);
 }
 
 
@@ -944,42 +962,37 @@ void int_udev(hd_data_t *hd_data)
 {
   hd_udevinfo_t *ui;
   hd_t *hd;
-  str_list_t *sl;
-
-  if(!hd_data->udevinfo) read_udevinfo(hd_data);
+  str_list_t *sl, *sl1;
 
-  if(!hd_data->udevinfo) return;
+  if(!hd_udevinfo_init(hd_data)) return;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd->unix_dev_names && hd->unix_dev_name) {
       add_str_list(&hd->unix_dev_names, hd->unix_dev_name);
     }
 
-    if(!hd->sysfs_id) continue;
+    /* udev uses canonical sysfs paths */
+    if(!hd->sysfs_id || strncmp(hd->sysfs_id, "/devices/", sizeof "/devices/" - 1)) continue;
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(ui->name && !strcmp(ui->sysfs, hd->sysfs_id)) {
-        if(!search_str_list(hd->unix_dev_names, ui->name)) {
-          add_str_list(&hd->unix_dev_names, ui->name);
-        }
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
+    if((ui = hd_udevinfo(hd_data, hd->sysfs_id)) && ui->name) {
+      if(!search_str_list(hd->unix_dev_names, ui->name)) {
+        add_str_list(&hd->unix_dev_names, ui->name);
+      }
+      for(sl = ui->links; sl; sl = sl->next) {
+        if(!search_str_list(hd->unix_dev_names, sl->str)) {
+          add_str_list(&hd->unix_dev_names, sl->str);
         }
+      }
 
-        if(!hd->unix_dev_name || hd_data->flags.udev) {
-          sl = hd->unix_dev_names;
+      if(!hd->unix_dev_name || hd_data->flags.udev) {
+        sl = hd->unix_dev_names;
 
-          if(hd_data->flags.udev) {
-            /* use first link as canonical device name */
-            if(ui->links) sl = sl->next;
-          }
-
-          hd->unix_dev_name = new_str(sl->str);
+        if(hd_data->flags.udev) {
+          /* use first link as canonical device name */
+          if(ui->links) sl = sl->next;
         }
 
-        break;
+        hd->unix_dev_name = new_str(sl->str);
       }
     }
   }
@@ -987,12 +1000,12 @@ void int_udev(hd_data_t *hd_data)
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd->unix_dev_names) continue;
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(search_str_list(hd->unix_dev_names, ui->name)) {
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
+    /* note: links added here are skipped by hd_udevinfo_by_name() */
+    for(sl = hd->unix_dev_names; sl; sl = sl->next) {
+      if(!(ui = hd_udevinfo_by_name(hd_data, sl->str))) continue;
+      for(sl1 = ui->links; sl1; sl1 = sl1->next) {
+        if(!search_str_list(hd->unix_dev_names, sl1->str)) {
+          add_str_list(&hd->unix_dev_names, sl1->str);
         }
       }
     }
@@ -1264,17 +1277,15 @@ void int_find_parent(hd_data_t *hd_data)
 {
   hd_t *hd, *hd2;
 
+  hd_index_build(hd_data);
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(hd->attached_to || !hd->parent_udi) continue;
 
-    for(hd2 = hd_data->hd; hd2; hd2 = hd2->next) {
-      if(!hd2->udi) continue;
-      if(!strcmp(hd->parent_udi, hd2->udi)) {
-        hd->attached_to = hd2->idx;
-        break;
-      }
-    }
+    if((hd2 = hd_find_udi(hd_data, hd->parent_udi))) hd->attached_to = hd2->idx;
   }
+
+  hd_index_drop(hd_data);
 }
 
 
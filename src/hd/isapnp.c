@@ -4,6 +4,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "sysfs.h"
 #include "hddb.h"
 #include "isapnp.h"
 
@@ -127,7 +128,7 @@ void get_pnp_devs(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/pnp/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/pnp/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  pnp device: name = %s\n    path = %s\n",
@@ -12,6 +12,8 @@
 #include "hd_int.h"
 #include "manual.h"
 #include "hddb.h"
+#include "hal.h"
+#include "cfgdb.h"
 
 /**
  * @defgroup Manualint UDI manual hardware 
@@ -43,7 +45,9 @@ static void hd2prop_append_list(hal_prop_t **list, const char *key, char *str);
 static void hd2prop(hd_data_t *hd_data, hd_t *hd);
 
 static hal_prop_t *hd_manual_read_entry_old(const char *id);
-static hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id);
+static hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id, hd_join_t *join);
+static hd_t *read_config(hd_data_t *hd_data, const char *id, hd_join_t *join);
+static void save_config_dir(hd_data_t *hd_data, const char *dir, int old_format, str_list_t **files);
 
 
 void hd_scan_manual(hd_data_t *hd_data)
@@ -51,8 +55,11 @@ void hd_scan_manual(hd_data_t *hd_data)
   DIR *dir;
   struct dirent *de;
   int i, j;
-  hd_t *hd, *hd1, *next, *hdm, **next2;
-  char *s;
+  unsigned u, idx;
+  hd_t *hd, *hd1, *next, *hdm, **next2, **added;
+  hd_join_t join_hd, join_manual;
+  str_list_t *sl, *sl0;
+  char *s, *t;
   char *udi_dir[] = { "/org/freedesktop/Hal/devices", "", "" };
 
   if(!hd_probe_feature(hd_data, pr_manual)) return;
@@ -72,15 +79,39 @@ void hd_scan_manual(hd_data_t *hd_data)
   next2 = &hd_data->manual;
 
   s = NULL;
+
+  /* used to look up udis while reading and for matching below */
+  hd_join_build(&join_hd, hd_data->hd, HD_JOIN_UNIQUE_ID);
+
+  i = 0;
+
+  if((sl0 = hd_cfgdb_keys())) {
+    /* config.db: keys with '/' are udis, else unique ids */
+    for(sl = sl0; sl; sl = sl->next) {
+      PROGRESS(1, ++i, "read");
+      str_printf(&s, 0, "%s%s", strchr(sl->str, '/') ? "/" : "", sl->str);
+      if((hd = read_config(hd_data, s, &join_hd))) {
+        if(hd->status.available != status_unknown) hd->status.available = status_no;
+        ADD2LOG("  got %s\n", hd->unique_id);
+        *next2 = hd;
+        next2 = &hd->next;
+      }
+    }
+  }
+
+  /* config files not (yet) in config.db, cf. hd_save_config() */
   for(j = 0; j < sizeof udi_dir / sizeof *udi_dir; j++) {
     str_printf(&s, 0, "%s%s", j == 2 ? "unique-keys" : "udi", udi_dir[j]);
     if((dir = opendir(hd_get_hddb_path(s)))) {
-      i = 0;
       while((de = readdir(dir))) {
         if(*de->d_name == '.') continue;
-        PROGRESS(1, ++i, "read");
         str_printf(&s, 0, "%s%s%s", udi_dir[j], *udi_dir[j] ? "/" : "", de->d_name);
-        if((hd = hd_read_config(hd_data, s))) {
+        if(sl0 && (t = hd_cfgdb_get(s))) {
+          free_mem(t);
+          continue;
+        }
+        PROGRESS(1, ++i, "read");
+        if((hd = read_config(hd_data, s, &join_hd))) {
           if(hd->status.available != status_unknown) hd->status.available = status_no;
           ADD2LOG("  got %s\n", hd->unique_id);
           *next2 = hd;
@@ -91,13 +122,25 @@ void hd_scan_manual(hd_data_t *hd_data)
     }
   }
   s = free_mem(s);
+  free_str_list(sl0);
+
+  /*
+   * Match by unique id: entries are either in hd_data->hd or have been
+   * added for an earlier manual entry (added[]).
+   */
+  hd_join_build(&join_manual, hd_data->manual, HD_JOIN_UNIQUE_ID);
+  added = new_mem((join_manual.len + 1) * sizeof *added);
 
   hd_data->flags.keep_kmods = 1;
-  for(hdm = hd_data->manual; hdm; hdm = next) {
+  for(u = 0, hdm = hd_data->manual; hdm; hdm = next, u++) {
     next = hdm->next;
 
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(hd->unique_id && hdm->unique_id && !strcmp(hd->unique_id, hdm->unique_id)) break;
+    hd = NULL;
+    if((i = hd_join_find(&join_hd, hdm, -1)) >= 0) {
+      hd = join_hd.list[i];
+    }
+    else if((i = hd_join_find(&join_manual, hdm, -1)) >= 0 && i < (int) u) {
+      hd = added[i];
     }
 
     if(hd) {
@@ -115,27 +158,38 @@ void hd_scan_manual(hd_data_t *hd_data)
     else {
       /* add new entry */
       hd = add_hd_entry(hd_data, __LINE__, 0);
+      idx = hd->idx;
       *hd = *hdm;
+      hd->idx = idx;
       hd->next = NULL;
       hd->tag.freeit = 0;
 
       hdm->tag.remove = 1;
+      added[u] = hd;
 
       if(hd->status.available != status_unknown) hd->status.available = status_no;
 
       // FIXME: do it really here?
       if(hd->parent_id) {
-        for(hd1 = hd_data->hd; hd1; hd1 = hd1->next) {
-          if(hd1->unique_id && !strcmp(hd1->unique_id, hd->parent_id)) {
-            hd->attached_to = hd1->idx;
-            break;
+        hd1 = NULL;
+        if((i = hd_join_find_id(&join_hd, hd->parent_id, -1)) >= 0) {
+          hd1 = join_hd.list[i];
+        }
+        else {
+          for(i = -1; (i = hd_join_find_id(&join_manual, hd->parent_id, i)) >= 0 && i <= (int) u; ) {
+            if((hd1 = added[i])) break;
           }
         }
+        if(hd1) hd->attached_to = hd1->idx;
       }
     }
   }
   hd_data->flags.keep_kmods = 0;
 
+  hd_join_free(&join_hd);
+  hd_join_free(&join_manual);
+  free_mem(added);
+
   for(hd = hd_data->manual; hd; hd = next) {
     next = hd->next;
     hd->next = NULL;
@@ -154,14 +208,17 @@ void hd_scan_manual(hd_data_t *hd_data)
 void hd_scan_manual2(hd_data_t *hd_data)
 {
   hd_t *hd, *hd1;
+  hd_join_t join;
 
   /* add persistent properties */
+  hd_join_build(&join, hd_data->hd, HD_JOIN_UNIQUE_ID);
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(hd->persistent_prop) continue;
-    hd->persistent_prop = read_properties(hd_data, hd->udi, hd->unique_id);
+    hd->persistent_prop = read_properties(hd_data, hd->udi, hd->unique_id, &join);
     prop2hd(hd_data, hd, 1);
     if(hd->status.available != status_unknown) hd->status.available = status_yes;
   }
+  hd_join_free(&join);
 
   /* check if it's necessary to reconfigure this hardware */
   for(hd = hd_data->hd; hd; hd = hd->next) {
@@ -641,6 +698,7 @@ void hd2prop_append_list(hal_prop_t **list, const char *key, char *str)
   if(!prop) {
     add_str_list(&sl, str);
     hd2prop_add_list(list, key, sl);
+    free_str_list(sl);
     return;
   }
 
@@ -848,10 +906,16 @@ void hd2prop(hd_data_t *hd_data, hd_t *hd)
 }
 
 
-hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
+/*
+ * Read properties by udi or unique id.
+ *
+ * join: hd_data->hd joined by unique id, to find the udi; may be NULL.
+ */
+hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id, hd_join_t *join)
 {
-  hd_t *hd;
+  hd_join_t join_tmp;
   hal_prop_t *prop = NULL;
+  int i;
 
   if(udi) {
     prop = hd_read_properties(udi);
@@ -862,12 +926,11 @@ hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
 
   if(id && !udi) {
     /* try to find udi entry */
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(hd->udi && hd->unique_id && !strcmp(id, hd->unique_id)) {
-        udi = hd->udi;
-        break;
-      }
+    if(!join) hd_join_build(join = &join_tmp, hd_data->hd, HD_JOIN_UNIQUE_ID);
+    for(i = -1; (i = hd_join_find_id(join, (char *) id, i)) >= 0; ) {
+      if((udi = join->list[i]->udi)) break;
     }
+    if(join == &join_tmp) hd_join_free(join);
 
     if(udi) {
       prop = hd_read_properties(udi);
@@ -889,6 +952,15 @@ hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
 
 
 hd_t *hd_read_config(hd_data_t *hd_data, const char *id)
+{
+  return read_config(hd_data, id, NULL);
+}
+
+
+/*
+ * join: hd_data->hd joined by unique id, cf. read_properties(); may be NULL.
+ */
+hd_t *read_config(hd_data_t *hd_data, const char *id, hd_join_t *join)
 {
   hd_t *hd = NULL;
   hal_prop_t *prop = NULL;
@@ -903,7 +975,7 @@ hd_t *hd_read_config(hd_data_t *hd_data, const char *id)
     id = NULL;
   }
 
-  prop = read_properties(hd_data, udi, id);
+  prop = read_properties(hd_data, udi, id, join);
 
   if(prop) {
     hd = new_mem(sizeof *hd);
@@ -932,7 +1004,97 @@ int hd_write_config(hd_data_t *hd_data, hd_t *hd)
 
   if(!udi) return 5;
 
-  return hd_write_properties(udi, hd->persistent_prop);
+  return hd_write_properties2(hd_data, udi, hd->persistent_prop);
+}
+
+
+/*
+ * Move all config files below udi/ and unique-keys/ into config.db
+ * (creating it). Entries already in config.db are kept.
+ *
+ * If a device has files in both udi/ and unique-keys/, the one in udi/
+ * wins: it is added later, cf. cfgdb_commit().
+ *
+ * return 0 if ok
+ */
+int hd_save_config(hd_data_t *hd_data)
+{
+  str_list_t *files = NULL, *sl;
+  int err;
+
+  hd_cfgdb_create(hd_data);
+
+  save_config_dir(hd_data, "", 1, &files);
+  save_config_dir(hd_data, "", 0, &files);
+  save_config_dir(hd_data, "/org/freedesktop/Hal/devices", 0, &files);
+
+  err = hd_commit_config(hd_data);
+
+  ADD2LOG("config.db: %s\n", err ? "failed" : "saved");
+
+  /* only now it's safe to remove them */
+  if(!err) for(sl = files; sl; sl = sl->next) unlink(sl->str);
+
+  free_str_list(files);
+
+  return err;
+}
+
+
+/*
+ * Add config files in udi/<dir> (or unique-keys/, if old_format is set) to
+ * the current config batch. Files that have been added are put into *files.
+ *
+ * Keys that are already stored are skipped. Keys added twice are sorted
+ * out when the batch is written (the last one wins).
+ */
+void save_config_dir(hd_data_t *hd_data, const char *dir, int old_format, str_list_t **files)
+{
+  hd_dir_t *dir_list;
+  hd_file_t *file;
+  hal_prop_t *prop;
+  char *key = NULL, *path = NULL, *file_name = NULL, *data, *name, *s;
+  unsigned u;
+
+  str_printf(&path, 0, "%s%s", old_format ? "unique-keys" : "udi", dir);
+  dir_list = hd_read_dir(hd_get_hddb_path(path), 'r');
+
+  for(u = 0; dir_list && u < dir_list->len; u++) {
+    name = dir_list->entry[u].name;
+    if(*name == '.') continue;
+
+    str_printf(&key, 0, "%s%s%s", dir, *dir ? "/" : "", name);
+
+    if((s = hd_cfgdb_get(key))) {
+      free_mem(s);
+      continue;
+    }
+
+    str_printf(&path, 0, "%s%s/%s", old_format ? "unique-keys" : "udi", dir, name);
+    str_printf(&file_name, 0, "%s", hd_get_hddb_path(path));
+
+    if(old_format) {
+      prop = hd_manual_read_entry_old(name);
+      data = hal_props2str(prop);
+      hd_free_hal_properties(prop);
+    }
+    else {
+      file = hd_read_file(file_name, 0);
+      data = file ? new_str(file->data) : NULL;
+      hd_free_file(file);
+    }
+
+    if(data) {
+      hd_cfgdb_put(hd_data, key, data);
+      add_str_list(files, file_name);
+      free_mem(data);
+    }
+  }
+
+  free_mem(dir_list);
+  free_mem(path);
+  free_mem(file_name);
+  free_mem(key);
 }
 
 
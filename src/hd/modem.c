@@ -5,6 +5,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -62,13 +65,21 @@ static char *init_strings[] = {
 
 #define MAX_INIT_STRING	(sizeof init_strings / sizeof *init_strings)
 
+/* response timeouts (in ms): for the first byte and between bytes */
+#define MODEM_FIRST_TIMEOUT	1200
+#define MODEM_IDLE_TIMEOUT	1000
+
 static void get_serial_modem(hd_data_t* hd_data);
+static void close_serial_modems(void *arg);
+static void probe_serial_modem(hd_data_t *hd_data, void *arg);
 static void add_serial_modem(hd_data_t* hd_data);
 static int dev_name_duplicate(hd_data_t *hd_data, char *dev_name);
 static void guess_modem_name(hd_data_t *hd_data, ser_device_t *sm);
 static void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it);
 static void write_modem(hd_data_t *hd_data, char *msg);
 static void read_modem(hd_data_t *hd_data);
+static int modem_resp_done(ser_device_t *sm);
+static unsigned modem_msecs(void);
 static ser_device_t *add_ser_modem_entry(ser_device_t **sm, ser_device_t *new_sm);
 static int set_modem_speed(ser_device_t *sm, unsigned baud);    
 static int init_modem(ser_device_t *mi);
@@ -89,21 +100,14 @@ void hd_scan_modem(hd_data_t *hd_data)
 
   PROGRESS(1, 0, "serial");
 
-  hd_fork(hd_data, 15, 120);
+  hd_isolate(hd_data, 15, 120, probe_serial_modem, NULL);
 
-  if(hd_data->flags.forked) {
-    get_serial_modem(hd_data);
-    hd_move_to_shm(hd_data);
-    if((hd_data->debug & HD_DEB_MODEM)) dump_ser_modem_data(hd_data);
-  }
-  else {
+  if(!hd_data->flags.forked) {
     /* take data from shm */
     hd_data->ser_modem = ((hd_data_t *) (hd_data->shm.data))->ser_modem;
     if((hd_data->debug & HD_DEB_MODEM)) dump_ser_modem_data(hd_data);
   }
 
-  hd_fork_done(hd_data);
-
   add_serial_modem(hd_data);
 
   hd_shm_clean(hd_data);
@@ -148,6 +152,19 @@ str_list_t *str_list_dup(str_list_t *orig)
   return dup;
 }
 
+/*
+ * Runs in a subprocess or, with flags.threads, in a thread, cf. hd_isolate().
+ */
+void probe_serial_modem(hd_data_t *hd_data, void *arg)
+{
+  pthread_cleanup_push(close_serial_modems, hd_data);
+  get_serial_modem(hd_data);
+  pthread_cleanup_pop(0);
+  hd_move_to_shm(hd_data);
+  if((hd_data->debug & HD_DEB_MODEM)) dump_ser_modem_data(hd_data);
+}
+
+
 void get_serial_modem(hd_data_t *hd_data)
 {
   hd_t *hd;
@@ -419,11 +436,28 @@ void get_serial_modem(hd_data_t *hd_data)
 
       if(!sm->user_name) guess_modem_name(hd_data, sm);
     }
+  }
+
+  close_serial_modems(hd_data);
+}
+
+
+/*
+ * Reset serial lines and close ports.
+ *
+ * Also a cleanup handler, in case the probe thread is cancelled.
+ */
+void close_serial_modems(void *arg)
+{
+  hd_data_t *hd_data = arg;
+  ser_device_t *sm;
 
-    /* reset serial lines */
+  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
+    if(sm->fd < 0) continue;
     tcflush(sm->fd, TCIOFLUSH);
     tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
     close(sm->fd);
+    sm->fd = -1;
   }
 }
 
@@ -685,6 +719,8 @@ void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it)
     if(sm->do_io) {
       sm->buf_len = 0;
       modems++;
+      if(strstr(at, "V0")) sm->numeric_resp = 1;
+      if(strstr(at, "V1")) sm->numeric_resp = 0;
     }
   }
 
@@ -693,7 +729,6 @@ void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it)
   PROGRESS(9, u, "write at cmd");
   write_modem(hd_data, at);
   PROGRESS(9, u, "read at resp");
-  usleep (200000);
   read_modem(hd_data);
   PROGRESS(9, u, "read ok");
   u++;
@@ -742,44 +777,76 @@ void write_modem(hd_data_t *hd_data, char *msg)
   }
 }
 
+/*
+ * Read responses from all modems in parallel.
+ *
+ * A modem is done when its response ends with a final result code, when it
+ * has been quiet for MODEM_IDLE_TIMEOUT ms, or when the buffer is full. So
+ * the total time is that of the slowest modem.
+ */
 void read_modem(hd_data_t *hd_data)
 {
-  int i, sel, fd_max = -1;
-  fd_set set, set0;
-  struct timeval to;
-  ser_device_t *sm;
+  int i, len, timeout;
+  unsigned u, now, *last;
+  struct pollfd *pfd;
+  ser_device_t *sm, **sms;
+
+  for(len = 0, sm = hd_data->ser_modem; sm; sm = sm->next) if(sm->do_io) len++;
+
+  if(!len) return;	/* nothing selected */
 
-  FD_ZERO(&set0);
+  pfd = new_mem(len * sizeof *pfd);
+  sms = new_mem(len * sizeof *sms);
+  last = new_mem(len * sizeof *last);
 
-  for(i = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
+  now = modem_msecs();
+
+  for(u = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
     if(sm->do_io) {
-      FD_SET(sm->fd, &set0);
-      if(sm->fd > fd_max) fd_max = sm->fd;
-      i++;
+      pfd[u].fd = sm->fd;
+      pfd[u].events = POLLIN;
+      sms[u] = sm;
+      /* the first byte may take a bit longer */
+      last[u] = now - MODEM_IDLE_TIMEOUT + MODEM_FIRST_TIMEOUT;
+      u++;
     }
   }
 
-  if(!i) return;	/* nothing selected */
-
   for(;;) {
-    to.tv_sec = 0; to.tv_usec = 1000000;
-    set = set0;
-    if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
-//      fprintf(stderr, "sel: %d\n", sel);
-      for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-        if(FD_ISSET(sm->fd, &set)) {
-          if((i = read(sm->fd, sm->buf + sm->buf_len, sizeof sm->buf - sm->buf_len)) > 0)
-            sm->buf_len += i;
-//          fprintf(stderr, "%s: got %d\n", sm->dev_name, i);
-          if(i <= 0) FD_CLR(sm->fd, &set0);
-        }
+    /* poll() ignores negative fds; that's how finished modems drop out */
+    for(timeout = -1, u = 0; u < (unsigned) len; u++) {
+      if(pfd[u].fd < 0) continue;
+      i = last[u] + MODEM_IDLE_TIMEOUT - now;
+      if(i <= 0) {
+        pfd[u].fd = -1;
+        continue;
       }
+      if(timeout < 0 || i < timeout) timeout = i;
     }
-    else {
-      break;
+
+    if(timeout < 0) break;
+
+    i = poll(pfd, len, timeout);
+
+    now = modem_msecs();
+
+    if(i < 0) break;
+
+    for(u = 0; u < (unsigned) len; u++) {
+      if(pfd[u].fd < 0 || !pfd[u].revents) continue;
+      sm = sms[u];
+      if((i = read(sm->fd, sm->buf + sm->buf_len, sizeof sm->buf - 1 - sm->buf_len)) > 0) {
+        sm->buf_len += i;
+        last[u] = now;
+      }
+      if(i <= 0 || modem_resp_done(sm)) pfd[u].fd = -1;
     }
   }
 
+  free_mem(last);
+  free_mem(sms);
+  free_mem(pfd);
+
   /* make the strings \000 terminated */
   for(sm = hd_data->ser_modem; sm; sm = sm->next) {
     if(sm->buf_len == sizeof sm->buf) sm->buf_len--;
@@ -787,6 +854,50 @@ void read_modem(hd_data_t *hd_data)
   }
 }
 
+
+/*
+ * Check if modem response is complete: buffer full or last line is a final
+ * result code (numeric codes only after ATV0).
+ */
+int modem_resp_done(ser_device_t *sm)
+{
+  static char *final[] = { "OK", "ERROR", "NO CARRIER", "0", "4" };
+  unsigned u, end, start, len;
+
+  if(sm->buf_len >= sizeof sm->buf - 1) return 1;
+
+  /* must end with a line break */
+  end = sm->buf_len;
+  if(!end || (sm->buf[end - 1] != '\r' && sm->buf[end - 1] != '\n')) return 0;
+
+  while(end && (sm->buf[end - 1] == '\r' || sm->buf[end - 1] == '\n')) end--;
+  for(start = end; start && sm->buf[start - 1] != '\r' && sm->buf[start - 1] != '\n'; start--);
+
+  /* the last two are the numeric codes */
+  len = sizeof final / sizeof *final;
+  if(!sm->numeric_resp) len -= 2;
+
+  for(u = 0; u < len; u++) {
+    if(
+      strlen(final[u]) == end - start &&
+      !memcmp(sm->buf + start, final[u], end - start)
+    ) return 1;
+  }
+
+  return 0;
+}
+
+
+unsigned modem_msecs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
 int set_modem_speed(ser_device_t *sm, unsigned baud)
 {
   int i;
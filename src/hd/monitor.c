@@ -376,9 +376,9 @@ void add_edid_info(hd_data_t *hd_data, hd_t *hd, unsigned char *edid)
   for(i = 0x36; i < 0x36 + 4 * 0x12; i += 0x12) {
     tag = (edid[i] << 24) + (edid[i + 1] << 16) + (edid[i + 2] << 8) + edid[i + 3];
 
-    ADD2LOG("  #%d: ", (i - 0x36)/0x12);
+    ADD2LOG_DATA("  #%d: ", (i - 0x36)/0x12);
     hd_log_hex(hd_data, 1, 0x12, edid + i);
-    ADD2LOG("\n");
+    ADD2LOG_DATA("\n");
 
     switch(tag) {
       case 0xfc:
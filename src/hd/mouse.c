@@ -5,6 +5,8 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <termios.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -32,6 +34,8 @@ static void test_ps2_open(void *arg);
 #endif
 
 static void get_serial_mouse(hd_data_t* hd_data);
+static void probe_serial_mouse(hd_data_t *hd_data, void *arg);
+static void close_serial_mice(void *arg);
 static void add_serial_mouse(hd_data_t* hd_data);
 static int _setspeed(int fd, int old, int new, int needtowrite, unsigned short flags);
 static void setspeed(int fd, int new, int needtowrite, unsigned short flags);
@@ -62,21 +66,14 @@ void hd_scan_mouse(hd_data_t *hd_data)
 
   PROGRESS(2, 0, "serial");
 
-  hd_fork(hd_data, 20, 20);
+  hd_isolate(hd_data, 20, 20, probe_serial_mouse, NULL);
 
-  if(hd_data->flags.forked) {
-    get_serial_mouse(hd_data);
-    hd_move_to_shm(hd_data);
-    if((hd_data->debug & HD_DEB_MOUSE)) dump_ser_mouse_data(hd_data);
-  }
-  else {
+  if(!hd_data->flags.forked) {
     /* take data from shm */
     hd_data->ser_mouse = ((hd_data_t *) (hd_data->shm.data))->ser_mouse;
     if((hd_data->debug & HD_DEB_MOUSE)) dump_ser_mouse_data(hd_data);
   }
 
-  hd_fork_done(hd_data);
-
   add_serial_mouse(hd_data);
 
   hd_shm_clean(hd_data);
@@ -198,7 +195,7 @@ static void get_ps2_mouse(hd_data_t *hd_data)
       PROGRESS(1, 1, "ps/2");
 
       /* open the mouse device... */
-      if(hd_timeout(test_ps2_open, NULL, 2) > 0) {
+      if(hd_timeout(hd_data, test_ps2_open, NULL, 2) > 0) {
         ADD2LOG("ps/2: open(%s) timed out\n", DEV_PSAUX);
         fd = -2;
       }
@@ -371,21 +368,33 @@ static void get_sunmouse(hd_data_t *hd_data)
 }
 #endif
 
+/*
+ * Probe serial mice and pass the results back via shm.
+ *
+ * Runs in a subprocess or, with flags.threads, in a thread, cf. hd_isolate().
+ */
+void probe_serial_mouse(hd_data_t *hd_data, void *arg)
+{
+  pthread_cleanup_push(close_serial_mice, hd_data);
+  get_serial_mouse(hd_data);
+  pthread_cleanup_pop(0);
+  hd_move_to_shm(hd_data);
+  if((hd_data->debug & HD_DEB_MOUSE)) dump_ser_mouse_data(hd_data);
+}
+
+
 /*
  * Gather serial mouse data and put it into hd_data->ser_mouse.
  */
 void get_serial_mouse(hd_data_t *hd_data)
 {
   hd_t *hd;
-  int j, fd, fd_max = 0, sel, max_len;
-  unsigned modem_info;
-  fd_set set, set0;
-  struct timeval to;
-  ser_device_t *sm;
+  int j, fd, max_len, len = 0;
+  unsigned u, modem_info;
+  struct pollfd *pfd;
+  ser_device_t *sm, **sms;
   struct termios tio;
 
-  FD_ZERO(&set);
-
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(
       hd->base_class.id == bc_comm &&
@@ -395,14 +404,16 @@ void get_serial_mouse(hd_data_t *hd_data)
       !has_something_attached(hd_data, hd)
     ) {
       if((fd = open(hd->unix_dev_name, O_RDWR | O_NONBLOCK)) >= 0) {
-        if(tcgetattr(fd, &tio)) continue;
+        if(tcgetattr(fd, &tio)) {
+          close(fd);
+          continue;
+        }
         sm = add_ser_mouse_entry(&hd_data->ser_mouse, new_mem(sizeof *sm));
         sm->dev_name = new_str(hd->unix_dev_name);
         sm->fd = fd;
         sm->tio = tio;
         sm->hd_idx = hd->idx;
-        if(fd > fd_max) fd_max = fd;
-        FD_SET(fd, &set);
+        len++;
 
         /*
          * PnP COM spec black magic...
@@ -429,32 +440,51 @@ void get_serial_mouse(hd_data_t *hd_data)
   /* smaller buffer size, otherwise we might wait really long... */
   max_len = sizeof sm->buf < 128 ? sizeof sm->buf : 128;
 
-  to.tv_sec = 0; to.tv_usec = 300000;
-
-  set0 = set;
-  for(;;) {
-   to.tv_sec = 0; to.tv_usec = 300000;
-    set = set0;
-    if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
-      for(sm = hd_data->ser_mouse; sm; sm = sm->next) {
-        if(FD_ISSET(sm->fd, &set)) {
-          if((j = read(sm->fd, sm->buf + sm->buf_len, max_len - sm->buf_len)) > 0)
-            sm->buf_len += j;
-          if(j <= 0) FD_CLR(sm->fd, &set0);	// #####
-        }
-      }
-    }
-    else {
-      break;
+  /* no fd limit, unlike select() */
+  pfd = new_mem(len * sizeof *pfd);
+  sms = new_mem(len * sizeof *sms);
+
+  for(u = 0, sm = hd_data->ser_mouse; sm; sm = sm->next, u++) {
+    pfd[u].fd = sm->fd;
+    pfd[u].events = POLLIN;
+    sms[u] = sm;
+  }
+
+  while(poll(pfd, len, 300) > 0) {
+    for(u = 0; u < (unsigned) len; u++) {
+      if(pfd[u].fd < 0 || !pfd[u].revents) continue;
+      sm = sms[u];
+      if((j = read(sm->fd, sm->buf + sm->buf_len, max_len - sm->buf_len)) > 0)
+        sm->buf_len += j;
+      if(j <= 0) pfd[u].fd = -1;	// #####
     }
   }
 
+  free_mem(pfd);
+  free_mem(sms);
+
+  for(sm = hd_data->ser_mouse; sm; sm = sm->next) chk4id(sm);
+
+  close_serial_mice(hd_data);
+}
+
+
+/*
+ * Reset serial lines and close ports.
+ *
+ * Also a cleanup handler, in case the probe thread is cancelled.
+ */
+void close_serial_mice(void *arg)
+{
+  hd_data_t *hd_data = arg;
+  ser_device_t *sm;
+
   for(sm = hd_data->ser_mouse; sm; sm = sm->next) {
-    chk4id(sm);
-    /* reset serial lines */
+    if(sm->fd < 0) continue;
     tcflush(sm->fd, TCIOFLUSH);
     tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
     close(sm->fd);
+    sm->fd = -1;
   }
 }
 
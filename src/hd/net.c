@@ -22,6 +22,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "sysfs.h"
 #include "net.h"
 
 /**
@@ -106,13 +107,13 @@ void hd_scan_net(hd_data_t *hd_data)
       ADD2LOG("    hw_addr = %s\n", hw_addr);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
     if(sf_dev) {
       ADD2LOG("    net device: path = %s\n", hd_sysfs_id(sf_dev));
     }
 
     sf_drv_name = NULL;
-    sf_drv = hd_read_sysfs_link(sf_dev, "driver");
+    sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver");
     if(sf_drv) {
       sf_drv_name = strrchr(sf_drv, '/');
       if(sf_drv_name) sf_drv_name++;
@@ -591,19 +592,20 @@ void get_linkstate(hd_data_t *hd_data, hd_t *hd)
 hd_res_t *get_phwaddr(hd_data_t *hd_data, hd_t *hd)
 {
   int fd;
-  struct ethtool_perm_addr *phwaddr = new_mem(sizeof (struct ethtool_perm_addr) + MAX_ADDR_LEN);
+  struct ethtool_perm_addr *phwaddr;
   struct ifreq ifr;
   hd_res_t *res = NULL;
 
-  phwaddr->cmd = ETHTOOL_GPERMADDR;
-  phwaddr->size = MAX_ADDR_LEN;
-
   if(!hd->unix_dev_name) return res;
 
   if(strlen(hd->unix_dev_name) > sizeof ifr.ifr_name - 1) return res;
 
   if((fd = socket(PF_INET, SOCK_DGRAM, 0)) == -1) return res;
 
+  phwaddr = new_mem(sizeof (struct ethtool_perm_addr) + MAX_ADDR_LEN);
+  phwaddr->cmd = ETHTOOL_GPERMADDR;
+  phwaddr->size = MAX_ADDR_LEN;
+
   /* get permanent hardware addr */
   memset(&ifr, 0, sizeof ifr);
   strcpy(ifr.ifr_name, hd->unix_dev_name);
@@ -636,6 +638,8 @@ hd_res_t *get_phwaddr(hd_data_t *hd_data, hd_t *hd)
 
   close(fd);
 
+  free_mem(phwaddr);
+
   return res;
 }
 
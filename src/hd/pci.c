@@ -11,6 +11,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "sysfs.h"
 #include "hddb.h"
 #include "pci.h"
 
@@ -82,7 +83,7 @@ void hd_scan_sysfs_pci(hd_data_t *hd_data)
   PROGRESS(2, 0, "get sysfs pci data");
 
   hd_pci_read_data(hd_data);
-  if(hd_data->debug) dump_pci_data(hd_data);
+  if(hd_data->debug && LOG_ON(log_data)) dump_pci_data(hd_data);
 
   add_pci_data(hd_data);
 
@@ -145,6 +146,7 @@ void hd_pci_read_data(hd_data_t *hd_data)
   str_list_t *sf_bus, *sf_bus_e, *sf_drm_dirs, *sf_drm_dir, *sf_drm_subdirs,
     *sf_drm_subdir;
   char *sf_dev, *sf_drm = NULL, *sf_drm_subpath = NULL, *sf_drm_edid = NULL;
+  hd_sysfs_dir_t *sf_dir;
 
   sf_bus = read_dir("/sys/bus/pci/devices", 'l');
 
@@ -154,7 +156,13 @@ void hd_pci_read_data(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/pci/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/pci/devices", sf_bus_e->str));
+
+    /* cf. hd_rescan_sysfs_path() */
+    if(!hd_sysfs_in_scope(hd_data, sf_dev)) {
+      free_mem(sf_dev);
+      continue;
+    }
 
     ADD2LOG(
       "  pci device: name = %s\n    path = %s\n",
@@ -173,49 +181,52 @@ void hd_pci_read_data(hd_data_t *hd_data)
     pci->slot = u2;
     pci->func = u3;
 
-    if((s = get_sysfs_attr_by_path(sf_dev, "modalias"))) {
+    sf_dir = hd_sysfs_open(sf_dev);
+    hd_sysfs_read_all(sf_dir);
+
+    if((s = hd_sysfs_attr(sf_dir, "modalias", NULL))) {
       pci->modalias = canon_str(s, strlen(s));
       ADD2LOG("    modalias = \"%s\"\n", pci->modalias);
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "class"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "class", NULL), &ul0, 0)) {
       ADD2LOG("    class = 0x%x\n", (unsigned) ul0);
       pci->prog_if = ul0 & 0xff;
       pci->sub_class = (ul0 >> 8) & 0xff;
       pci->base_class = (ul0 >> 16) & 0xff;
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "vendor"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "vendor", NULL), &ul0, 0)) {
       ADD2LOG("    vendor = 0x%x\n", (unsigned) ul0);
       pci->vend = ul0 & 0xffff;
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "device"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "device", NULL), &ul0, 0)) {
       ADD2LOG("    device = 0x%x\n", (unsigned) ul0);
       pci->dev = ul0 & 0xffff;
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "subsystem_vendor"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "subsystem_vendor", NULL), &ul0, 0)) {
       ADD2LOG("    subvendor = 0x%x\n", (unsigned) ul0);
       pci->sub_vend = ul0 & 0xffff;
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "subsystem_device"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "subsystem_device", NULL), &ul0, 0)) {
       ADD2LOG("    subdevice = 0x%x\n", (unsigned) ul0);
       pci->sub_dev = ul0 & 0xffff;
     }
 
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "irq"), &ul0, 0)) {
+    if(hd_attr_uint(hd_sysfs_attr(sf_dir, "irq", NULL), &ul0, 0)) {
       ADD2LOG("    irq = %d\n", (unsigned) ul0);
       pci->irq = ul0;
     }
 
-    if((s = get_sysfs_attr_by_path(sf_dev, "label"))) {
+    if((s = hd_sysfs_attr(sf_dir, "label", NULL))) {
       pci->label = canon_str(s, strlen(s));
       ADD2LOG("    label = \"%s\"\n", pci->label);
     }
 
-    sl = hd_attr_list(get_sysfs_attr_by_path(sf_dev, "resource"));
+    sl = hd_attr_list(hd_sysfs_attr(sf_dir, "resource", NULL));
     for(u = 0; sl; sl = sl->next, u++) {
       if(
         sscanf(sl->str, "0x%"SCNx64" 0x%"SCNx64" 0x%"SCNx64, &ul0, &ul1, &ul2) == 3 &&
@@ -230,8 +241,7 @@ void hd_pci_read_data(hd_data_t *hd_data)
     }
 
     s = NULL;
-    str_printf(&s, 0, "%s/config", sf_dev);
-    if((fd = open(s, O_RDONLY)) != -1) {
+    if((fd = hd_sysfs_openat(sf_dir, "config", O_RDONLY)) != -1) {
       pci->data_len = pci->data_ext_len = read(fd, pci->data, 0x40);
       ADD2LOG("    config[%u]\n", pci->data_len);
 
@@ -331,6 +341,7 @@ void hd_pci_read_data(hd_data_t *hd_data)
 
     pci->flags |= (1 << pci_flag_ok);
 
+    sf_dir = hd_sysfs_close(sf_dir);
     free_mem(sf_dev);
   }
 
@@ -347,9 +358,9 @@ void add_edid_from_file(const char *file, pci_t *pci, int index, hd_data_t *hd_d
 
       if(pci->edid_len[index] > 0) {
         for(i = 0; i < sizeof pci->edid_data[index]; i += 0x10) {
-          ADD2LOG("      ");
+          ADD2LOG_DATA("      ");
           hd_log_hex(hd_data, 1, 0x10, pci->edid_data[index] + i);
-          ADD2LOG("\n");
+          ADD2LOG_DATA("\n");
         }
       }
     }
@@ -711,7 +722,7 @@ void hd_read_macio(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/macio/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/macio/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  macio device: name = %s\n    path = %s\n",
@@ -815,7 +826,7 @@ void hd_read_vio(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/vio/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/vio/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  vio device: name = %s\n    path = %s\n",
@@ -945,7 +956,7 @@ void hd_read_platform(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/platform/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/platform/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  platform device: name = %s\n    path = %s\n",
@@ -966,7 +977,7 @@ void hd_read_platform(hd_data_t *hd_data)
       }
       ADD2LOG("    type = \"%s\", modalias = \"%s\"\n", device_type, platform_type);
       is_net = 0;
-      sf_eth_net = new_str(hd_read_sysfs_link(sf_dev, "net"));
+      sf_eth_net = new_str(hd_sysfs_link(hd_data, sf_dev, "net"));
       sf_eth_dev = read_dir(sf_eth_net, 'd');
       is_net = sf_eth_net && sf_eth_dev;
       is_storage = device_type && !strcmp(device_type, "sata");
@@ -1046,7 +1057,7 @@ void hd_read_of_platform(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/of_platform/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/of_platform/devices", sf_bus_e->str));
     ADD2LOG(
       "  of_platform device: name = %s\n    path = %s\n",
       sf_bus_e->str, hd_sysfs_id(sf_dev)
@@ -1146,7 +1157,7 @@ void hd_read_ps3_system_bus(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/ps3_system_bus/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/ps3_system_bus/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  ps3 device: name = %s\n    path = %s\n",
@@ -1164,7 +1175,7 @@ void hd_read_ps3_system_bus(hd_data_t *hd_data)
     /* network devices */
     if(ps3_name && !strcmp(ps3_name, "ps3:3")) {
       /* read list of available devices */
-      sf_eth_net = new_str(hd_read_sysfs_link(sf_dev, "net"));
+      sf_eth_net = new_str(hd_sysfs_link(hd_data, sf_dev, "net"));
       sf_eth_dev = read_dir(sf_eth_net, 'd');
 
       /* add entries for available devices */
@@ -1181,7 +1192,7 @@ void hd_read_ps3_system_bus(hd_data_t *hd_data)
         hd->unix_dev_name = new_str(sf_eth_dev_e->str);		/* this is needed to correctly link to interfaces later */
 
         /* ethernet and wireless differ only by directory "wireless" so check for it */
-        sf_eth_wireless = hd_read_sysfs_link(hd_read_sysfs_link(sf_eth_net, sf_eth_dev_e->str), "wireless");
+        sf_eth_wireless = hd_sysfs_link(hd_data, hd_sysfs_link(hd_data, sf_eth_net, sf_eth_dev_e->str), "wireless");
         if(sf_eth_wireless) {
           hd->sub_class.id = 0x82;	/* wireless */
           str_printf(&hd->device.name, 0, "PS3 Wireless card %d", wlan_cnt++);
@@ -1280,7 +1291,7 @@ void hd_read_ibmebus(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/ibmebus/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/ibmebus/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  ibmebus device: name = %s\n    path = %s\n",
@@ -1378,7 +1389,7 @@ void hd_read_xen(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/xen/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/xen/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  xen device: name = %s\n    path = %s\n",
@@ -1398,9 +1409,9 @@ void hd_read_xen(hd_data_t *hd_data)
       ADD2LOG("    node = \"%s\"\n", xen_node);
     }
 
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
 
-    s = new_str(hd_read_sysfs_link(drv, "module"));
+    s = new_str(hd_sysfs_link(hd_data, drv, "module"));
     module = new_str(s ? strrchr(s, '/') + 1 : NULL);
     free_mem(s);
 
@@ -1514,7 +1525,7 @@ void hd_read_vm(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/vmbus/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/vmbus/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  vm device: name = %s\n    path = %s\n",
@@ -1523,7 +1534,7 @@ void hd_read_vm(hd_data_t *hd_data)
     );
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
       drv_name = strrchr(drv, '/');
       if(drv_name) drv_name++;
@@ -1598,7 +1609,7 @@ void hd_read_virtio(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/virtio/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/virtio/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  virtio device: name = %s\n    path = %s\n",
@@ -1607,7 +1618,7 @@ void hd_read_virtio(hd_data_t *hd_data)
     );
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
       drv_name = strrchr(drv, '/');
       if(drv_name) drv_name++;
@@ -1712,7 +1723,7 @@ void hd_read_uisvirtpci(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/uisvirtpci/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/uisvirtpci/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  uisvirtpci device: name = %s\n    path = %s\n",
@@ -1724,7 +1735,7 @@ void hd_read_uisvirtpci(hd_data_t *hd_data)
     hd->vendor.id = MAKE_ID(TAG_PCI, 0xA0F1);	/* Unisys */
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
         drv_name = strrchr(drv, '/');
         if(drv_name) {
@@ -1785,7 +1796,7 @@ void hd_read_mmc(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/mmc/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/mmc/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  mmc device: name = %s\n    path = %s\n",
@@ -1794,7 +1805,7 @@ void hd_read_mmc(hd_data_t *hd_data)
     );
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
       drv_name = strrchr(drv, '/');
       if(drv_name) drv_name++;
@@ -1867,7 +1878,7 @@ void hd_read_sdio(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/sdio/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/sdio/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  sdio device: name = %s\n    path = %s\n",
@@ -1876,7 +1887,7 @@ void hd_read_sdio(hd_data_t *hd_data)
     );
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
       drv_name = strrchr(drv, '/');
       if(drv_name) drv_name++;
@@ -1919,7 +1930,7 @@ void hd_read_sdio(hd_data_t *hd_data)
 
     free_mem(s);
 
-    if(hd_read_sysfs_link(sf_dev, "net")) {
+    if(hd_sysfs_link(hd_data, sf_dev, "net")) {
       hd->base_class.id = bc_network;
       hd->sub_class.id = sc_nif_other;
     }
@@ -1952,7 +1963,7 @@ void hd_read_nd(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/nd/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/nd/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  nd device: name = %s\n    path = %s\n",
@@ -1961,7 +1972,7 @@ void hd_read_nd(hd_data_t *hd_data)
     );
 
     drv_name = NULL;
-    drv = new_str(hd_read_sysfs_link(sf_dev, "driver"));
+    drv = new_str(hd_sysfs_link(hd_data, sf_dev, "driver"));
     if(drv) {
       drv_name = strrchr(drv, '/');
       if(drv_name) drv_name++;
@@ -1974,7 +1985,7 @@ void hd_read_nd(hd_data_t *hd_data)
       ADD2LOG("    modalias = \"%s\"\n", modalias);
     }
 
-    if(hd_read_sysfs_link(sf_dev, "block")) {
+    if(hd_sysfs_link(hd_data, sf_dev, "block")) {
       ADD2LOG("    block device\n");
 
       char *sysfs_id = new_str(hd_sysfs_id(sf_dev));
@@ -600,9 +600,9 @@ void dump_devtree_data(hd_data_t *hd_data)
     if(devtree->edid) {
       ADD2LOG("    EDID record:\n");
       for(u = 0; u < 0x80; u += 0x10) {
-        ADD2LOG("    %02x  ", u);
+        ADD2LOG_DATA("    %02x  ", u);
         hd_log_hex(hd_data, 1, 0x10, devtree->edid + u);
-        ADD2LOG("\n");
+        ADD2LOG_DATA("\n");
       }
     }
 
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "sysfs.h"
+
+/**
+ * @defgroup SYSFSint sysfs device tree
+ * @ingroup libhdInternals
+ * @brief Snapshot of /sys/devices
+ *
+ * One walk over /sys/devices records every device (directory with an
+ * 'uevent' file) together with its subsystem, driver, module, device link,
+ * modalias and device number. Links are resolved textually from readlink(),
+ * so there is no realpath() (an lstat() per path element) per lookup.
+ *
+ * @{
+ */
+
+#define SYSFS_DEVICES		"/sys/devices"
+#define SYSFS_MAX_DEPTH		64
+
+static void sysfs_walk(hd_sysfs_tree_t *tree, int fd, char *path, hd_sysfs_node_t *parent, unsigned depth);
+static hd_sysfs_node_t *sysfs_add_node(hd_sysfs_tree_t *tree, int fd, char *path, hd_sysfs_node_t *parent);
+static char *sysfs_link(int fd, char *dir, char *name);
+static char *sysfs_resolve(char *dir, char *link);
+static void sysfs_hash_node(hd_sysfs_tree_t *tree, hd_sysfs_node_t *node);
+static unsigned sysfs_name_hash(char *subsystem, unsigned len, char *name);
+static hd_sysfs_node_t *sysfs_node_by_name(hd_sysfs_tree_t *tree, char *subsystem, unsigned len, char *name);
+static hd_sysfs_node_t *sysfs_node_by_path(hd_data_t *hd_data, char *path);
+
+
+/*
+ * Get /sys/devices snapshot; it is built on first use.
+ *
+ * It lives until hd_sysfs_tree_done() is called (at the start of a scan and
+ * after loading or unloading modules).
+ */
+hd_sysfs_tree_t *hd_sysfs_tree(hd_data_t *hd_data)
+{
+  hd_sysfs_tree_t *tree;
+  hd_sysfs_node_t *node;
+  int fd;
+
+  if(hd_data->sysfs_tree) return hd_data->sysfs_tree;
+
+  tree = hd_data->sysfs_tree = new_mem(sizeof *tree);
+  tree->last = &tree->list;
+
+  if((fd = open(SYSFS_DEVICES, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+    sysfs_walk(tree, fd, SYSFS_DEVICES, NULL, 0);
+  }
+
+  for(tree->hash_size = 64; tree->hash_size < 2 * tree->nodes; tree->hash_size <<= 1);
+  tree->by_path = new_mem(tree->hash_size * sizeof *tree->by_path);
+  tree->by_name = new_mem(tree->hash_size * sizeof *tree->by_name);
+
+  for(node = tree->list; node; node = node->next) sysfs_hash_node(tree, node);
+
+  ADD2LOG("sysfs: %u devices\n", tree->nodes);
+
+  return tree;
+}
+
+
+/*
+ * Drop /sys/devices snapshot.
+ *
+ * A shared snapshot is only dropped from hd_data; hd_scan_wave() frees it.
+ */
+void hd_sysfs_tree_done(hd_data_t *hd_data)
+{
+  hd_sysfs_tree_t *tree = hd_data->sysfs_tree;
+  hd_sysfs_node_t *node, *next;
+
+  if(!tree) return;
+
+  if(tree->shared) {
+    hd_data->sysfs_tree = NULL;
+    return;
+  }
+
+  for(node = tree->list; node; node = next) {
+    next = node->next;
+    free_mem(node->path);
+    free_mem(node->subsystem);
+    free_mem(node->driver);
+    free_mem(node->module);
+    free_mem(node->modalias);
+    free_mem(node->device);
+    free_mem(node);
+  }
+
+  free_mem(tree->by_path);
+  free_mem(tree->by_name);
+
+  hd_data->sysfs_tree = free_mem(tree);
+}
+
+
+/*
+ * Device by canonical path (with or without leading "/sys").
+ */
+hd_sysfs_node_t *hd_sysfs_node(hd_data_t *hd_data, char *path)
+{
+  hd_sysfs_tree_t *tree;
+  hd_sysfs_node_t *node;
+  char *s = NULL;
+
+  if(!path) return NULL;
+
+  if(strncmp(path, "/sys/", sizeof "/sys/" - 1)) {
+    str_printf(&s, 0, "/sys%s", path);
+    path = s;
+  }
+
+  tree = hd_sysfs_tree(hd_data);
+
+  for(node = tree->by_path[hd_index_hash(path) & (tree->hash_size - 1)]; node; node = node->path_next) {
+    if(!strcmp(node->path, path)) break;
+  }
+
+  free_mem(s);
+
+  return node;
+}
+
+
+/*
+ * Device by subsystem path (e.g. "/sys/bus/pci", "/sys/class/net") and name.
+ */
+hd_sysfs_node_t *hd_sysfs_node_by_name(hd_data_t *hd_data, char *subsystem, char *name)
+{
+  if(!subsystem || !name) return NULL;
+
+  return sysfs_node_by_name(hd_sysfs_tree(hd_data), subsystem, strlen(subsystem), name);
+}
+
+
+/*
+ * Replacement for hd_read_sysfs_link().
+ *
+ * Answers lookups of devices in bus & class directories
+ * ("/sys/bus/pci/devices" + "0000:00:01.0", "/sys/class/net" + "eth0") and
+ * of the 'device', 'driver' and 'subsystem' links of known devices from the
+ * snapshot. Everything else goes to hd_read_sysfs_link().
+ *
+ * The result is valid until the next hd_sysfs_tree_done() or
+ * hd_read_sysfs_link() call.
+ */
+char *hd_sysfs_link(hd_data_t *hd_data, char *base_dir, char *link_name)
+{
+  hd_sysfs_node_t *node;
+  char *s;
+  unsigned len;
+
+  if(!base_dir || !link_name) return NULL;
+
+  /* bus or class directory */
+  len = 0;
+  if(!strncmp(base_dir, "/sys/bus/", sizeof "/sys/bus/" - 1)) {
+    s = base_dir + strlen(base_dir) - (sizeof "/devices" - 1);
+    if(
+      s > base_dir + sizeof "/sys/bus/" - 1 &&
+      !strcmp(s, "/devices") &&
+      strchr(base_dir + sizeof "/sys/bus/" - 1, '/') == s
+    ) len = s - base_dir;
+  }
+  else if(
+    !strncmp(base_dir, "/sys/class/", sizeof "/sys/class/" - 1) &&
+    !strchr(base_dir + sizeof "/sys/class/" - 1, '/')
+  ) {
+    len = strlen(base_dir);
+  }
+  else if(!strcmp(base_dir, "/sys/block")) {
+    base_dir = "/sys/class/block";
+    len = strlen(base_dir);
+  }
+
+  if(len) {
+    if((node = sysfs_node_by_name(hd_sysfs_tree(hd_data), base_dir, len, link_name))) return node->path;
+  }
+  else if((node = sysfs_node_by_path(hd_data, base_dir))) {
+    /* 'device' is a plain file for some buses (e.g. pci) */
+    if(!strcmp(link_name, "device") && node->device) return node->device;
+    /* a driver may have been bound since the snapshot was taken */
+    if(!strcmp(link_name, "driver") && node->driver) return node->driver;
+    if(!strcmp(link_name, "subsystem") && node->subsystem) return node->subsystem;
+  }
+
+  return hd_read_sysfs_link(base_dir, link_name);
+}
+
+
+/*
+ * Device for a canonical path or a class device path
+ * ("/sys/class/net/eth0").
+ */
+hd_sysfs_node_t *sysfs_node_by_path(hd_data_t *hd_data, char *path)
+{
+  char *s;
+
+  if(!strncmp(path, SYSFS_DEVICES "/", sizeof SYSFS_DEVICES)) return hd_sysfs_node(hd_data, path);
+
+  if(!strncmp(path, "/sys/block/", sizeof "/sys/block/" - 1) && !strchr(path + sizeof "/sys/block/" - 1, '/')) {
+    return hd_sysfs_node_by_name(hd_data, "/sys/class/block", path + sizeof "/sys/block/" - 1);
+  }
+
+  if(
+    !strncmp(path, "/sys/class/", sizeof "/sys/class/" - 1) &&
+    (s = strrchr(path, '/')) > path + sizeof "/sys/class/" - 1 &&
+    !memchr(path + sizeof "/sys/class/" - 1, '/', s - path - (sizeof "/sys/class/" - 1))
+  ) {
+    return sysfs_node_by_name(hd_sysfs_tree(hd_data), path, s - path, s + 1);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Add all devices below 'path' (open as 'fd'; closed here).
+ */
+void sysfs_walk(hd_sysfs_tree_t *tree, int fd, char *path, hd_sysfs_node_t *parent, unsigned depth)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct stat sbuf;
+  str_list_t *sl, *sl0 = NULL;
+  char *s = NULL;
+  int fd2, type, is_dev = 0;
+
+  if(!(dir = fdopendir(fd))) {
+    close(fd);
+    return;
+  }
+
+  while((de = readdir(dir))) {
+    if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+    type = de->d_type;
+    if(type == DT_UNKNOWN && !fstatat(fd, de->d_name, &sbuf, AT_SYMLINK_NOFOLLOW)) {
+      type = S_ISDIR(sbuf.st_mode) ? DT_DIR : S_ISREG(sbuf.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    if(type == DT_DIR) {
+      add_str_list(&sl0, de->d_name);
+    }
+    else if(type == DT_REG && !strcmp(de->d_name, "uevent")) {
+      is_dev = 1;
+    }
+  }
+
+  if(is_dev) parent = sysfs_add_node(tree, fd, path, parent);
+
+  if(depth < SYSFS_MAX_DEPTH) {
+    for(sl = sl0; sl; sl = sl->next) {
+      fd2 = openat(fd, sl->str, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if(fd2 < 0) continue;
+      str_printf(&s, 0, "%s/%s", path, sl->str);
+      sysfs_walk(tree, fd2, s, parent, depth + 1);
+    }
+  }
+
+  closedir(dir);
+
+  free_mem(s);
+  free_str_list(sl0);
+}
+
+
+/*
+ * Add device at 'path' (open as 'fd').
+ */
+hd_sysfs_node_t *sysfs_add_node(hd_sysfs_tree_t *tree, int fd, char *path, hd_sysfs_node_t *parent)
+{
+  hd_sysfs_node_t *node;
+  char buf[4096], *s, *t;
+  unsigned major = 0, minor = 0;
+  int fd2, has_dev = 0;
+  ssize_t len;
+
+  node = new_mem(sizeof *node);
+  node->path = new_str(path);
+  node->name = strrchr(node->path, '/') + 1;
+  node->parent = parent;
+
+  node->subsystem = sysfs_link(fd, path, "subsystem");
+  node->driver = sysfs_link(fd, path, "driver");
+  if(node->driver) node->module = sysfs_link(fd, node->driver, "driver/module");
+  node->device = sysfs_link(fd, path, "device");
+
+  if((fd2 = openat(fd, "uevent", O_RDONLY | O_CLOEXEC)) >= 0) {
+    len = read(fd2, buf, sizeof buf - 1);
+    close(fd2);
+    buf[len > 0 ? len : 0] = 0;
+
+    for(s = buf; (t = strsep(&s, "\n"));) {
+      if(!strncmp(t, "MAJOR=", sizeof "MAJOR=" - 1)) {
+        major = strtoul(t + sizeof "MAJOR=" - 1, NULL, 10);
+        has_dev |= 1;
+      }
+      else if(!strncmp(t, "MINOR=", sizeof "MINOR=" - 1)) {
+        minor = strtoul(t + sizeof "MINOR=" - 1, NULL, 10);
+        has_dev |= 2;
+      }
+      else if(!strncmp(t, "MODALIAS=", sizeof "MODALIAS=" - 1)) {
+        node->modalias = new_str(t + sizeof "MODALIAS=" - 1);
+      }
+    }
+  }
+
+  if(has_dev == 3) node->dev = makedev(major, minor);
+
+  *tree->last = node;
+  tree->last = &node->next;
+  tree->nodes++;
+
+  /* tree is already in use: hash it, too */
+  if(tree->by_path) sysfs_hash_node(tree, node);
+
+  return node;
+}
+
+
+/*
+ * Canonical target of link 'name' in 'dir' (open as 'fd').
+ *
+ * Note: the directory 'name' is relative to is 'dir' for a plain name; for
+ * "driver/module" pass the resolved driver path as 'dir'.
+ */
+char *sysfs_link(int fd, char *dir, char *name)
+{
+  char buf[PATH_MAX];
+  ssize_t len;
+
+  len = readlinkat(fd, name, buf, sizeof buf - 1);
+  if(len <= 0) return NULL;
+  buf[len] = 0;
+
+  return sysfs_resolve(dir, buf);
+}
+
+
+/*
+ * Combine 'dir' and 'link' and remove "." and ".." path elements.
+ *
+ * This is fine in sysfs as there are no links between 'dir' and the link
+ * target (the kernel uses relative links).
+ */
+char *sysfs_resolve(char *dir, char *link)
+{
+  char *path = NULL, *s, *t, *p;
+
+  if(*link == '/') {
+    str_printf(&path, 0, "%s", link);
+  }
+  else {
+    str_printf(&path, 0, "%s/%s", dir, link);
+  }
+
+  for(p = s = path; *s;) {
+    while(*s == '/') s++;
+    if(!*s) break;
+    for(t = s; *t && *t != '/'; t++);
+
+    if(t - s == 1 && *s == '.') {
+      /* skip */
+    }
+    else if(t - s == 2 && s[0] == '.' && s[1] == '.') {
+      while(p > path && *--p != '/');
+    }
+    else {
+      *p++ = '/';
+      memmove(p, s, t - s);
+      p += t - s;
+    }
+
+    s = t;
+  }
+
+  if(p == path) *p++ = '/';
+  *p = 0;
+
+  return path;
+}
+
+
+void sysfs_hash_node(hd_sysfs_tree_t *tree, hd_sysfs_node_t *node)
+{
+  unsigned u;
+
+  u = hd_index_hash(node->path) & (tree->hash_size - 1);
+  node->path_next = tree->by_path[u];
+  tree->by_path[u] = node;
+
+  if(node->subsystem) {
+    u = sysfs_name_hash(node->subsystem, strlen(node->subsystem), node->name) & (tree->hash_size - 1);
+    node->name_next = tree->by_name[u];
+    tree->by_name[u] = node;
+  }
+}
+
+
+unsigned sysfs_name_hash(char *subsystem, unsigned len, char *name)
+{
+  unsigned h = hd_index_hash(name);
+
+  while(len--) {
+    h ^= (unsigned char) *subsystem++;
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+
+hd_sysfs_node_t *sysfs_node_by_name(hd_sysfs_tree_t *tree, char *subsystem, unsigned len, char *name)
+{
+  hd_sysfs_node_t *node;
+
+  node = tree->by_name[sysfs_name_hash(subsystem, len, name) & (tree->hash_size - 1)];
+
+  for(; node; node = node->name_next) {
+    if(
+      !strcmp(node->name, name) &&
+      !strncmp(node->subsystem, subsystem, len) &&
+      !node->subsystem[len]
+    ) break;
+  }
+
+  return node;
+}
+
+/** @} */
+
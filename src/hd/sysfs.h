@@ -0,0 +1,5 @@
+hd_sysfs_tree_t *hd_sysfs_tree(hd_data_t *hd_data);
+void hd_sysfs_tree_done(hd_data_t *hd_data);
+hd_sysfs_node_t *hd_sysfs_node(hd_data_t *hd_data, char *path);
+hd_sysfs_node_t *hd_sysfs_node_by_name(hd_data_t *hd_data, char *subsystem, char *name);
+char *hd_sysfs_link(hd_data_t *hd_data, char *base_dir, char *link_name);
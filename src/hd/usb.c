@@ -10,6 +10,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "sysfs.h"
 #include "hddb.h"
 #include "usb.h"
 
@@ -41,6 +42,12 @@ static void get_printer_devs(hd_data_t *hd_data);
 static void read_usb_lp(hd_data_t *hd_data, hd_t *hd);
 static void get_serial_devs(hd_data_t *hd_data);
 
+/* usb device attributes read by get_usb_devs() */
+static const char *usb_dev_attrs[] = {
+  "bDeviceClass", "bDeviceSubClass", "bDeviceProtocol", "idVendor", "idProduct",
+  "manufacturer", "product", "serial", "bcdDevice", "speed", NULL
+};
+
 void hd_scan_sysfs_usb(hd_data_t *hd_data)
 {
   if(!hd_probe_feature(hd_data, pr_usb)) return;
@@ -89,7 +96,8 @@ void get_usb_devs(hd_data_t *hd_data)
   hd_res_t *res;
   size_t l;
   str_list_t *sf_bus, *sf_bus_e;
-  char *sf_dev, *sf_dev_2;
+  char *sf_dev;
+  hd_sysfs_dir_t *sf_dir = NULL;
 
   sf_bus = read_dir("/sys/bus/usb/devices", 'l');
 
@@ -99,7 +107,7 @@ void get_usb_devs(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = hd_read_sysfs_link("/sys/bus/usb/devices", sf_bus_e->str);
+    sf_dev = hd_sysfs_link(hd_data, "/sys/bus/usb/devices", sf_bus_e->str);
 
     if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "bNumInterfaces"), &ul0, 0)) {
       add_str_list(&usb_devs, sf_dev);
@@ -108,7 +116,7 @@ void get_usb_devs(hd_data_t *hd_data)
   }
 
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
-    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/usb/devices", sf_bus_e->str));
+    sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/bus/usb/devices", sf_bus_e->str));
 
     ADD2LOG(
       "  usb device: name = %s\n    path = %s\n",
@@ -117,6 +125,7 @@ void get_usb_devs(hd_data_t *hd_data)
     );
 
     if(
+      hd_sysfs_in_scope(hd_data, sf_dev) &&
       hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "bInterfaceNumber"), &ul0, 16)
     ) {
       hd = add_hd_entry(hd_data, __LINE__, 0);
@@ -173,64 +182,66 @@ void get_usb_devs(hd_data_t *hd_data)
 
       if(s) {
         ADD2LOG("    if: %s @ %s\n", hd->sysfs_bus_id, hd_sysfs_id(s));
-        sf_dev_2 = new_str(s);
-        if(sf_dev_2) {
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "bDeviceClass"), &ul0, 16)) {
-            usb->d_cls = ul0;
-            ADD2LOG("    bDeviceClass = %u\n", usb->d_cls);
-          }
+        /* interfaces of a device are usually listed together: keep its attributes */
+        if(!sf_dir || strcmp(sf_dir->path, s)) {
+          sf_dir = hd_sysfs_close(sf_dir);
+          sf_dir = hd_sysfs_open(s);
+          hd_sysfs_read_attrs(sf_dir, usb_dev_attrs);
+        }
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "bDeviceSubClass"), &ul0, 16)) {
-            usb->d_sub = ul0;
-            ADD2LOG("    bDeviceSubClass = %u\n", usb->d_sub);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "bDeviceClass", NULL), &ul0, 16)) {
+          usb->d_cls = ul0;
+          ADD2LOG("    bDeviceClass = %u\n", usb->d_cls);
+        }
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "bDeviceProtocol"), &ul0, 16)) {
-            usb->d_prot = ul0;
-            ADD2LOG("    bDeviceProtocol = %u\n", usb->d_prot);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "bDeviceSubClass", NULL), &ul0, 16)) {
+          usb->d_sub = ul0;
+          ADD2LOG("    bDeviceSubClass = %u\n", usb->d_sub);
+        }
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "idVendor"), &ul0, 16)) {
-            usb->vendor = ul0;
-            ADD2LOG("    idVendor = 0x%04x\n", usb->vendor);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "bDeviceProtocol", NULL), &ul0, 16)) {
+          usb->d_prot = ul0;
+          ADD2LOG("    bDeviceProtocol = %u\n", usb->d_prot);
+        }
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "idProduct"), &ul0, 16)) {
-            usb->device = ul0;
-            ADD2LOG("    idProduct = 0x%04x\n", usb->device);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "idVendor", NULL), &ul0, 16)) {
+          usb->vendor = ul0;
+          ADD2LOG("    idVendor = 0x%04x\n", usb->vendor);
+        }
 
-          if((s = get_sysfs_attr_by_path(sf_dev_2, "manufacturer"))) {
-            usb->manufact = canon_str(s, strlen(s));
-            ADD2LOG("    manufacturer = \"%s\"\n", usb->manufact);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "idProduct", NULL), &ul0, 16)) {
+          usb->device = ul0;
+          ADD2LOG("    idProduct = 0x%04x\n", usb->device);
+        }
 
-          if((s = get_sysfs_attr_by_path(sf_dev_2, "product"))) {
-            usb->product = canon_str(s, strlen(s));
-            ADD2LOG("    product = \"%s\"\n", usb->product);
-          }
+        if((s = hd_sysfs_attr(sf_dir, "manufacturer", NULL))) {
+          usb->manufact = canon_str(s, strlen(s));
+          ADD2LOG("    manufacturer = \"%s\"\n", usb->manufact);
+        }
 
-          if((s = get_sysfs_attr_by_path(sf_dev_2, "serial"))) {
-            usb->serial = canon_str(s, strlen(s));
-            ADD2LOG("    serial = \"%s\"\n", usb->serial);
-          }
+        if((s = hd_sysfs_attr(sf_dir, "product", NULL))) {
+          usb->product = canon_str(s, strlen(s));
+          ADD2LOG("    product = \"%s\"\n", usb->product);
+        }
 
-          if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev_2, "bcdDevice"), &ul0, 16)) {
-            usb->rev = ul0;
-            ADD2LOG("    bcdDevice = %04x\n", usb->rev);
-          }
+        if((s = hd_sysfs_attr(sf_dir, "serial", NULL))) {
+          usb->serial = canon_str(s, strlen(s));
+          ADD2LOG("    serial = \"%s\"\n", usb->serial);
+        }
 
-          if((s = get_sysfs_attr_by_path(sf_dev_2, "speed"))) {
-            s = canon_str(s, strlen(s));
-            if(!strcmp(s, "1.5")) usb->speed = 15*100000;
-            else if(!strcmp(s, "12")) usb->speed = 12*1000000;
-            else if(!strcmp(s, "480")) usb->speed = 480*1000000;
-            ADD2LOG("    speed = \"%s\"\n", s);
-            s = free_mem(s);
-          }
+        if(hd_attr_uint(hd_sysfs_attr(sf_dir, "bcdDevice", NULL), &ul0, 16)) {
+          usb->rev = ul0;
+          ADD2LOG("    bcdDevice = %04x\n", usb->rev);
+        }
 
-          sf_dev_2 = free_mem(sf_dev_2);
+        if((s = hd_sysfs_attr(sf_dir, "speed", NULL))) {
+          s = canon_str(s, strlen(s));
+          if(!strcmp(s, "1.5")) usb->speed = 15*100000;
+          else if(!strcmp(s, "12")) usb->speed = 12*1000000;
+          else if(!strcmp(s, "480")) usb->speed = 480*1000000;
+          ADD2LOG("    speed = \"%s\"\n", s);
+          s = free_mem(s);
         }
       }
 
@@ -276,6 +287,7 @@ void get_usb_devs(hd_data_t *hd_data)
     sf_dev = free_mem(sf_dev);
   }
 
+  sf_dir = hd_sysfs_close(sf_dir);
   sf_bus = free_str_list(sf_bus);
 
   /* connect usb devices to each other */
@@ -532,11 +544,11 @@ void add_input_dev(hd_data_t *hd_data, char *name)
     return;
   }
 
-  sf_dev = new_str(hd_read_sysfs_link(name, "device"));
+  sf_dev = new_str(hd_sysfs_link(hd_data, name, "device"));
 
   if(sf_dev) {
     /* new kernel (2.6.24): one more level */
-    s = new_str(hd_read_sysfs_link(sf_dev, "device"));
+    s = new_str(hd_sysfs_link(hd_data, sf_dev, "device"));
     if(s) {
       free_mem(sf_dev);
       sf_dev = s;
@@ -546,14 +558,14 @@ void add_input_dev(hd_data_t *hd_data, char *name)
     if(bus_id) bus_id++;
 
     sf_drv_name = NULL;
-    if((sf_drv = hd_read_sysfs_link(sf_dev, "driver"))) {
+    if((sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver"))) {
       sf_drv_name = strrchr(sf_drv, '/');
       if(sf_drv_name) sf_drv_name++;
       sf_drv_name = new_str(sf_drv_name);
     }
 
     bus_name = NULL;
-    if((s = hd_read_sysfs_link(sf_dev, "subsystem"))) {
+    if((s = hd_sysfs_link(hd_data, sf_dev, "subsystem"))) {
       bus_name = strrchr(s, '/');
       if(bus_name) bus_name++;
       bus_name = new_str(bus_name);
@@ -649,7 +661,7 @@ void get_input_devs(hd_data_t *hd_data)
       str_printf(&sf_dev, 0, "/sys/class/input/%s", sf_dir_e->str);
     }
     else {
-      sf_dev = new_str(hd_read_sysfs_link("/sys/class/input", sf_dir_e->str));
+      sf_dev = new_str(hd_sysfs_link(hd_data, "/sys/class/input", sf_dir_e->str));
     }
 
     add_input_dev(hd_data, sf_dev);
@@ -700,21 +712,21 @@ void get_printer_devs(hd_data_t *hd_data)
       ADD2LOG("    dev = %u:%u\n", u1, u2);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
 
     if(sf_dev) {
       bus_id = sf_dev ? strrchr(sf_dev, '/') : NULL;
       if(bus_id) bus_id++;
 
       sf_drv_name = NULL;
-      if((sf_drv = hd_read_sysfs_link(sf_dev, "driver"))) {
+      if((sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver"))) {
         sf_drv_name = strrchr(sf_drv, '/');
         if(sf_drv_name) sf_drv_name++;
         sf_drv_name = new_str(sf_drv_name);
       }
 
       bus_name = NULL;
-      if((s = hd_read_sysfs_link(sf_dev, "bus"))) {
+      if((s = hd_sysfs_link(hd_data, sf_dev, "bus"))) {
         bus_name = strrchr(s, '/');
         if(bus_name) bus_name++;
         bus_name = new_str(bus_name);
@@ -866,21 +878,21 @@ void get_serial_devs(hd_data_t *hd_data)
       ADD2LOG("    dev = %u:%u\n", u1, u2);
     }
 
-    sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
+    sf_dev = new_str(hd_sysfs_link(hd_data, sf_cdev, "device"));
 
     if(sf_dev) {
       bus_id = sf_dev ? strrchr(sf_dev, '/') : NULL;
       if(bus_id) bus_id++;
 
       sf_drv_name = NULL;
-      if((sf_drv = hd_read_sysfs_link(sf_dev, "driver"))) {
+      if((sf_drv = hd_sysfs_link(hd_data, sf_dev, "driver"))) {
         sf_drv_name = strrchr(sf_drv, '/');
         if(sf_drv_name) sf_drv_name++;
         sf_drv_name = new_str(sf_drv_name);
       }
 
       bus_name = NULL;
-      if((s = hd_read_sysfs_link(sf_dev, "bus"))) {
+      if((s = hd_sysfs_link(hd_data, sf_dev, "bus"))) {
         bus_name = strrchr(s, '/');
         if(bus_name) bus_name++;
         bus_name = new_str(bus_name);
@@ -198,6 +198,7 @@ void join_items_by_key(list_t *hd);
 void remove_unimportant_items(list_t *hd);
 
 void write_cfile(FILE *f, list_t *hd);
+void write_binfile(FILE *f, list_t *hd);
 
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
@@ -218,6 +219,7 @@ struct option options[] = {
   { "join-keys-first", 0, NULL, 14},
   { "combine", 0, NULL, 15},
   { "no-range", 0, NULL, 16},
+  { "bin", 1, NULL, 17},
   { }
 };
 
@@ -242,6 +244,7 @@ struct {
   char *logfile;
   char *outfile;
   char *cfile;
+  char *binfile;
 } opt = {
   logfile: "hd.log",
   outfile: "hd.ids"
@@ -258,7 +261,7 @@ int main(int argc, char **argv)
 {
   int i, close_log = 0, close_cfile = 0;
   item_t *item;
-  FILE *cfile;
+  FILE *cfile, *binfile;
 
   for(opterr = 0; (i = getopt_long(argc, argv, "", options, NULL)) != -1; ) {
     switch(i) {
@@ -328,6 +331,11 @@ int main(int argc, char **argv)
         opt.no_range = 1;
         break;
 
+      case 17:
+        opt.binfile = optarg;
+        if(!*opt.binfile) opt.binfile = NULL;
+        break;
+
       default:
         fprintf(stderr,
           "Usage: check_hd [options] files\n"
@@ -341,6 +349,8 @@ int main(int argc, char **argv)
           "  --join-keys-first\twhen combining similar items, join entries with\n"
           "  \t\t\tcommon keys first (default is common values first)\n"
           "  --cfile file\t\tcreate C file to be included in libhd\n"
+          "  --bin file\t\tcreate binary data base to be mapped by libhd\n"
+          "  \t\t\t(hd.ids.bin; pass files in libhd's parse order: ids/*, then hd.ids)\n"
           "  --no-compact\t\tdon't try to make C version as small as possible\n"
           "  --out file\t\twrite results to file, default is \"hd.ids\"\n"
           "  --log file\t\twrite log info to file, default is \"hd.log\"\n\n"
@@ -442,6 +452,24 @@ int main(int argc, char **argv)
     if(close_cfile) fclose(cfile);
   }
 
+  if(opt.binfile) {
+    binfile = fopen(opt.binfile, "w");
+    if(!binfile) {
+      perror(opt.binfile);
+      return 3;
+    }
+
+    /* already done for the C file */
+    if(!opt.cfile) split_items(&hd);
+
+    write_binfile(binfile, &hd);
+
+    if(fclose(binfile)) {
+      perror(opt.binfile);
+      return 3;
+    }
+  }
+
   fprintf(logfh, "- statistics\n");
   write_stats(logfh);
   if(logfh != stdout) {
@@ -2909,3 +2937,38 @@ void write_cfile(FILE *f, list_t *hd)
 }
 
 
+/*
+ * Write data base in the binary format libhd can map directly (see
+ * hddb_bin_header_t).
+ */
+void write_binfile(FILE *f, list_t *hd)
+{
+  hddb_data_t hddb = {};
+  hddb_bin_header_t h = {};
+
+  fprintf(logfh, "- building binary version\n");
+  fflush(logfh);
+
+  hddb_init(&hddb, hd);
+
+  h.magic = HDDB_BIN_MAGIC;
+  h.version = HDDB_BIN_VERSION;
+  h.list_ofs = sizeof h;
+  h.list_len = hddb.list_len;
+  h.ids_ofs = h.list_ofs + hddb.list_len * sizeof *hddb.list;
+  h.ids_len = hddb.ids_len;
+  h.strings_ofs = h.ids_ofs + hddb.ids_len * sizeof *hddb.ids;
+  h.strings_len = hddb.strings_len;
+  h.size = h.strings_ofs + hddb.strings_len;
+
+  fprintf(logfh, "  db size: %u bytes\n", h.size);
+
+  fwrite(&h, sizeof h, 1, f);
+  if(hddb.list_len) fwrite(hddb.list, sizeof *hddb.list, hddb.list_len, f);
+  if(hddb.ids_len) fwrite(hddb.ids, sizeof *hddb.ids, hddb.ids_len, f);
+  if(hddb.strings_len) fwrite(hddb.strings, 1, hddb.strings_len, f);
+
+  free_mem(hddb.list);
+  free_mem(hddb.ids);
+  free_mem(hddb.strings);
+}